@@ -50,6 +50,7 @@
 #include <inc/hw_gpio.h>
 
 #include <driverlib/gpio.h>
+#include <driverlib/hibernate.h>
 #include <driverlib/i2c.h>
 #include <driverlib/pin_map.h>
 #include <driverlib/pwm.h>
@@ -74,7 +75,8 @@
 #elif defined(__GNUC__)
 __attribute__ ((aligned (1024)))
 #endif
-static tDMAControlTable dmaControlTable[32];
+/* Primary and alternate structures, for the UART's ping-pong transfers */
+static tDMAControlTable dmaControlTable[64];
 static bool dmaInitialized = false;
 
 /* Hwi_Struct used in the initDMA Hwi_construct call */
@@ -205,6 +207,28 @@ void EK_TM4C123GXL_initGPIO(void)
     GPIO_init();
 }
 
+/*
+ *  =============================== Hibernate ===============================
+ */
+/*
+ *  ======== EK_TM4C123GXL_initHibernate ========
+ */
+void EK_TM4C123GXL_initHibernate(void)
+{
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_HIBERNATE);
+    HibernateEnableExpClk(SysCtlClockGet());
+
+    /*
+     * The hibernation module keeps running through a reset. Only configure
+     * the 32.768kHz oscillator and RTC if it is not already running, so the
+     * wall clock time is retained.
+     */
+    if (!HibernateIsActive()) {
+        HibernateClockConfig(HIBERNATE_OSC_LOWDRIVE);
+    }
+    HibernateRTCEnable();
+}
+
 /*
  *  =============================== I2C ===============================
  */
@@ -182,6 +182,15 @@ extern void EK_TM4C123GXL_initGeneral(void);
  */
 extern void EK_TM4C123GXL_initGPIO(void);
 
+/*!
+ *  @brief  Initialize board specific hibernation module settings
+ *
+ *  This function enables the hibernation module, its 32.768kHz oscillator,
+ *  and the RTC. If the hibernation module is already running (the MCU was
+ *  reset without losing power), the RTC value is retained.
+ */
+extern void EK_TM4C123GXL_initHibernate(void);
+
 /*!
  *  @brief  Initialize board specific I2C settings
  *
@@ -36,6 +36,7 @@ static void move_line_index(CLIContext *context, bool forwards);
 void cli_context_init(CLIContext *context) {
     int i;
     context->cursor = NULL;
+    context->cli_wake = NULL;
     context->line_idx = 0;
     for (i = 0; i < CLI_BUFCNT; i++) {
         // Set the line length
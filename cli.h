@@ -30,6 +30,9 @@ typedef struct {
     int (*cli_read)(char *, int);
     /*! write data for output on the CLI. Returns number of bytes written. */
     int (*cli_write)(char *, int);
+    /*! wake cli_read to write out forwarded log data, or NULL if it can't
+     * be woken. Safe to call from any task. */
+    void (*cli_wake)(void);
     /*! current pointer location */
     char *cursor;
     /*! line buffers */
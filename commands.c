@@ -3,14 +3,38 @@
  * Implements CLI command handlers.
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* TI-RTOS Header files */
 #include <ti/drivers/GPIO.h>
 #include <ti/drivers/UART.h>
 
+/* BIOS Header files */
+#include <ti/sysbios/knl/Task.h>
+#include <ti/sysbios/utils/Load.h>
+
 #include "cli.h"
+#include "config.h"
+#include "filter.h"
+#include "flash_log.h"
+#include "latency.h"
+#include "lock.h"
+#include "persist.h"
+#include "pipeline.h"
+#include "pipeline_wdt.h"
+#include "power.h"
+#include "profile.h"
 #include "sd_card.h"
+#include "status_led.h"
+#include "supervisor.h"
+#include "timebase.h"
+#include "timesync.h"
+#include "trace.h"
 #include "uart_logger_task.h"
 
 /* Board-specific functions */
@@ -32,6 +56,10 @@ typedef struct {
  * Add any other delimeters to this string.
  */
 #define DELIMETER " "
+// File the flash log is copied to.
+#define FLASHLOG_FILE DRIVE_PREFIX "FLASHLOG.TXT"
+// Time allowed after a stress run, past sync_max_ms, for the writer's sync.
+#define STRESS_SETTLE_MS 200
 
 static int help(CLIContext *ctx, char **argv, int argc);
 static int mount(CLIContext *ctx, char **argv, int argc);
@@ -44,6 +72,26 @@ static int connect_log(CLIContext *ctx, char **argv, int argc);
 static int disconnect_log(CLIContext *ctx, char **argv, int argc);
 static int realtime_terminal(CLIContext *ctx, char **argv, int argc);
 static int write_ts(CLIContext *ctx, char **argv, int argc);
+static int settime(CLIContext *ctx, char **argv, int argc);
+static int tsync(CLIContext *ctx, char **argv, int argc);
+static int prof(CLIContext *ctx, char **argv, int argc);
+static int trace(CLIContext *ctx, char **argv, int argc);
+static int latency(CLIContext *ctx, char **argv, int argc);
+static int locks(CLIContext *ctx, char **argv, int argc);
+static int ingest(CLIContext *ctx, char **argv, int argc);
+static int stress(CLIContext *ctx, char **argv, int argc);
+static int cpuload(CLIContext *ctx, char **argv, int argc);
+static int trigger(CLIContext *ctx, char **argv, int argc);
+static int rotate(CLIContext *ctx, char **argv, int argc);
+static int wdt(CLIContext *ctx, char **argv, int argc);
+static int power(CLIContext *ctx, char **argv, int argc);
+static int flashlog(CLIContext *ctx, char **argv, int argc);
+static int persist(CLIContext *ctx, char **argv, int argc);
+static int config(CLIContext *ctx, char **argv, int argc);
+static int levels(CLIContext *ctx, char **argv, int argc);
+static int filter(CLIContext *ctx, char **argv, int argc);
+static int panic(CLIContext *ctx, char **argv, int argc);
+static bool parse_number(const char *arg, uint64_t *value);
 
 /**
  * Declaration of commands. Syntax is as follows:
@@ -68,7 +116,72 @@ const CmdEntry COMMANDS[] = {
     {"write_sd", sdwrite, "Writes provided string to the SD card"},
     {"filesize", logfile_size, "Gets the size of the log file in bytes"},
     {"write_timestamp", write_ts, "Writes a timestamp to the SD card log"},
-    {"connect_log", connect_log, "Connects to the UART console being logged"},
+    {"settime", settime,
+     "Sets the wall clock time: \"settime [seconds since unix epoch]\".\r\n"
+     "With no arguments, prints the current wall clock time and uptime"},
+    {"tsync", tsync,
+     "Clock sync exchange with a host, see tools/timesync.py.\r\n"
+     "\"tsync req [seq]\" starts an exchange, \"tsync done [seq] [t1] [t4]\" "
+     "completes it.\r\nWith no arguments, prints the latest estimate"},
+    {"prof", prof,
+     "Prints hot path profiling statistics (debug builds only).\r\n"
+     "\"prof reset\" clears the statistics"},
+    {"trace", trace,
+     "Pipeline event trace: \"trace dump\" or \"trace clear\".\r\n"
+     "Decode dumps with tools/trace_decode.py"},
+    {"latency", latency,
+     "Prints the UART RX to durable storage latency distribution.\r\n"
+     "\"latency reset\" clears it"},
+    {"locks", locks,
+     "Prints lock contention statistics per lock and task (debug builds "
+     "only).\r\n\"locks reset\" clears the statistics"},
+    {"ingest", ingest,
+     "Prints UART ingest statistics: blocks, dropped bytes, receive errors, "
+     "the longest time spent in the UART interrupt, and its share of the "
+     "CPU, to compare the uDMA and interrupt paths.\r\n\"ingest reset\" "
+     "clears them"},
+    {"stress", stress,
+     "Runs heavy SD card commands from the console, then reports ingest "
+     "statistics and the RX to durable latency of data logged meanwhile: "
+     "\"stress [iterations]\""},
+    {"cpuload", cpuload,
+     "Prints the CPU load over the last load window, and the ingest path"},
+    {"trigger", trigger,
+     "Writes a trigger marker to the log and syncs it: \"trigger [text]\""},
+    {"rotate", rotate, "Moves logging to the next LOG_NNNN.TXT file"},
+    {"wdt", wdt,
+     "Prints the pipeline watchdog state, the last reset cause, and the last "
+     "recorded stall"},
+    {"power", power,
+     "Prints idle sleep statistics and the RX wake latency.\r\n"
+     "\"power reset\" clears them, \"power sleep on|off\" sets idle sleep, "
+     "\"power leds on|off\" sets the status LEDs"},
+    {"flashlog", flashlog,
+     "Prints the state of the emergency flash log, captured while the SD "
+     "card is unmounted.\r\n\"flashlog copy\" appends it to FLASHLOG.TXT "
+     "on the SD card, \"flashlog erase\" clears it"},
+    {"persist", persist,
+     "Prints the state kept in EEPROM across resets: session, lifetime "
+     "logged and dropped bytes, and the log file.\r\n\"persist save\" "
+     "writes a checkpoint now"},
+    {"config", config,
+     "Prints the config values and their limits.\r\n\"config [key] [value]\" "
+     "sets a value, or clears a text value if none is given, \"config load\" "
+     "rereads LOGGER.CFG, \"config save\" writes the current values to it"},
+    {"levels", levels,
+     "Prints the lines seen at each kernel log level, when the \"levels\" "
+     "config value is on.\r\n\"levels reset\" clears the counts"},
+    {"filter", filter,
+     "Prints the line filter rules and the lines each decided on.\r\n"
+     "\"filter load\" rereads FILTERS.TXT, \"filter reset\" clears the "
+     "counts"},
+    {"panic", panic,
+     "Copies the log around now to a PANIC_NNNN.TXT snapshot, as the "
+     "\"panic_pattern\" config value does"},
+    {"connect_log", connect_log,
+     "Connects to the UART console being logged.\r\n\"connect_log [match "
+     "text] [sample N] [rate N]\" only shows lines holding text, one in N "
+     "of them, and at most N per second, noting lines suppressed"},
     {"disconnect_log", disconnect_log,
      "Disconnects from the UART console being logged"},
     {"rtt", realtime_terminal,
@@ -84,7 +197,7 @@ const CmdEntry COMMANDS[] = {
  */
 int handle_command(CLIContext *ctx, char *cmd) {
     const CmdEntry *entry;
-    int argc;
+    int argc, ret;
     char *arguments[MAX_ARGC], *saveptr, cmd_buf[CLI_MAX_LINE + 1];
     strncpy(cmd_buf, cmd, CLI_MAX_LINE);
     // The parser interprets a space as a delimeter between arguments.
@@ -102,7 +215,11 @@ int handle_command(CLIContext *ctx, char *cmd) {
     entry = COMMANDS;
     while (entry->cmd_name != NULL) {
         if (strncmp(entry->cmd_name, arguments[0], CLI_MAX_LINE) == 0) {
-            return entry->cmd_fxn(ctx, arguments, argc);
+            // The watchdog checks the console while a command runs.
+            wdt_busy(WDT_STAGE_CONSOLE);
+            ret = entry->cmd_fxn(ctx, arguments, argc);
+            wdt_idle(WDT_STAGE_CONSOLE);
+            return ret;
         }
         entry++;
     }
@@ -198,6 +315,7 @@ static int unmount(CLIContext *ctx, char **argv, int argc) {
 static int sdstatus(CLIContext *ctx, char **argv, int argc) {
     cli_printf(ctx, "SD card is %s\r\n",
                sd_card_mounted() ? "mounted" : "unmounted");
+    cli_printf(ctx, "Log file: %s\r\n", log_file_name());
     cli_printf(ctx, "SD card power: %s\r\n",
                GPIO_read(Board_SDCARD_VCC) ? "on" : "off");
     return 0;
@@ -269,14 +387,47 @@ static int logfile_size(CLIContext *ctx, char **argv, int argc) {
 /**
  * Connects directly to the UART device being logged from. Useful for
  * situations where the logged device exposes a terminal, and you'd like to
- * access it.
+ * access it. With options, only some lines are shown, so a fast target can
+ * be followed on the console. What is stored is not affected.
  * @param ctx: CLI context to print to
  * @param argv list of arguments
  * @param argc argument count
  * @return 0 on success, or another value on failure
  */
 static int connect_log(CLIContext *ctx, char **argv, int argc) {
-    if (enable_log_forwarding(ctx) != 0) {
+    ForwardOptions options = {"", 1, 0};
+    unsigned long value;
+    char *end;
+    int i;
+    // Options come in pairs of a name and its value.
+    for (i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            cli_printf(ctx, "Unsupported arguments\r\n");
+            return 255;
+        }
+        if (strcmp(argv[i], "match") == 0) {
+            if (strlen(argv[i + 1]) >= sizeof(options.match)) {
+                cli_printf(ctx, "Match text is too long\r\n");
+                return 255;
+            }
+            strcpy(options.match, argv[i + 1]);
+            continue;
+        }
+        value = strtoul(argv[i + 1], &end, 10);
+        if (end == argv[i + 1] || *end != '\0' || value == 0) {
+            cli_printf(ctx, "Invalid value %s\r\n", argv[i + 1]);
+            return 255;
+        }
+        if (strcmp(argv[i], "sample") == 0) {
+            options.sample = value;
+        } else if (strcmp(argv[i], "rate") == 0) {
+            options.max_rate = value;
+        } else {
+            cli_printf(ctx, "Unsupported arguments\r\n");
+            return 255;
+        }
+    }
+    if (enable_log_forwarding(ctx, argc > 1 ? &options : NULL) != 0) {
         cli_printf(ctx, "Could not enable log forwarding\r\n");
         return 255;
     } else {
@@ -315,7 +466,7 @@ static int disconnect_log(CLIContext *ctx, char **argv, int argc) {
 static int realtime_terminal(CLIContext *ctx, char **argv, int argc) {
     char input;
     // First, enable log forwarding.
-    if (enable_log_forwarding(ctx) != 0) {
+    if (enable_log_forwarding(ctx, NULL) != 0) {
         cli_printf(ctx, "Could not start terminal, another console is using "
                         "log forwarding\r\n");
         return 255;
@@ -326,7 +477,10 @@ static int realtime_terminal(CLIContext *ctx, char **argv, int argc) {
      */
     cli_printf(ctx, "Starting real time terminal, press CTRL+E to exit\r\n");
     while (1) {
+        // Waiting for the user is not a stall.
+        wdt_idle(WDT_STAGE_CONSOLE);
         ctx->cli_read(&input, 1);
+        wdt_busy(WDT_STAGE_CONSOLE);
         if (input == 5) { // Corresponds to CTRL+E
             break;
         }
@@ -355,4 +509,683 @@ static int write_ts(CLIContext *ctx, char **argv, int argc) {
         return 255;
     }
     return 0;
+}
+
+/**
+ * Sets or reports the wall clock time kept by the RTC.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int settime(CLIContext *ctx, char **argv, int argc) {
+    char wall_buf[32];
+    char *end;
+    unsigned long seconds;
+    uint64_t uptime_us;
+    if (argc == 2) {
+        seconds = strtoul(argv[1], &end, 10);
+        if (*end != '\0') {
+            cli_printf(ctx, "Invalid time %s\r\n", argv[1]);
+            return 255;
+        }
+        rtc_set(seconds);
+    } else if (argc != 1) {
+        cli_printf(ctx, "Unsupported number of arguments\r\n");
+        return 255;
+    }
+    uptime_us = timebase_now_us();
+    format_wall_time(wall_buf, sizeof(wall_buf));
+    cli_printf(ctx, "Wall time: %s\r\n", wall_buf);
+    cli_printf(ctx, "Uptime: %lu.%06lu s\r\n",
+               (unsigned long)(uptime_us / 1000000),
+               (unsigned long)(uptime_us % 1000000));
+    return 0;
+}
+
+/**
+ * Runs the logger side of a clock sync exchange with a host.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int tsync(CLIContext *ctx, char **argv, int argc) {
+    // Stamp the request time before doing any other work.
+    uint64_t t2 = timebase_now_us(), t1, t3, t4, seq;
+    int ret;
+    TimeSyncResult result;
+    if (argc == 1) {
+        if (!timesync_latest(&result)) {
+            cli_printf(ctx, "No sync estimate\r\n");
+            return 0;
+        }
+        cli_printf(ctx,
+                   "seq %lu: local %llu us, offset %lld us, delay %lld us, "
+                   "drift %ld ppb\r\n",
+                   (unsigned long)result.seq,
+                   (unsigned long long)result.local_us,
+                   (long long)result.offset_us, (long long)result.delay_us,
+                   (long)result.drift_ppb);
+        return 0;
+    } else if (argc == 3 && strcmp(argv[1], "req") == 0) {
+        if (!parse_number(argv[2], &seq) || seq > UINT32_MAX) {
+            cli_printf(ctx, "Invalid sequence number %s\r\n", argv[2]);
+            return 255;
+        }
+        timesync_request(seq, t2);
+        /*
+         * The host stamps t4 when the "!" arrives, so stamp t3 as close to
+         * writing it as possible.
+         */
+        t3 = timebase_now_us();
+        ctx->cli_write("!", 1);
+        timesync_reply(seq, t3);
+        cli_printf(ctx, "%lu %llu %llu\r\n", (unsigned long)seq,
+                   (unsigned long long)t2, (unsigned long long)t3);
+        return 0;
+    } else if (argc == 5 && strcmp(argv[1], "done") == 0) {
+        if (!parse_number(argv[2], &seq) || seq > UINT32_MAX ||
+            !parse_number(argv[3], &t1) || !parse_number(argv[4], &t4)) {
+            cli_printf(ctx, "Invalid sync exchange arguments\r\n");
+            return 255;
+        }
+        ret = timesync_complete(seq, t1, t4, &result);
+        if (ret == -1) {
+            cli_printf(ctx, "Invalid sync exchange %lu\r\n",
+                       (unsigned long)seq);
+            return 255;
+        }
+        cli_printf(ctx, "offset %lld us, delay %lld us, drift %ld ppb\r\n",
+                   (long long)result.offset_us, (long long)result.delay_us,
+                   (long)result.drift_ppb);
+        if (ret != 0) {
+            cli_printf(ctx, "Could not write sync record to SD card\r\n");
+            return 255;
+        }
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints or resets hot path profiling statistics.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int prof(CLIContext *ctx, char **argv, int argc) {
+    if (argc == 1) {
+        prof_report(ctx);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        prof_reset();
+        cli_printf(ctx, "Profiling statistics reset\r\n");
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Dumps or clears the pipeline event trace.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int trace(CLIContext *ctx, char **argv, int argc) {
+    if (argc == 1) {
+        cli_printf(ctx, "%d events in trace\r\n", trace_count());
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        trace_dump(ctx);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        trace_clear();
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints or resets the RX to durable storage latency distribution.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int latency(CLIContext *ctx, char **argv, int argc) {
+    if (argc == 1) {
+        latency_report(ctx);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        latency_reset();
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints or resets lock contention statistics.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int locks(CLIContext *ctx, char **argv, int argc) {
+    if (argc == 1) {
+        lock_stats_report(ctx);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        lock_stats_reset();
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints or resets UART ingest statistics.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int ingest(CLIContext *ctx, char **argv, int argc) {
+    IngestStats stats;
+    uint64_t elapsed, load, ns_per_byte;
+    if (argc == 1) {
+        ingest_stats(&stats);
+        cli_printf(ctx,
+                   "%s path: blocks %lu, dropped %lu bytes, max isr %lu us\r\n",
+                   ingest_path_name(), (unsigned long)stats.blocks,
+                   (unsigned long)stats.dropped,
+                   (unsigned long)timebase_to_us(stats.isr_max));
+        // Hwi time as a share of the CPU, and per byte, since the reset.
+        elapsed = timebase_now() - stats.since;
+        load = stats.isr_total * 10000 / elapsed;
+        ns_per_byte = 0;
+        if (stats.bytes != 0) {
+            ns_per_byte = timebase_to_us(stats.isr_total * 1000) / stats.bytes;
+        }
+        cli_printf(ctx,
+                   "Hwi load: %lu.%02lu%% over %lu s, %lu ns per byte\r\n",
+                   (unsigned long)(load / 100), (unsigned long)(load % 100),
+                   (unsigned long)(timebase_to_us(elapsed) / 1000000),
+                   (unsigned long)ns_per_byte);
+        cli_printf(ctx,
+                   "UART errors: %lu break, %lu framing, %lu parity, "
+                   "%lu overrun\r\n",
+                   (unsigned long)stats.breaks, (unsigned long)stats.framing,
+                   (unsigned long)stats.parity, (unsigned long)stats.overruns);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        ingest_stats_reset();
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Runs SD card commands that hold the SD card mutex for a long time, while
+ * the logger is running. Reports ingest statistics for the run, and the
+ * latency from the logged UART to the SD card of data logged during it, so
+ * data must be sent to the logged UART meanwhile. No data should be
+ * dropped, and the latency should stay near sync_max_ms, regardless of the
+ * console's load. Resets the ingest statistics and latency distribution.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int stress(CLIContext *ctx, char **argv, int argc) {
+    int i, iterations = 100;
+    uint64_t start;
+    uint32_t samples, max_us, sync_max_ms;
+    IngestStats before, after;
+    if (argc > 2) {
+        cli_printf(ctx, "Unsupported arguments\r\n");
+        return 255;
+    } else if (argc == 2) {
+        iterations = strtol(argv[1], NULL, 10);
+        if (iterations <= 0) {
+            cli_printf(ctx, "Invalid iteration count\r\n");
+            return 255;
+        }
+    }
+    if (!sd_card_mounted()) {
+        cli_printf(ctx, "SD card is not mounted\r\n");
+        return 255;
+    }
+    ingest_stats(&before);
+    ingest_stats_reset();
+    latency_reset();
+    start = timebase_now();
+    write_record("Console stress test: %d iterations", iterations);
+    for (i = 0; i < iterations; i++) {
+        sync_sd();
+        filesize();
+        wdt_checkin(WDT_STAGE_CONSOLE);
+    }
+    ingest_stats(&after);
+    cli_printf(ctx, "%d iterations in %lu ms\r\n", iterations,
+               (unsigned long)(timebase_to_us(timebase_now() - start) / 1000));
+    cli_printf(ctx,
+               "ingest: max isr %lu us (before %lu us), dropped %lu bytes\r\n",
+               (unsigned long)timebase_to_us(after.isr_max),
+               (unsigned long)timebase_to_us(before.isr_max),
+               (unsigned long)after.dropped);
+    // Data logged during the run is measured at the writer's next sync.
+    sync_max_ms = config_get(CONFIG_SYNC_MAX_MS);
+    wdt_idle(WDT_STAGE_CONSOLE);
+    Task_sleep(sync_max_ms + STRESS_SETTLE_MS);
+    wdt_busy(WDT_STAGE_CONSOLE);
+    latency_summary(&samples, &max_us);
+    if (samples == 0) {
+        cli_printf(ctx, "latency: no samples, send data to the logged UART "
+                        "during the run\r\n");
+        return 0;
+    }
+    cli_printf(ctx, "latency: %lu samples, max %lu ms, sync_max_ms %lu%s\r\n",
+               (unsigned long)samples, (unsigned long)(max_us / 1000),
+               (unsigned long)sync_max_ms,
+               max_us / 1000 > sync_max_ms ? " (exceeded)" : "");
+    return 0;
+}
+
+/**
+ * Prints the CPU load, measured by the Load module from idle time.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int cpuload(CLIContext *ctx, char **argv, int argc) {
+    if (argc != 1) {
+        cli_printf(ctx, "Unsupported arguments\r\n");
+        return 255;
+    }
+    cli_printf(ctx, "CPU load %lu%%, %s receive path\r\n",
+               (unsigned long)Load_getCPULoad(), ingest_path_name());
+    if (power_sleep_enabled()) {
+        cli_printf(ctx, "Idle sleep is on, so the load reads high. See "
+                        "\"power\"\r\n");
+    }
+    return 0;
+}
+
+/**
+ * Requests a trigger marker in the log. The SD writer writes the marker, and
+ * syncs the log so everything before the trigger is durable.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int trigger(CLIContext *ctx, char **argv, int argc) {
+    char text[SUP_TRIGGER_MAXLEN];
+    int i, len = 0;
+    text[0] = '\0';
+    // Join the arguments back together with spaces.
+    for (i = 1; i < argc && len < sizeof(text) - 1; i++) {
+        len += snprintf(text + len, sizeof(text) - len, "%s%s",
+                        i > 1 ? " " : "", argv[i]);
+    }
+    if (!sd_card_mounted()) {
+        cli_printf(ctx, "SD card is not mounted\r\n");
+        return 255;
+    }
+    supervisor_trigger(text);
+    cli_printf(ctx, "Trigger requested\r\n");
+    return 0;
+}
+
+/**
+ * Requests that logging move to the next rotated log file. The SD writer
+ * performs the rotation, after writing out data received before it.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int rotate(CLIContext *ctx, char **argv, int argc) {
+    if (argc != 1) {
+        cli_printf(ctx, "Unsupported arguments\r\n");
+        return 255;
+    }
+    if (!sd_card_mounted()) {
+        cli_printf(ctx, "SD card is not mounted\r\n");
+        return 255;
+    }
+    supervisor_post(SUP_EVT_ROTATE);
+    cli_printf(ctx, "Rotation requested, \"sdstatus\" shows the new file\r\n");
+    return 0;
+}
+
+/**
+ * Prints the pipeline watchdog state, and the stall that caused the last
+ * watchdog reset, if any.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int wdt(CLIContext *ctx, char **argv, int argc) {
+    if (argc != 1) {
+        cli_printf(ctx, "Unsupported arguments\r\n");
+        return 255;
+    }
+    wdt_report(ctx);
+    return 0;
+}
+
+/**
+ * Prints the idle sleep statistics, or changes the power settings. Idle
+ * current can't be measured on chip: measure it on the bench while the
+ * logged UART is silent, with the status LEDs off.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int power(CLIContext *ctx, char **argv, int argc) {
+    PowerStats stats;
+    uint64_t elapsed;
+    bool on;
+    if (argc == 1) {
+        power_stats(&stats);
+        elapsed = timebase_now() - stats.since;
+        cli_printf(ctx, "Idle sleep %s, status LEDs %s\r\n",
+                   power_sleep_enabled() ? "on" : "off",
+                   status_led_enabled() ? "on" : "off");
+        cli_printf(ctx,
+                   "%lu sleeps, asleep %lu ms of %lu ms, longest %lu ms\r\n",
+                   (unsigned long)stats.sleeps,
+                   (unsigned long)(timebase_to_us(stats.asleep) / 1000),
+                   (unsigned long)(timebase_to_us(elapsed) / 1000),
+                   (unsigned long)(timebase_to_us(stats.sleep_max) / 1000));
+        cli_printf(ctx, "%lu RX edge wakes, max wake to Hwi latency %lu us\r\n",
+                   (unsigned long)stats.rx_wakes,
+                   (unsigned long)timebase_to_us(stats.wake_latency_max));
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        power_stats_reset();
+        return 0;
+    } else if (argc == 3 && (strcmp(argv[2], "on") == 0 ||
+                             strcmp(argv[2], "off") == 0)) {
+        on = strcmp(argv[2], "on") == 0;
+        if (strcmp(argv[1], "sleep") == 0) {
+            power_sleep_enable(on);
+            return 0;
+        } else if (strcmp(argv[1], "leds") == 0) {
+            status_led_enable(on);
+            return 0;
+        }
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints the state of the emergency flash log, or copies it to the SD card,
+ * or erases it.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int flashlog(CLIContext *ctx, char **argv, int argc) {
+    FlashLogStatus status;
+    int copied;
+    if (argc == 1) {
+        flash_log_status(&status);
+        if (status.pages == 0) {
+            cli_printf(ctx, "Flash log is empty, %lu bytes staged\r\n",
+                       (unsigned long)status.staged);
+            return 0;
+        }
+        cli_printf(ctx,
+                   "Flash log: %lu pages (%lu to %lu), %lu bytes, %lu bytes "
+                   "staged\r\n",
+                   (unsigned long)status.pages,
+                   (unsigned long)status.oldest_seq,
+                   (unsigned long)status.newest_seq,
+                   (unsigned long)status.bytes, (unsigned long)status.staged);
+        if (status.power_fail) {
+            cli_printf(ctx, "Newest page was written on a power failure\r\n");
+        }
+        if (status.full) {
+            cli_printf(ctx,
+                       "Flash log is full, %lu bytes dropped, copy it and "
+                       "\"flashlog erase\" to capture again\r\n",
+                       (unsigned long)status.dropped);
+        }
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "copy") == 0) {
+        if (!sd_card_mounted()) {
+            cli_printf(ctx, "SD card is not mounted\r\n");
+            return 255;
+        }
+        copied = flash_log_copy(ctx, FLASHLOG_FILE);
+        if (copied < 0) {
+            cli_printf(ctx, "Failed to copy the flash log\r\n");
+            return 255;
+        }
+        cli_printf(ctx, "Copied %d bytes to %s\r\n", copied, FLASHLOG_FILE);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "erase") == 0) {
+        flash_log_erase();
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints the persistent state kept in the EEPROM, or writes a checkpoint.
+ * @param ctx: CLI context to print to.
+ * @param argv: argument array, "save" writes a checkpoint
+ * @param argc: argument count
+ * @return 0 on success, or 255 on error.
+ */
+static int persist(CLIContext *ctx, char **argv, int argc) {
+    PersistRecord state;
+    if (argc == 1) {
+        persist_state(&state);
+        cli_printf(ctx, "Session %lu, checkpoint %lu\r\n",
+                   (unsigned long)state.session, (unsigned long)state.seq);
+        cli_printf(ctx, "Lifetime: %lu KB logged, %lu KB dropped\r\n",
+                   (unsigned long)(state.bytes_logged / 1024),
+                   (unsigned long)(state.bytes_dropped / 1024));
+        cli_printf(ctx, "Log file %s, %lu bytes at the last checkpoint\r\n",
+                   log_file_name(), (unsigned long)state.log_size);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "save") == 0) {
+        if (persist_checkpoint() != 0) {
+            cli_printf(ctx, "EEPROM write failed\r\n");
+            return 255;
+        }
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints or sets the config values, or loads or saves the config file.
+ * @param ctx: CLI context to print to.
+ * @param argv: argument array, see the help string
+ * @param argc: argument count
+ * @return 0 on success, or 255 on error.
+ */
+static int config(CLIContext *ctx, char **argv, int argc) {
+    const ConfigEntry *entry;
+    char text[CONFIG_TEXT_MAXLEN];
+    int i, len, ret;
+    if (argc == 1) {
+        for (i = 0; i < CONFIG_COUNT; i++) {
+            entry = config_entry((ConfigKey)i);
+            if (entry->text != NULL) {
+                config_get_text((ConfigKey)i, text);
+                cli_printf(ctx, "%s=\"%s\" (text): %s\r\n", entry->name, text,
+                           entry->help);
+                continue;
+            }
+            cli_printf(ctx, "%s=%lu (%lu to %lu, default %lu): %s\r\n",
+                       entry->name, (unsigned long)entry->value,
+                       (unsigned long)entry->min, (unsigned long)entry->max,
+                       (unsigned long)entry->def, entry->help);
+        }
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "load") == 0) {
+        ret = config_load();
+        if (ret < 0) {
+            cli_printf(ctx, "Could not read %s\r\n", CONFIG_FILE);
+            return 255;
+        }
+        cli_printf(ctx, "%d values set, errors are in the log\r\n", ret);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "save") == 0) {
+        if (config_save() != 0) {
+            cli_printf(ctx, "Could not write %s\r\n", CONFIG_FILE);
+            return 255;
+        }
+        return 0;
+    } else if (argc >= 2) {
+        // Join the rest back together, as text values may hold spaces.
+        text[0] = '\0';
+        for (i = 2, len = 0; i < argc && len < sizeof(text); i++) {
+            len += snprintf(text + len, sizeof(text) - len, "%s%s",
+                            i > 2 ? " " : "", argv[i]);
+        }
+        if (len >= sizeof(text)) {
+            cli_printf(ctx, "Value is too long\r\n");
+            return 255;
+        }
+        ret = config_set(argv[1], text);
+        if (ret == -1) {
+            cli_printf(ctx, "Unknown key\r\n");
+            return 255;
+        } else if (ret == -2) {
+            cli_printf(ctx, "Value is out of range\r\n");
+            return 255;
+        }
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints or resets the kernel log level counts.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int levels(CLIContext *ctx, char **argv, int argc) {
+    uint32_t counts[PIPE_LEVELS];
+    int i;
+    if (argc == 1) {
+        if (config_get(CONFIG_LEVELS) == 0) {
+            cli_printf(ctx, "Classification is off, see \"config\"\r\n");
+        }
+        pipeline_level_counts(counts);
+        for (i = 0; i < PIPE_LEVELS; i++) {
+            cli_printf(ctx, "%-6s %lu\r\n", pipeline_level_name(i),
+                       (unsigned long)counts[i]);
+        }
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        pipeline_level_reset();
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Prints the line filter rules with their hit counts, reloads them, or
+ * resets the counts. The SD writer reloads the rules, after writing out
+ * data received before the request.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int filter(CLIContext *ctx, char **argv, int argc) {
+    FilterRule rule;
+    int i;
+    if (argc == 1) {
+        for (i = 0; filter_get(i, &rule) == 0; i++) {
+            cli_printf(ctx, "%2d %s %-8s %-10lu %s\r\n", i + 1,
+                       filter_action_name(rule.action),
+                       filter_type_name(rule.type), (unsigned long)rule.hits,
+                       rule.pattern);
+        }
+        if (i == 0) {
+            cli_printf(ctx, "No filter rules, all lines are kept\r\n");
+        }
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "load") == 0) {
+        if (!sd_card_mounted()) {
+            cli_printf(ctx, "SD card is not mounted\r\n");
+            return 255;
+        }
+        supervisor_post(SUP_EVT_FILTERS);
+        cli_printf(ctx, "Reload requested, the log records the result\r\n");
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        filter_reset();
+        return 0;
+    }
+    cli_printf(ctx, "Unsupported arguments\r\n");
+    return 255;
+}
+
+/**
+ * Requests a panic snapshot of the log around now. The SD writer starts it,
+ * after writing out data received before it, and notes the snapshot file in
+ * the log once written.
+ * @param ctx: CLI context to print to
+ * @param argv list of arguments
+ * @param argc argument count
+ * @return 0 on success, or another value on failure
+ */
+static int panic(CLIContext *ctx, char **argv, int argc) {
+    if (argc != 1) {
+        cli_printf(ctx, "Unsupported arguments\r\n");
+        return 255;
+    }
+    if (!sd_card_mounted()) {
+        cli_printf(ctx, "SD card is not mounted\r\n");
+        return 255;
+    }
+    supervisor_post(SUP_EVT_PANIC);
+    cli_printf(ctx, "Panic snapshot requested\r\n");
+    return 0;
+}
+
+/**
+ * Parses a decimal number argument. The argument must hold only digits, and
+ * fit in 64 bits, so a typo is rejected rather than read as 0 or a partial
+ * number.
+ * @param arg: argument to parse
+ * @param value: set to the number
+ * @return true if the argument is a valid number, or false otherwise.
+ */
+static bool parse_number(const char *arg, uint64_t *value) {
+    char *end;
+    if (!isdigit((unsigned char)arg[0])) {
+        return false;
+    }
+    errno = 0;
+    *value = strtoull(arg, &end, 10);
+    return *end == '\0' && errno != ERANGE;
 }
\ No newline at end of file
@@ -0,0 +1,300 @@
+/**
+ * @file config.c
+ * Implements runtime tuning. See config.h for the config file format.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "lock.h"
+#include "sd_card.h"
+#include "uart_logger_task.h"
+
+// Largest config file used. Of a longer file, the lines that end within
+// this many bytes are used, so a value is never cut short.
+#define CONFIG_FILE_MAXLEN 512
+
+static char BOOT_BANNER[CONFIG_TEXT_MAXLEN];
+static char PANIC_PATTERN[CONFIG_TEXT_MAXLEN];
+
+static ConfigEntry CONFIG[CONFIG_COUNT] = {
+    [CONFIG_BAUD] = {"baud", 115200, 115200, 300, 5000000, ingest_set_baud,
+                     "Baud rate of the logged UART"},
+    [CONFIG_SYNC_IDLE_MS] = {"sync_idle_ms", 20, 20, 1, 10000, NULL,
+                             "Sync once no data arrived for this long, ms"},
+    [CONFIG_SYNC_MAX_MS] = {"sync_max_ms", 500, 500, 10, 60000, NULL,
+                            "Sync once unsynced data is this old, ms"},
+    [CONFIG_ROTATE_KB] = {"rotate_kb", 0, 0, 0, 4194303, NULL,
+                          "Rotate the log file at this size in KB, 0 for "
+                          "never"},
+    [CONFIG_INBAND_TAG] = {"inband_tag", 7777, 7777, 0, 99999, NULL,
+                           "Tag of in-band control sequences, 0 to ignore "
+                           "them"},
+    [CONFIG_IDLE_GAP_MS] = {"idle_gap_ms", 1000, 1000, 0, 3600000, NULL,
+                            "Record silences longer than this, ms, 0 for "
+                            "never"},
+    [CONFIG_ANCHOR_S] = {"anchor_s", 60, 60, 0, 86400, NULL,
+                         "Record a time anchor at most this often, s, 0 "
+                         "for never"},
+    [CONFIG_BOOT_BANNER] = {"boot_banner", 0, 0, 0, 0, NULL,
+                            "Start a new log segment at lines holding this "
+                            "text, empty for never",
+                            BOOT_BANNER},
+    [CONFIG_BOOT_BREAK] = {"boot_break", 0, 0, 0, 1, NULL,
+                           "Start a new log segment after a break, 1 for on"},
+    [CONFIG_BOOT_IDLE_S] = {"boot_idle_s", 0, 0, 0, 86400, NULL,
+                            "Start a new log segment after silences this "
+                            "long, s, 0 for never"},
+    [CONFIG_LEVELS] = {"levels", 0, 0, 0, 1, NULL,
+                       "Classify lines by kernel log level, 1 for on"},
+    [CONFIG_ERRORS_LEVEL] = {"errors_level", 3, 3, 0, 7, NULL,
+                             "Copy lines at this kernel log level or more "
+                             "severe to ERRORS.TXT"},
+    [CONFIG_REPEATS] = {"repeats", 0, 0, 0, 1, NULL,
+                        "Collapse exact repeats of a line into a count, 1 "
+                        "for on"},
+    [CONFIG_PANIC_PATTERN] = {"panic_pattern", 0, 0, 0, 0, NULL,
+                              "Write a panic snapshot at lines holding this "
+                              "text, empty for never",
+                              PANIC_PATTERN},
+    [CONFIG_PANIC_BEFORE_KB] = {"panic_before_kb", 16, 16, 0, 64, NULL,
+                                "Log data before the trigger kept in a panic "
+                                "snapshot, KB"},
+    [CONFIG_PANIC_AFTER_KB] = {"panic_after_kb", 4, 4, 0, 64, NULL,
+                               "Log data after the trigger kept in a panic "
+                               "snapshot, KB"},
+};
+
+// Protects text values, and the file buffer, between the SD writer and the
+// console.
+static Lock CONFIG_MUTEX;
+// Holds a byte more than the largest file, to tell a longer one, and the
+// terminator.
+static char FILE_BUF[CONFIG_FILE_MAXLEN + 2];
+static volatile uint32_t CHANGES = 0;
+
+static int set_value(const char *name, const char *value);
+static ConfigEntry *find_entry(const char *name);
+
+/**
+ * Sets up the config mutex. Should be called before BIOS starts.
+ */
+void config_prebios(void) {
+    if (lock_init(&CONFIG_MUTEX, "CONFIG_MUTEX") != 0) {
+        System_abort("Failed to create config mutex\n");
+    }
+}
+
+/**
+ * Gets a config value.
+ * @param key: value to get
+ * @return current value.
+ */
+uint32_t config_get(ConfigKey key) { return CONFIG[key].value; }
+
+/**
+ * Gets a text config value.
+ * @param key: value to get
+ * @param buf: buffer of CONFIG_TEXT_MAXLEN bytes, filled with the value
+ * @return length of the value.
+ */
+int config_get_text(ConfigKey key, char *buf) {
+    lock_acquire(&CONFIG_MUTEX);
+    strcpy(buf, CONFIG[key].text);
+    lock_release(&CONFIG_MUTEX);
+    return strlen(buf);
+}
+
+/**
+ * Counts changes to config values, so users of text values can tell when to
+ * get them again.
+ * @return number of values changed since boot.
+ */
+uint32_t config_changes(void) { return CHANGES; }
+
+/**
+ * Gets the entry for a config value, for listing them.
+ * @param key: value to get
+ * @return entry for the value.
+ */
+const ConfigEntry *config_entry(ConfigKey key) { return &CONFIG[key]; }
+
+/**
+ * Sets a config value by name, after checking it against its limits.
+ * @param name: key of the value
+ * @param value: new value, as a string
+ * @return 0 on success, -1 if the key is unknown, or -2 if the value is not
+ * a number, is out of range, or is too long.
+ */
+int config_set(const char *name, const char *value) {
+    int ret;
+    lock_acquire(&CONFIG_MUTEX);
+    ret = set_value(name, value);
+    lock_release(&CONFIG_MUTEX);
+    return ret;
+}
+
+/**
+ * Reads CONFIG_FILE from the SD card, and sets the values in it. Each line
+ * that could not be used is written to the log as a record. If the file is
+ * longer than CONFIG_FILE_MAXLEN, the line it is cut in and the rest are
+ * ignored, and that is recorded too.
+ * @return number of values set, or -1 if the file could not be read.
+ */
+int config_load(void) {
+    char *line, *next, *value, *end;
+    int len, line_num = 0, set = 0, ret;
+    lock_acquire(&CONFIG_MUTEX);
+    len = read_sd_file(CONFIG_FILE, FILE_BUF, CONFIG_FILE_MAXLEN + 1);
+    if (len < 0) {
+        lock_release(&CONFIG_MUTEX);
+        return -1;
+    }
+    FILE_BUF[len] = '\0';
+    if (len > CONFIG_FILE_MAXLEN) {
+        // Drop the line cut short, so "rotate_kb=1024" is not read as 1.
+        FILE_BUF[CONFIG_FILE_MAXLEN] = '\0';
+        end = strrchr(FILE_BUF, '\n');
+        if (end != NULL) {
+            end[1] = '\0';
+        } else {
+            FILE_BUF[0] = '\0';
+        }
+        write_record("Config: %s is longer than %d bytes, the rest is ignored",
+                     CONFIG_FILE + sizeof(DRIVE_PREFIX) - 1,
+                     CONFIG_FILE_MAXLEN);
+    }
+    for (line = FILE_BUF; line != NULL; line = next) {
+        line_num++;
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        // Trim leading and trailing whitespace, including '\r'.
+        while (isspace((unsigned char)*line)) {
+            line++;
+        }
+        end = line + strlen(line);
+        while (end > line && isspace((unsigned char)end[-1])) {
+            *--end = '\0';
+        }
+        if (*line == '\0' || *line == '#') {
+            continue;
+        }
+        value = strchr(line, '=');
+        if (value == NULL) {
+            write_record("Config line %d: expected key=value", line_num);
+            continue;
+        }
+        // Split the key from the value, dropping spaces around the '='.
+        end = value;
+        *value++ = '\0';
+        while (end > line && isspace((unsigned char)end[-1])) {
+            *--end = '\0';
+        }
+        while (isspace((unsigned char)*value)) {
+            value++;
+        }
+        ret = set_value(line, value);
+        if (ret == -1) {
+            write_record("Config line %d: unknown key \"%s\"", line_num, line);
+        } else if (ret == -2 && find_entry(line)->text != NULL) {
+            write_record("Config line %d: %s is longer than %d characters",
+                         line_num, line, CONFIG_TEXT_MAXLEN - 1);
+        } else if (ret == -2) {
+            write_record("Config line %d: bad value for %s, limits %lu to %lu",
+                         line_num, line,
+                         (unsigned long)find_entry(line)->min,
+                         (unsigned long)find_entry(line)->max);
+        } else {
+            set++;
+        }
+    }
+    lock_release(&CONFIG_MUTEX);
+    return set;
+}
+
+/**
+ * Writes all current values to CONFIG_FILE on the SD card, replacing it.
+ * @return 0 on success, or -1 on error.
+ */
+int config_save(void) {
+    int len = 0, i, ret;
+    lock_acquire(&CONFIG_MUTEX);
+    for (i = 0; i < CONFIG_COUNT; i++) {
+        if (CONFIG[i].text != NULL) {
+            len += snprintf(FILE_BUF + len, sizeof(FILE_BUF) - len,
+                            "%s=%s\r\n", CONFIG[i].name, CONFIG[i].text);
+        } else {
+            len += snprintf(FILE_BUF + len, sizeof(FILE_BUF) - len,
+                            "%s=%lu\r\n", CONFIG[i].name,
+                            (unsigned long)CONFIG[i].value);
+        }
+    }
+    ret = replace_sd_file(CONFIG_FILE, FILE_BUF, len) == len ? 0 : -1;
+    lock_release(&CONFIG_MUTEX);
+    return ret;
+}
+
+/**
+ * Sets a config value by name, after checking it. Must be called with the
+ * config mutex held.
+ * @param name: key of the value
+ * @param value: new value, as a string
+ * @return 0 on success, -1 if the key is unknown, or -2 if the value is not
+ * a number, is out of range, or is too long.
+ */
+static int set_value(const char *name, const char *value) {
+    ConfigEntry *entry = find_entry(name);
+    unsigned long parsed;
+    char *end;
+    if (entry == NULL) {
+        return -1;
+    }
+    if (entry->text != NULL) {
+        if (strlen(value) >= CONFIG_TEXT_MAXLEN) {
+            return -2;
+        }
+        if (strcmp(entry->text, value) != 0) {
+            strcpy(entry->text, value);
+            CHANGES++;
+        }
+        return 0;
+    }
+    parsed = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < entry->min ||
+        parsed > entry->max) {
+        return -2;
+    }
+    if (entry->value != parsed) {
+        entry->value = parsed;
+        CHANGES++;
+        if (entry->apply != NULL) {
+            entry->apply(entry->value);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Finds a config entry by its key.
+ * @param name: key of the value
+ * @return entry, or NULL if the key is unknown.
+ */
+static ConfigEntry *find_entry(const char *name) {
+    int i;
+    for (i = 0; i < CONFIG_COUNT; i++) {
+        if (strcmp(CONFIG[i].name, name) == 0) {
+            return &CONFIG[i];
+        }
+    }
+    return NULL;
+}
\ No newline at end of file
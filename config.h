@@ -0,0 +1,149 @@
+/**
+ * @file config.h
+ * Implements runtime tuning. Values are read from CONFIG_FILE on the SD card
+ * each time it is mounted, and can be viewed and set with the "config"
+ * command. Each value is checked against its limits, and a line that fails
+ * the check leaves the value unchanged.
+ *
+ * The file holds one "key=value" per line. Blank lines, and lines starting
+ * with '#', are ignored:
+ *
+ *     # Logged UART at 921600 baud, sync at least every 200 ms.
+ *     baud=921600
+ *     sync_max_ms=200
+ *
+ * Text values take the rest of the line, without its leading and trailing
+ * whitespace, and default to empty.
+ *
+ * Buffer sizes are fixed at build time (see log_buffer.h and cli.h), as
+ * their memory is allocated statically.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+
+#include "sd_card.h"
+
+// Config file, read on mount.
+#define CONFIG_FILE DRIVE_PREFIX "LOGGER.CFG"
+// Longest text value, including the terminator.
+#define CONFIG_TEXT_MAXLEN 48
+
+typedef enum {
+    /*! baud rate of the logged UART */
+    CONFIG_BAUD,
+    /*! sync once no data arrived for this long, in ms */
+    CONFIG_SYNC_IDLE_MS,
+    /*! sync once the oldest unsynced data is this old, in ms */
+    CONFIG_SYNC_MAX_MS,
+    /*! rotate the log file once it reaches this size in KB, or 0 for never */
+    CONFIG_ROTATE_KB,
+    /*! tag of in-band control sequences, or 0 to ignore them */
+    CONFIG_INBAND_TAG,
+    /*! record silences on the logged UART longer than this in ms, or 0 for
+     * never */
+    CONFIG_IDLE_GAP_MS,
+    /*! record a time anchor at most this often in s, or 0 for never */
+    CONFIG_ANCHOR_S,
+    /*! text starting a new log segment at the line holding it, or empty for
+     * never */
+    CONFIG_BOOT_BANNER,
+    /*! 1 to start a new log segment after a break on the logged UART */
+    CONFIG_BOOT_BREAK,
+    /*! start a new log segment after a silence this long in s, or 0 for
+     * never */
+    CONFIG_BOOT_IDLE_S,
+    /*! 1 to classify lines by kernel log level */
+    CONFIG_LEVELS,
+    /*! copy lines at this kernel log level or more severe to the errors
+     * file, when classifying */
+    CONFIG_ERRORS_LEVEL,
+    /*! 1 to collapse exact repeats of a line into a count */
+    CONFIG_REPEATS,
+    /*! text starting a panic snapshot at the line holding it, or empty for
+     * never */
+    CONFIG_PANIC_PATTERN,
+    /*! log data before the trigger kept in a panic snapshot, in KB */
+    CONFIG_PANIC_BEFORE_KB,
+    /*! log data after the trigger kept in a panic snapshot, in KB */
+    CONFIG_PANIC_AFTER_KB,
+    CONFIG_COUNT
+} ConfigKey;
+
+typedef struct {
+    /*! key, as written in the config file */
+    const char *name;
+    /*! current and default values */
+    uint32_t value;
+    uint32_t def;
+    /*! inclusive limits */
+    uint32_t min;
+    uint32_t max;
+    /*! called when the value changes, or NULL if it is read where used */
+    void (*apply)(uint32_t value);
+    /*! description, for the "config" command */
+    const char *help;
+    /*! buffer of CONFIG_TEXT_MAXLEN bytes holding a text value, or NULL for
+     * a number. For text, the numeric fields are unused. */
+    char *text;
+} ConfigEntry;
+
+/**
+ * Sets up the config mutex. Should be called before BIOS starts.
+ */
+void config_prebios(void);
+
+/**
+ * Gets a config value.
+ * @param key: value to get
+ * @return current value.
+ */
+uint32_t config_get(ConfigKey key);
+
+/**
+ * Gets a text config value.
+ * @param key: value to get
+ * @param buf: buffer of CONFIG_TEXT_MAXLEN bytes, filled with the value
+ * @return length of the value.
+ */
+int config_get_text(ConfigKey key, char *buf);
+
+/**
+ * Counts changes to config values, so users of text values can tell when to
+ * get them again.
+ * @return number of values changed since boot.
+ */
+uint32_t config_changes(void);
+
+/**
+ * Gets the entry for a config value, for listing them.
+ * @param key: value to get
+ * @return entry for the value.
+ */
+const ConfigEntry *config_entry(ConfigKey key);
+
+/**
+ * Sets a config value by name, after checking it against its limits.
+ * @param name: key of the value
+ * @param value: new value, as a string
+ * @return 0 on success, -1 if the key is unknown, or -2 if the value is not
+ * a number, is out of range, or is too long.
+ */
+int config_set(const char *name, const char *value);
+
+/**
+ * Reads CONFIG_FILE from the SD card, and sets the values in it. Each line
+ * that could not be used is written to the log as a record.
+ * @return number of values set, or -1 if the file could not be read.
+ */
+int config_load(void);
+
+/**
+ * Writes all current values to CONFIG_FILE on the SD card, replacing it.
+ * @return 0 on success, or -1 on error.
+ */
+int config_save(void);
+
+#endif
\ No newline at end of file
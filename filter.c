@@ -0,0 +1,666 @@
+/**
+ * @file filter.c
+ * Implements line filter rules. See filter.h for the rules file format.
+ *
+ * Rules are compiled in three steps. First, the bytes are split into
+ * classes no pattern tells apart, so the DFA has a column per class rather
+ * than per byte. Next, each pattern becomes a run of NFA positions, one per
+ * atom, followed by an accepting position. Last, the sets of positions that
+ * can be active together become DFA states, by subset construction. A state
+ * also holds the first rule matched so far. Only earlier rules with the
+ * other action can still change the result, so the positions of all other
+ * rules are dropped, which keeps the number of states down. A set of drop
+ * rules alone needs no more states than its patterns have atoms.
+ *
+ * The sets of positions are only needed while compiling, so they share
+ * their memory with the rules file, which is parsed by then. The transition
+ * table is sized in bytes rather than states, so rules telling fewer bytes
+ * apart can use more states.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "filter.h"
+#include "lock.h"
+#include "sd_card.h"
+
+// Largest rules file read. The rest of a longer file is ignored.
+#define FILTER_FILE_MAXLEN 768
+// Limits of the compiled rules. Rules exceeding them are rejected. Byte
+// classes are held in a 32 bit mask.
+#define MAX_CLASSES 32
+#define MAX_POSITIONS 96
+#define MAX_STATES 96
+#define TRANS_SIZE 2048
+#define POSITION_WORDS ((MAX_POSITIONS + 31) / 32)
+#define NO_RULE 0xFF
+
+typedef enum { QUANT_ONE, QUANT_OPT, QUANT_STAR } Quant;
+
+typedef struct {
+    /*! byte classes the atom matches, or 0 for an accepting position */
+    uint32_t classes;
+    uint8_t quant;
+    uint8_t rule;
+} Position;
+
+typedef struct {
+    /*! active positions */
+    uint32_t bits[POSITION_WORDS];
+    /*! first rule matched so far, or NO_RULE */
+    uint8_t best;
+} StateSet;
+
+/*! Receives an atom of a pattern: the set of bytes it matches, as a 256 bit
+ * mask, and its quantifier. Returns 0 on success, or -1 if a limit was
+ * reached. */
+typedef int (*AtomFxn)(const uint32_t *set, Quant quant, int rule);
+
+static const char *const ACTION_NAMES[] = {"keep", "drop"};
+static const char *const TYPE_NAMES[] = {"prefix", "contains", "regex"};
+
+// Protects the rules between the SD writer and the console.
+static Lock FILTER_MUTEX;
+static FilterRule RULES[FILTER_MAX_RULES];
+static int RULE_COUNT = 0;
+
+// Compiled rules. Only accessed by the SD writer, apart from the hit counts.
+static bool ANCHOR_START[FILTER_MAX_RULES];
+static bool ANCHOR_END[FILTER_MAX_RULES];
+static uint8_t FIRST_POS[FILTER_MAX_RULES];
+static uint8_t ACCEPT_POS[FILTER_MAX_RULES];
+static uint8_t CLASS_OF[256];
+static int CLASS_COUNT;
+static int POSITION_COUNT;
+static int STATE_COUNT;
+// Next state for each state and byte class, CLASS_COUNT to a state.
+static uint8_t TRANS[TRANS_SIZE];
+// First rule a state matched, counting rules anchored at the line end and
+// not, and whether the state can still change.
+static uint8_t STATE_RULE[MAX_STATES];
+static uint8_t STATE_BEST[MAX_STATES];
+static bool STATE_FINAL[MAX_STATES];
+
+// Rules file while loading, then the NFA while compiling.
+static union {
+    char file[FILTER_FILE_MAXLEN + 1];
+    struct {
+        Position positions[MAX_POSITIONS];
+        StateSet states[MAX_STATES];
+    } nfa;
+} WORK;
+#define FILE_BUF WORK.file
+#define POSITIONS WORK.nfa.positions
+#define STATES WORK.nfa.states
+
+static const char *parse_rule(char *line, FilterRule *rule);
+static char *split_word(char **rest);
+static const char *parse_pattern(const FilterRule *rule, AtomFxn atom,
+                                 bool *start, bool *end);
+static const char *parse_class(const char *p, uint32_t *set);
+static bool parse_escape(char c, uint32_t *set);
+static int refine_classes(const uint32_t *set, Quant quant, int rule);
+static int add_position(const uint32_t *set, Quant quant, int rule);
+static int compile(void);
+static void settle(StateSet *set, bool first);
+static bool settled(const StateSet *set, int rule);
+static int find_state(const StateSet *set);
+
+/**
+ * Sets up the filter mutex. Should be called before BIOS starts.
+ */
+void filter_prebios(void) {
+    if (lock_init(&FILTER_MUTEX, "FILTER_MUTEX") != 0) {
+        System_abort("Failed to create filter mutex\n");
+    }
+}
+
+/**
+ * Reads FILTER_FILE from the SD card, and compiles its rules, replacing the
+ * current ones. Each line that could not be used is written to the log as a
+ * record. Should only be called by the SD writer.
+ * @return number of rules, or -1 if the file could not be read or the rules
+ * could not be compiled, in which case no lines are filtered.
+ */
+int filter_load(void) {
+    char *line, *next, *end;
+    const char *error;
+    int len, line_num = 0, count = 0;
+    lock_acquire(&FILTER_MUTEX);
+    RULE_COUNT = 0;
+    len = read_sd_file(FILTER_FILE, FILE_BUF, FILTER_FILE_MAXLEN);
+    if (len < 0) {
+        lock_release(&FILTER_MUTEX);
+        return -1;
+    }
+    FILE_BUF[len] = '\0';
+    for (line = FILE_BUF; line != NULL; line = next) {
+        line_num++;
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        // Trim leading and trailing whitespace, including '\r'.
+        while (isspace((unsigned char)*line)) {
+            line++;
+        }
+        end = line + strlen(line);
+        while (end > line && isspace((unsigned char)end[-1])) {
+            *--end = '\0';
+        }
+        if (*line == '\0' || *line == '#') {
+            continue;
+        }
+        if (count == FILTER_MAX_RULES) {
+            write_record("Filter line %d: more than %d rules, ignoring the "
+                         "rest",
+                         line_num, FILTER_MAX_RULES);
+            break;
+        }
+        error = parse_rule(line, &RULES[count]);
+        if (error != NULL) {
+            write_record("Filter line %d: %s", line_num, error);
+            continue;
+        }
+        count++;
+    }
+    RULE_COUNT = count;
+    if (count != 0 && compile() != 0) {
+        write_record("Filter rules exceed the DFA limits of %d states, %d "
+                     "byte classes and %d positions, not filtering",
+                     MAX_STATES, MAX_CLASSES, MAX_POSITIONS);
+        RULE_COUNT = 0;
+        count = -1;
+    }
+    lock_release(&FILTER_MUTEX);
+    return count;
+}
+
+/**
+ * Matches a line against the rules. Should only be called by the SD writer.
+ * @param line: line to match
+ * @param len: length of line, which may include its line ending. Rules
+ * anchored at the line end only match if it does, so the start of a line
+ * passed on in pieces is not matched against them.
+ * @return true if the line should be dropped.
+ */
+bool filter_drop(const char *line, int len) {
+    uint8_t state = 0, rule;
+    bool line_end;
+    int i;
+    if (RULE_COUNT == 0) {
+        return false;
+    }
+    line_end = len > 0 && line[len - 1] == '\n';
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        len--;
+    }
+    for (i = 0; i < len && !STATE_FINAL[state]; i++) {
+        state = TRANS[state * CLASS_COUNT + CLASS_OF[(uint8_t)line[i]]];
+    }
+    rule = line_end ? STATE_RULE[state] : STATE_BEST[state];
+    if (rule == NO_RULE) {
+        return false;
+    }
+    // The console reads and clears the counts.
+    lock_acquire(&FILTER_MUTEX);
+    RULES[rule].hits++;
+    lock_release(&FILTER_MUTEX);
+    return RULES[rule].action == FILTER_DROP;
+}
+
+/**
+ * Gets a copy of a rule, with its hit count, for listing them.
+ * @param index: index of the rule, from 0
+ * @param rule: filled with the rule
+ * @return 0 on success, or -1 if there is no rule at index.
+ */
+int filter_get(int index, FilterRule *rule) {
+    int ret = -1;
+    lock_acquire(&FILTER_MUTEX);
+    if (index < RULE_COUNT) {
+        *rule = RULES[index];
+        ret = 0;
+    }
+    lock_release(&FILTER_MUTEX);
+    return ret;
+}
+
+/**
+ * Clears the hit counts of all rules.
+ */
+void filter_reset(void) {
+    int i;
+    lock_acquire(&FILTER_MUTEX);
+    for (i = 0; i < RULE_COUNT; i++) {
+        RULES[i].hits = 0;
+    }
+    lock_release(&FILTER_MUTEX);
+}
+
+/**
+ * Gets the name of a rule's action, as written in the rules file.
+ * @param action: action of the rule
+ * @return name of the action.
+ */
+const char *filter_action_name(FilterAction action) {
+    return ACTION_NAMES[action];
+}
+
+/**
+ * Gets the name of a rule's type, as written in the rules file.
+ * @param type: type of the rule
+ * @return name of the type.
+ */
+const char *filter_type_name(FilterType type) { return TYPE_NAMES[type]; }
+
+/**
+ * Parses a line of the rules file, and checks the syntax of its pattern.
+ * @param line: line, without leading and trailing whitespace. Modified.
+ * @param rule: filled with the rule
+ * @return NULL on success, or a description of the error.
+ */
+static const char *parse_rule(char *line, FilterRule *rule) {
+    char *action = split_word(&line);
+    char *type = split_word(&line);
+    bool start, end;
+    if (strcmp(action, "keep") == 0) {
+        rule->action = FILTER_KEEP;
+    } else if (strcmp(action, "drop") == 0) {
+        rule->action = FILTER_DROP;
+    } else {
+        return "expected keep or drop";
+    }
+    if (strcmp(type, "prefix") == 0) {
+        rule->type = FILTER_PREFIX;
+    } else if (strcmp(type, "contains") == 0) {
+        rule->type = FILTER_CONTAINS;
+    } else if (strcmp(type, "regex") == 0) {
+        rule->type = FILTER_REGEX;
+    } else {
+        return "expected prefix, contains or regex";
+    }
+    if (*line == '\0') {
+        return "missing pattern";
+    }
+    if (strlen(line) >= FILTER_PATTERN_MAXLEN) {
+        return "pattern is too long";
+    }
+    strcpy(rule->pattern, line);
+    rule->hits = 0;
+    // Check the syntax now, so errors are reported against their line.
+    return parse_pattern(rule, NULL, &start, &end);
+}
+
+/**
+ * Splits the first word off a string.
+ * @param rest: string, set to the text after the word and its spaces
+ * @return the word, NUL terminated, or an empty string if there is none.
+ */
+static char *split_word(char **rest) {
+    char *word = *rest, *p = *rest;
+    while (*p != '\0' && *p != ' ' && *p != '\t') {
+        p++;
+    }
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    *rest = p;
+    return word;
+}
+
+/**
+ * Parses a rule's pattern into atoms, each a set of bytes and a quantifier.
+ * @param rule: rule to parse
+ * @param atom: function receiving each atom in order, or NULL to only check
+ * the syntax
+ * @param start: set to true if the pattern is anchored at the line start
+ * @param end: set to true if the pattern is anchored at the line end
+ * @return NULL on success, or a description of the error.
+ */
+static const char *parse_pattern(const FilterRule *rule, AtomFxn atom,
+                                 bool *start, bool *end) {
+    const char *p = rule->pattern;
+    bool regex = rule->type == FILTER_REGEX;
+    uint32_t set[8];
+    Quant quant;
+    *start = rule->type == FILTER_PREFIX;
+    *end = false;
+    if (regex && *p == '^') {
+        *start = true;
+        p++;
+    }
+    while (*p != '\0') {
+        memset(set, 0, sizeof(set));
+        if (!regex) {
+            set[(uint8_t)*p / 32] |= 1u << ((uint8_t)*p % 32);
+            p++;
+        } else if (*p == '$' && p[1] == '\0') {
+            *end = true;
+            break;
+        } else if (*p == '.') {
+            memset(set, 0xFF, sizeof(set));
+            p++;
+        } else if (*p == '[') {
+            p = parse_class(p + 1, set);
+            if (p == NULL) {
+                return "unterminated or bad character class";
+            }
+        } else if (*p == '\\') {
+            if (p[1] == '\0') {
+                return "pattern ends in '\\'";
+            }
+            parse_escape(p[1], set);
+            p += 2;
+        } else if (*p == '*' || *p == '+' || *p == '?') {
+            return "quantifier without anything to repeat";
+        } else {
+            set[(uint8_t)*p / 32] |= 1u << ((uint8_t)*p % 32);
+            p++;
+        }
+        quant = QUANT_ONE;
+        if (regex && *p == '*') {
+            quant = QUANT_STAR;
+            p++;
+        } else if (regex && *p == '?') {
+            quant = QUANT_OPT;
+            p++;
+        } else if (regex && *p == '+') {
+            // One, followed by any more.
+            if (atom != NULL && atom(set, QUANT_ONE, rule - RULES) != 0) {
+                return "too complex";
+            }
+            quant = QUANT_STAR;
+            p++;
+        }
+        if (atom != NULL && atom(set, quant, rule - RULES) != 0) {
+            return "too complex";
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Parses a character class, after its '['.
+ * @param p: pattern, after the '['
+ * @param set: 256 bit mask, set to the bytes in the class
+ * @return pattern after the closing ']', or NULL if the class is bad.
+ */
+static const char *parse_class(const char *p, uint32_t *set) {
+    bool negate = false;
+    uint8_t lo, hi;
+    int i;
+    if (*p == '^') {
+        negate = true;
+        p++;
+    }
+    // A ']' first is taken literally.
+    do {
+        if (*p == '\0') {
+            return NULL;
+        }
+        if (*p == '\\') {
+            if (p[1] == '\0') {
+                return NULL;
+            }
+            if (parse_escape(p[1], set)) {
+                // A class escape can't start a range.
+                p += 2;
+                continue;
+            }
+            lo = (uint8_t)p[1];
+            p += 2;
+        } else {
+            lo = (uint8_t)*p++;
+        }
+        hi = lo;
+        if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+            hi = (uint8_t)p[1];
+            p += 2;
+            if (hi < lo) {
+                return NULL;
+            }
+        }
+        for (i = lo; i <= hi; i++) {
+            set[i / 32] |= 1u << (i % 32);
+        }
+    } while (*p != ']');
+    if (negate) {
+        for (i = 0; i < 8; i++) {
+            set[i] = ~set[i];
+        }
+    }
+    return p + 1;
+}
+
+/**
+ * Adds the bytes matched by an escape to a set.
+ * @param c: character after the '\'
+ * @param set: 256 bit mask to add to
+ * @return true if the escape is a class ("\d", "\s" or "\w"), or false if it
+ * is the character itself.
+ */
+static bool parse_escape(char c, uint32_t *set) {
+    int i;
+    bool class_escape = c == 'd' || c == 's' || c == 'w';
+    for (i = 0; i < 256; i++) {
+        if ((c == 'd' && isdigit(i)) || (c == 's' && isspace(i)) ||
+            (c == 'w' && (isalnum(i) || i == '_')) ||
+            (!class_escape && i == (uint8_t)c)) {
+            set[i / 32] |= 1u << (i % 32);
+        }
+    }
+    return class_escape;
+}
+
+/**
+ * Atom function splitting the byte classes, so the bytes of each class are
+ * either all in the atom's set, or all outside it.
+ * @return 0 on success, or -1 if there would be too many classes.
+ */
+static int refine_classes(const uint32_t *set, Quant quant, int rule) {
+    uint16_t size[MAX_CLASSES] = {0}, in[MAX_CLASSES] = {0};
+    uint8_t split[MAX_CLASSES];
+    int i, count = CLASS_COUNT;
+    for (i = 0; i < 256; i++) {
+        size[CLASS_OF[i]]++;
+        if (set[i / 32] & (1u << (i % 32))) {
+            in[CLASS_OF[i]]++;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        split[i] = i;
+        if (in[i] != 0 && in[i] != size[i]) {
+            if (CLASS_COUNT == MAX_CLASSES) {
+                return -1;
+            }
+            split[i] = CLASS_COUNT++;
+        }
+    }
+    for (i = 0; i < 256; i++) {
+        if (set[i / 32] & (1u << (i % 32))) {
+            CLASS_OF[i] = split[CLASS_OF[i]];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Atom function adding an NFA position for the atom.
+ * @return 0 on success, or -1 if there would be too many positions.
+ */
+static int add_position(const uint32_t *set, Quant quant, int rule) {
+    uint32_t classes = 0;
+    int i;
+    if (POSITION_COUNT == MAX_POSITIONS) {
+        return -1;
+    }
+    for (i = 0; i < 256; i++) {
+        if (set[i / 32] & (1u << (i % 32))) {
+            classes |= 1u << CLASS_OF[i];
+        }
+    }
+    POSITIONS[POSITION_COUNT].classes = classes;
+    POSITIONS[POSITION_COUNT].quant = quant;
+    POSITIONS[POSITION_COUNT].rule = rule;
+    POSITION_COUNT++;
+    return 0;
+}
+
+/**
+ * Compiles RULES into the DFA.
+ * @return 0 on success, or -1 if a limit was reached.
+ */
+static int compile(void) {
+    StateSet next;
+    int r, s, c, p, t;
+    memset(CLASS_OF, 0, sizeof(CLASS_OF));
+    CLASS_COUNT = 1;
+    for (r = 0; r < RULE_COUNT; r++) {
+        if (parse_pattern(&RULES[r], refine_classes, &ANCHOR_START[r],
+                          &ANCHOR_END[r]) != NULL) {
+            return -1;
+        }
+    }
+    POSITION_COUNT = 0;
+    for (r = 0; r < RULE_COUNT; r++) {
+        FIRST_POS[r] = POSITION_COUNT;
+        if (parse_pattern(&RULES[r], add_position, &ANCHOR_START[r],
+                          &ANCHOR_END[r]) != NULL ||
+            POSITION_COUNT == MAX_POSITIONS) {
+            return -1;
+        }
+        // The accepting position matches nothing, so it has no successor.
+        ACCEPT_POS[r] = POSITION_COUNT;
+        POSITIONS[POSITION_COUNT].classes = 0;
+        POSITIONS[POSITION_COUNT].quant = QUANT_ONE;
+        POSITIONS[POSITION_COUNT].rule = r;
+        POSITION_COUNT++;
+    }
+    memset(&next, 0, sizeof(next));
+    next.best = NO_RULE;
+    settle(&next, true);
+    STATE_COUNT = 0;
+    if (find_state(&next) < 0) {
+        return -1;
+    }
+    // States are added as they are found, so this visits all of them.
+    for (s = 0; s < STATE_COUNT; s++) {
+        for (c = 0; c < CLASS_COUNT; c++) {
+            memset(&next, 0, sizeof(next));
+            next.best = STATES[s].best;
+            for (p = 0; p < POSITION_COUNT; p++) {
+                if (!(STATES[s].bits[p / 32] & (1u << (p % 32))) ||
+                    !(POSITIONS[p].classes & (1u << c))) {
+                    continue;
+                }
+                t = POSITIONS[p].quant == QUANT_STAR ? p : p + 1;
+                next.bits[t / 32] |= 1u << (t % 32);
+            }
+            settle(&next, false);
+            t = find_state(&next);
+            if (t < 0) {
+                return -1;
+            }
+            TRANS[s * CLASS_COUNT + c] = t;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Completes a set of positions after a step: starts the rules that can
+ * match anywhere, follows the positions that can be skipped, records the
+ * first rule matched, and drops the positions of rules that can no longer
+ * change the result.
+ * @param set: set to complete
+ * @param first: true for the set at the start of a line, which also starts
+ * the rules anchored there
+ */
+static void settle(StateSet *set, bool first) {
+    int r, p;
+    for (r = 0; r < RULE_COUNT && r < set->best; r++) {
+        if ((first || !ANCHOR_START[r]) && !settled(set, r)) {
+            p = FIRST_POS[r];
+            set->bits[p / 32] |= 1u << (p % 32);
+        }
+    }
+    // Skips only lead forward, so one pass in order follows all of them.
+    for (p = 0; p < POSITION_COUNT; p++) {
+        if ((set->bits[p / 32] & (1u << (p % 32))) &&
+            POSITIONS[p].classes != 0 && POSITIONS[p].quant != QUANT_ONE) {
+            set->bits[(p + 1) / 32] |= 1u << ((p + 1) % 32);
+        }
+    }
+    for (r = 0; r < RULE_COUNT && r < set->best; r++) {
+        p = ACCEPT_POS[r];
+        if (!ANCHOR_END[r] && (set->bits[p / 32] & (1u << (p % 32)))) {
+            set->best = r;
+        }
+    }
+    for (p = 0; p < POSITION_COUNT; p++) {
+        if (settled(set, POSITIONS[p].rule)) {
+            set->bits[p / 32] &= ~(1u << (p % 32));
+        }
+    }
+}
+
+/**
+ * Checks if a rule can no longer change the result of a line: it comes
+ * after the first rule matched, or has the same action. Of rules with the
+ * same action, the one matched first in the line is counted.
+ * @param set: set holding the first rule matched
+ * @param rule: index of the rule
+ * @return true if the rule's positions can be dropped.
+ */
+static bool settled(const StateSet *set, int rule) {
+    return set->best != NO_RULE &&
+           (rule >= set->best ||
+            RULES[rule].action == RULES[set->best].action);
+}
+
+/**
+ * Finds the DFA state for a set of positions, adding it if it is new.
+ * @param set: set of positions, and the first rule matched
+ * @return index of the state, or -1 if there would be too many states.
+ */
+static int find_state(const StateSet *set) {
+    int s, r, p;
+    bool active = false;
+    for (s = 0; s < STATE_COUNT; s++) {
+        if (STATES[s].best == set->best &&
+            memcmp(STATES[s].bits, set->bits, sizeof(set->bits)) == 0) {
+            return s;
+        }
+    }
+    if (STATE_COUNT == MAX_STATES ||
+        (STATE_COUNT + 1) * CLASS_COUNT > TRANS_SIZE) {
+        return -1;
+    }
+    STATES[s] = *set;
+    STATE_COUNT++;
+    // Rules anchored at the line end only match if the line ends here.
+    STATE_BEST[s] = set->best;
+    STATE_RULE[s] = set->best;
+    for (r = 0; r < RULE_COUNT && r < STATE_RULE[s]; r++) {
+        p = ACCEPT_POS[r];
+        if (ANCHOR_END[r] && (set->bits[p / 32] & (1u << (p % 32)))) {
+            STATE_RULE[s] = r;
+        }
+    }
+    for (p = 0; p < POSITION_WORDS; p++) {
+        active |= set->bits[p] != 0;
+    }
+    STATE_FINAL[s] = !active;
+    return s;
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+/**
+ * @file filter.h
+ * Implements line filter rules, which drop known noise from the log before
+ * it is stored. Rules are read from FILTER_FILE on the SD card each time it
+ * is mounted, or on the "filter load" command, one per line:
+ *
+ *     # <keep|drop> <prefix|contains|regex> <pattern>
+ *     keep contains sensor: fault
+ *     drop prefix sensor:
+ *     drop regex ^\[ *[0-9.]+\] random: .*bytes$
+ *
+ * The first rule matching a line decides whether it is kept, so keep rules
+ * placed first make exceptions to later drop rules. Lines no rule matches
+ * are kept. The pattern is the rest of the line, and matches the line
+ * without its line ending.
+ *
+ * Regex patterns support literals, '.', character classes ("[a-z]",
+ * "[^0-9]"), the escapes "\d", "\s" and "\w", the quantifiers '*', '+' and
+ * '?', and the anchors '^' and '$'. Without '^', a pattern can match
+ * anywhere in the line. '$' only matches before a line ending, so not in a
+ * line matched before it ended, such as an overlong line, or a prompt
+ * flushed as the UART went idle.
+ *
+ * All rules are compiled together into a single DFA, so each byte of a line
+ * costs one table lookup however many rules there are, and matching stops
+ * as soon as the result is known. The DFA is only used by the SD writer.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sd_card.h"
+
+// Filter rules file, read on mount.
+#define FILTER_FILE DRIVE_PREFIX "FILTERS.TXT"
+// Most rules, and longest pattern, including the terminator.
+#define FILTER_MAX_RULES 16
+#define FILTER_PATTERN_MAXLEN 40
+
+typedef enum { FILTER_KEEP, FILTER_DROP } FilterAction;
+
+typedef enum { FILTER_PREFIX, FILTER_CONTAINS, FILTER_REGEX } FilterType;
+
+typedef struct {
+    /*! what happens to lines the rule matches first */
+    FilterAction action;
+    /*! how the pattern is matched */
+    FilterType type;
+    /*! pattern, as written in the rules file */
+    char pattern[FILTER_PATTERN_MAXLEN];
+    /*! lines the rule decided on. Of several rules with the same action
+     * matching a line, the one matched first in the line counts it. */
+    uint32_t hits;
+} FilterRule;
+
+/**
+ * Sets up the filter mutex. Should be called before BIOS starts.
+ */
+void filter_prebios(void);
+
+/**
+ * Reads FILTER_FILE from the SD card, and compiles its rules, replacing the
+ * current ones. Each line that could not be used is written to the log as a
+ * record. Should only be called by the SD writer.
+ * @return number of rules, or -1 if the file could not be read or the rules
+ * could not be compiled, in which case no lines are filtered.
+ */
+int filter_load(void);
+
+/**
+ * Matches a line against the rules. Should only be called by the SD writer.
+ * @param line: line to match
+ * @param len: length of line, which may include its line ending
+ * @return true if the line should be dropped.
+ */
+bool filter_drop(const char *line, int len);
+
+/**
+ * Gets a copy of a rule, with its hit count, for listing them.
+ * @param index: index of the rule, from 0
+ * @param rule: filled with the rule
+ * @return 0 on success, or -1 if there is no rule at index.
+ */
+int filter_get(int index, FilterRule *rule);
+
+/**
+ * Clears the hit counts of all rules.
+ */
+void filter_reset(void);
+
+/**
+ * Gets the name of a rule's action, as written in the rules file.
+ * @param action: action of the rule
+ * @return name of the action.
+ */
+const char *filter_action_name(FilterAction action);
+
+/**
+ * Gets the name of a rule's type, as written in the rules file.
+ * @param type: type of the rule
+ * @return name of the type.
+ */
+const char *filter_type_name(FilterType type);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,402 @@
+/**
+ * @file flash_log.c
+ * Implements the emergency flash log. See flash_log.h for when data is
+ * captured, and how it survives a power failure.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/Error.h>
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/hal/Hwi.h>
+
+/* TivaWare driver files */
+#include <inc/hw_ints.h>
+#include <driverlib/flash.h>
+#include <driverlib/sysctl.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cli.h"
+#include "flash_log.h"
+#include "lock.h"
+#include "log_buffer.h"
+#include "pipeline_wdt.h"
+#include "sd_card.h"
+#include "timebase.h"
+
+// Erase page size of the internal flash.
+#define FLASH_PAGE_SIZE 1024
+#define FLASH_PAGE_MAGIC 0x464C4F47 // "FLOG"
+// Page flags.
+#define FLASH_PAGE_POWER_FAIL 0x0001
+
+// Bounds of the flash log region, defined by the linker script.
+extern uint32_t __flash_log_start__[];
+extern uint32_t __flash_log_end__[];
+#define FLASH_LOG_BASE ((uint32_t)__flash_log_start__)
+#define FLASH_LOG_PAGES                                                        \
+    (((uint32_t)__flash_log_end__ - FLASH_LOG_BASE) / FLASH_PAGE_SIZE)
+
+typedef struct {
+    /*! FLASH_PAGE_MAGIC once the page is written */
+    uint32_t magic;
+    /*! sequence number, counting up with each page written */
+    uint32_t seq;
+    /*! number of valid bytes in data */
+    uint16_t len;
+    /*! FLASH_PAGE_* flags */
+    uint16_t flags;
+    /*! uptime the page was written at, in seconds */
+    uint32_t uptime_s;
+} FlashPageHeader;
+
+#define FLASH_PAGE_DATA (FLASH_PAGE_SIZE - sizeof(FlashPageHeader))
+
+typedef struct {
+    FlashPageHeader header;
+    char data[FLASH_PAGE_DATA];
+} FlashPage;
+
+// Protects the staged page and the write position between tasks.
+static Lock FLASH_LOG_MUTEX;
+// Page being filled in RAM. Programmed from the start, so word aligned.
+static FlashPage STAGE;
+// Index of the next page to write, which is kept erased, and its sequence.
+static uint32_t NEXT_PAGE = 0;
+static uint32_t NEXT_SEQ = 1;
+// True while a task is erasing or programming flash.
+static volatile bool FLASH_BUSY = false;
+// Set once the log is full, until it is erased, and the bytes dropped since.
+static bool FULL = false;
+static uint32_t DROPPED = 0;
+
+static const FlashPage *page_at(uint32_t index);
+static bool page_valid(const FlashPage *page);
+static bool page_erased(uint32_t index);
+static bool log_full(void);
+static int program_stage(uint16_t flags);
+static void write_stage(void);
+static void brown_out_hwi(UArg arg);
+
+/**
+ * Finds the newest page in the flash log, and sets up the brown-out
+ * interrupt. Should be called before BIOS starts.
+ */
+void flash_log_prebios(void) {
+    Error_Block eb;
+    Hwi_Params hwi_params;
+    const FlashPage *page;
+    uint32_t i;
+    bool found = false;
+    if (lock_init(&FLASH_LOG_MUTEX, "FLASH_LOG_MUTEX") != 0) {
+        System_abort("Failed to create flash log mutex\n");
+    }
+    // The page after the newest is written next.
+    for (i = 0; i < FLASH_LOG_PAGES; i++) {
+        page = page_at(i);
+        if (page_valid(page) &&
+            (!found || (int32_t)(page->header.seq - NEXT_SEQ) >= 0)) {
+            found = true;
+            NEXT_SEQ = page->header.seq + 1;
+            NEXT_PAGE = (i + 1) % FLASH_LOG_PAGES;
+        }
+    }
+    if (!page_erased(NEXT_PAGE)) {
+        FlashErase(FLASH_LOG_BASE + NEXT_PAGE * FLASH_PAGE_SIZE);
+    }
+    /*
+     * The brown-out interrupt fires while the supply is still high enough to
+     * program flash, but not to erase it.
+     */
+    Error_init(&eb);
+    Hwi_Params_init(&hwi_params);
+    if (Hwi_create(INT_SYSCTL, brown_out_hwi, &hwi_params, &eb) == NULL) {
+        System_abort("Failed to create brown-out Hwi\n");
+    }
+    SysCtlIntClear(SYSCTL_INT_BOR);
+    SysCtlIntEnable(SYSCTL_INT_BOR);
+    System_printf("Flash log: %lu pages, next sequence %lu\n",
+                  (unsigned long)FLASH_LOG_PAGES, (unsigned long)NEXT_SEQ);
+    System_flush();
+}
+
+/**
+ * Captures data into the flash log. Full pages are written to flash. Should
+ * only be called by the SD writer.
+ * @param data: data to capture
+ * @param len: length of data
+ * @return number of bytes captured, less than len once the log is full.
+ */
+int flash_log_write(const char *data, int len) {
+    int chunk, captured = 0;
+    UInt key;
+    if (lock_acquire(&FLASH_LOG_MUTEX) != 0) {
+        System_abort("Could not lock flash log mutex");
+    }
+    while (len > 0) {
+        if (FULL) {
+            DROPPED += len;
+            break;
+        }
+        chunk = FLASH_PAGE_DATA - STAGE.header.len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        // The brown-out Hwi also appends to the stage.
+        key = Hwi_disable();
+        memcpy(STAGE.data + STAGE.header.len, data, chunk);
+        STAGE.header.len += chunk;
+        Hwi_restore(key);
+        data += chunk;
+        len -= chunk;
+        captured += chunk;
+        if (STAGE.header.len == FLASH_PAGE_DATA) {
+            write_stage();
+        }
+    }
+    lock_release(&FLASH_LOG_MUTEX);
+    return captured;
+}
+
+/**
+ * Writes any staged data to flash, as a partial page. Should only be called
+ * by the SD writer.
+ */
+void flash_log_flush(void) {
+    if (lock_acquire(&FLASH_LOG_MUTEX) != 0) {
+        System_abort("Could not lock flash log mutex");
+    }
+    if (STAGE.header.len != 0) {
+        write_stage();
+    }
+    lock_release(&FLASH_LOG_MUTEX);
+}
+
+/**
+ * Gets the state of the flash log.
+ * @param status: filled with the current state.
+ */
+void flash_log_status(FlashLogStatus *status) {
+    const FlashPage *page;
+    uint32_t i;
+    *status = (FlashLogStatus){0};
+    if (lock_acquire(&FLASH_LOG_MUTEX) != 0) {
+        System_abort("Could not lock flash log mutex");
+    }
+    // Pages are in sequence order, starting after the erased next page.
+    for (i = 1; i < FLASH_LOG_PAGES; i++) {
+        page = page_at((NEXT_PAGE + i) % FLASH_LOG_PAGES);
+        if (!page_valid(page)) {
+            continue;
+        }
+        if (status->pages == 0) {
+            status->oldest_seq = page->header.seq;
+        }
+        status->pages++;
+        status->bytes += page->header.len;
+        status->newest_seq = page->header.seq;
+        status->power_fail =
+            (page->header.flags & FLASH_PAGE_POWER_FAIL) != 0;
+    }
+    status->staged = STAGE.header.len;
+    status->full = FULL;
+    status->dropped = DROPPED;
+    lock_release(&FLASH_LOG_MUTEX);
+}
+
+/**
+ * Copies the flash log, oldest page first, to a file on the SD card.
+ * @param ctx: CLI context to print progress to
+ * @param name: file to append the log to, including the drive number
+ * @return number of bytes copied, or -1 on error.
+ */
+int flash_log_copy(CLIContext *ctx, const char *name) {
+    static const char power_fail_str[] = "\n------- Power failed -----------\n";
+    const FlashPage *page;
+    uint32_t i;
+    int copied = 0;
+    if (lock_acquire(&FLASH_LOG_MUTEX) != 0) {
+        System_abort("Could not lock flash log mutex");
+    }
+    for (i = 1; i < FLASH_LOG_PAGES; i++) {
+        page = page_at((NEXT_PAGE + i) % FLASH_LOG_PAGES);
+        if (!page_valid(page)) {
+            continue;
+        }
+        // Flash is memory mapped, so write straight from it.
+        if (append_sd_file(name, page->data, page->header.len) !=
+            page->header.len) {
+            copied = -1;
+            break;
+        }
+        copied += page->header.len;
+        if ((page->header.flags & FLASH_PAGE_POWER_FAIL) &&
+            append_sd_file(name, power_fail_str, sizeof(power_fail_str) - 1) !=
+                sizeof(power_fail_str) - 1) {
+            copied = -1;
+            break;
+        }
+        cli_printf(ctx, "Copied page %lu, %u bytes\r\n",
+                   (unsigned long)page->header.seq, page->header.len);
+        // Each page opens and closes the file, so this can take a while.
+        wdt_checkin(WDT_STAGE_CONSOLE);
+    }
+    lock_release(&FLASH_LOG_MUTEX);
+    return copied;
+}
+
+/**
+ * Erases the flash log.
+ */
+void flash_log_erase(void) {
+    uint32_t i;
+    if (lock_acquire(&FLASH_LOG_MUTEX) != 0) {
+        System_abort("Could not lock flash log mutex");
+    }
+    FLASH_BUSY = true;
+    for (i = 0; i < FLASH_LOG_PAGES; i++) {
+        if (!page_erased(i)) {
+            FlashErase(FLASH_LOG_BASE + i * FLASH_PAGE_SIZE);
+        }
+    }
+    NEXT_PAGE = 0;
+    FULL = false;
+    DROPPED = 0;
+    FLASH_BUSY = false;
+    lock_release(&FLASH_LOG_MUTEX);
+}
+
+/**
+ * Gets a page of the flash log.
+ * @param index: index of the page in the flash log region
+ * @return pointer to the memory mapped page.
+ */
+static const FlashPage *page_at(uint32_t index) {
+    return (const FlashPage *)(FLASH_LOG_BASE + index * FLASH_PAGE_SIZE);
+}
+
+/**
+ * Checks if a page holds data.
+ * @param page: page to check
+ * @return true if the page was written, false otherwise.
+ */
+static bool page_valid(const FlashPage *page) {
+    return page->header.magic == FLASH_PAGE_MAGIC &&
+           page->header.len <= FLASH_PAGE_DATA;
+}
+
+/**
+ * Checks if a page is erased, so it can be programmed.
+ * @param index: index of the page in the flash log region
+ * @return true if every word of the page is erased, false otherwise.
+ */
+static bool page_erased(uint32_t index) {
+    const uint32_t *word = (const uint32_t *)page_at(index);
+    int i;
+    for (i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (word[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks if writing the next page would leave no erased page for a
+ * brown-out without erasing older data.
+ * @return true if the log is full.
+ */
+static bool log_full(void) {
+    return page_valid(page_at(NEXT_PAGE)) ||
+           page_valid(page_at((NEXT_PAGE + 1) % FLASH_LOG_PAGES));
+}
+
+/**
+ * Programs the staged page into the next page, which must be erased, and
+ * empties the stage. Must be called with the flash log mutex held, or from
+ * the brown-out Hwi.
+ * @param flags: FLASH_PAGE_* flags of the page
+ * @return 0 on success, or -1 on error.
+ */
+static int program_stage(uint16_t flags) {
+    uint32_t len;
+    STAGE.header.magic = FLASH_PAGE_MAGIC;
+    STAGE.header.seq = NEXT_SEQ;
+    STAGE.header.flags = flags;
+    STAGE.header.uptime_s = (uint32_t)(timebase_now_us() / 1000000);
+    // Only program the words holding data, as programming is word by word.
+    len = (sizeof(FlashPageHeader) + STAGE.header.len + 3) & ~3;
+    if (FlashProgram((uint32_t *)&STAGE,
+                     FLASH_LOG_BASE + NEXT_PAGE * FLASH_PAGE_SIZE, len) != 0) {
+        return -1;
+    }
+    NEXT_SEQ++;
+    NEXT_PAGE = (NEXT_PAGE + 1) % FLASH_LOG_PAGES;
+    STAGE.header.len = 0;
+    return 0;
+}
+
+/**
+ * Writes the staged page to flash, and erases the page after it, so the
+ * brown-out Hwi only has to program. If the log is full, the staged data is
+ * dropped instead. Must be called with the flash log mutex held.
+ */
+static void write_stage(void) {
+    if (log_full()) {
+        FULL = true;
+        DROPPED += STAGE.header.len;
+        STAGE.header.len = 0;
+        return;
+    }
+    // Keeps the brown-out Hwi away from the stage and the next page.
+    FLASH_BUSY = true;
+    // A brown-out programmed the erased page since the last write.
+    if (!page_erased(NEXT_PAGE)) {
+        FlashErase(FLASH_LOG_BASE + NEXT_PAGE * FLASH_PAGE_SIZE);
+    }
+    if (program_stage(0) != 0) {
+        // Drop the page, rather than retrying a failing write forever.
+        STAGE.header.len = 0;
+    }
+    // The next page is usually still erased since the log was last cleared.
+    if (!page_erased(NEXT_PAGE)) {
+        FlashErase(FLASH_LOG_BASE + NEXT_PAGE * FLASH_PAGE_SIZE);
+    }
+    FLASH_BUSY = false;
+}
+
+/**
+ * Hwi for the brown-out interrupt. Fills the stage with whole blocks still
+ * waiting on the writer, and programs it into the erased next page. If a
+ * task is erasing or programming flash, its page is left to finish instead.
+ *
+ * A brown-out is an interrupt, not a reset, so the supply may recover. Each
+ * block taken is released to the pool again, and blocks that don't fit are
+ * left for the writer, so no data is lost if it does.
+ * @param arg unused
+ */
+static void brown_out_hwi(UArg arg) {
+    LogBlock *block;
+    SysCtlIntClear(SysCtlIntStatus(true));
+    // Only capture once, even if the supply recovers and drops again.
+    SysCtlIntDisable(SYSCTL_INT_BOR);
+    // A full log may have no erased page left.
+    if (FLASH_BUSY || !page_erased(NEXT_PAGE)) {
+        return;
+    }
+    while (FLASH_PAGE_DATA - STAGE.header.len >= LOG_BLOCK_SIZE &&
+           (block = log_buffer_get_full(BIOS_NO_WAIT)) != NULL) {
+        memcpy(STAGE.data + STAGE.header.len, block->data, block->len);
+        STAGE.header.len += block->len;
+        log_buffer_release(block);
+    }
+    if (STAGE.header.len != 0) {
+        program_stage(FLASH_PAGE_POWER_FAIL);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+/**
+ * @file flash_log.h
+ * Implements the emergency flash log, kept in a region of internal flash
+ * reserved by the linker script (FLASHLOG in EK_TM4C123GXL.lds).
+ *
+ * While the SD card is unmounted, the SD writer captures log blocks here
+ * rather than leaving them in the buffer. Data is staged in RAM and written
+ * one erase page at a time, with the page after the newest one kept erased.
+ * On a brown-out, the staged data, and the whole blocks still waiting on the
+ * writer that fit, are programmed into that page without an erase, so the
+ * most recent data survives a power failure. If the supply recovers, the
+ * blocks captured are only in the flash log. The "flashlog copy" command
+ * copies the log to the SD card once one is mounted.
+ *
+ * Once the region is full, further data is dropped and counted, rather than
+ * erasing the oldest pages: a card left out for days would otherwise wear
+ * out the flash, at about 11 erases a second at 115200 baud. The log is
+ * written again from its start after "flashlog erase".
+ *
+ * Erasing and programming flash stalls instruction fetch, and so all
+ * interrupts, for up to the page erase time. The uDMA receive path keeps
+ * moving data into RAM during the stall; the interrupt receive path may
+ * overflow the RX FIFO.
+ */
+
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cli.h"
+
+typedef struct {
+    /*! number of pages holding data, and the bytes of data in them */
+    uint32_t pages;
+    uint32_t bytes;
+    /*! number of bytes staged in RAM, not yet in flash */
+    uint32_t staged;
+    /*! sequence numbers of the oldest and newest pages */
+    uint32_t oldest_seq;
+    uint32_t newest_seq;
+    /*! true if the newest page was written on a brown-out */
+    bool power_fail;
+    /*! true once the log is full, and the bytes dropped since */
+    bool full;
+    uint32_t dropped;
+} FlashLogStatus;
+
+/**
+ * Finds the newest page in the flash log, and sets up the brown-out
+ * interrupt. Should be called before BIOS starts.
+ */
+void flash_log_prebios(void);
+
+/**
+ * Captures data into the flash log. Full pages are written to flash. Should
+ * only be called by the SD writer.
+ * @param data: data to capture
+ * @param len: length of data
+ * @return number of bytes captured, less than len once the log is full.
+ */
+int flash_log_write(const char *data, int len);
+
+/**
+ * Writes any staged data to flash, as a partial page. Should only be called
+ * by the SD writer.
+ */
+void flash_log_flush(void);
+
+/**
+ * Gets the state of the flash log.
+ * @param status: filled with the current state.
+ */
+void flash_log_status(FlashLogStatus *status);
+
+/**
+ * Copies the flash log, oldest page first, to a file on the SD card.
+ * @param ctx: CLI context to print progress to
+ * @param name: file to append the log to, including the drive number
+ * @return number of bytes copied, or -1 on error.
+ */
+int flash_log_copy(CLIContext *ctx, const char *name);
+
+/**
+ * Erases the flash log.
+ */
+void flash_log_erase(void);
+
+#endif
\ No newline at end of file
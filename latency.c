@@ -0,0 +1,172 @@
+/**
+ * @file latency.c
+ * Implements end to end latency measurement, from a byte arriving on the
+ * logged UART to the f_sync call that makes it durable on the SD card.
+ * See latency.h for the sampling scheme.
+ */
+
+/* BIOS Header files */
+#include <ti/sysbios/hal/Hwi.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cli.h"
+#include "latency.h"
+#include "timebase.h"
+
+// Maximum number of samples waiting on a sync.
+#define LATENCY_MAX_PENDING 8
+/*
+ * Histogram buckets. Bucket 0 counts latencies under 1ms, and bucket n
+ * counts latencies from 2^(n-1) up to 2^n ms. The last bucket counts
+ * everything larger.
+ */
+#define LATENCY_BUCKETS 16
+
+typedef struct {
+    /*! number of latencies recorded */
+    uint32_t count;
+    /*! sum, min and max of latencies, in microseconds */
+    uint64_t total_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    /*! log2 histogram of latencies, see LATENCY_BUCKETS */
+    uint32_t buckets[LATENCY_BUCKETS];
+} LatencyStats;
+
+static uint64_t PENDING[LATENCY_MAX_PENDING];
+static int PENDING_COUNT = 0;
+static LatencyStats STATS;
+
+static void record_latency(uint32_t latency_us);
+
+/**
+ * Notes that a block was written to the SD card, and samples the arrival
+ * time of its first byte if required. Should be called for every block
+ * written by the logger.
+ * @param arrival: timebase value the first byte of the block arrived at.
+ */
+void latency_sample(uint64_t arrival) {
+    if (PENDING_COUNT < LATENCY_MAX_PENDING) {
+        PENDING[PENDING_COUNT++] = arrival;
+    }
+}
+
+/**
+ * Records the completion of a sync, adding the latency of all pending
+ * samples to the distribution.
+ * @param synced: timebase value the sync completed at.
+ */
+void latency_synced(uint64_t synced) {
+    int i;
+    for (i = 0; i < PENDING_COUNT; i++) {
+        record_latency((uint32_t)timebase_to_us(synced - PENDING[i]));
+    }
+    latency_discard();
+}
+
+/**
+ * Discards pending samples without recording them. Should be called if
+ * written data will not be synced, such as when the SD card is unmounted.
+ */
+void latency_discard(void) {
+    PENDING_COUNT = 0;
+}
+
+/**
+ * Resets the latency distribution.
+ */
+void latency_reset(void) {
+    int i;
+    UInt key = Hwi_disable();
+    STATS.count = 0;
+    STATS.total_us = 0;
+    STATS.min_us = UINT32_MAX;
+    STATS.max_us = 0;
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        STATS.buckets[i] = 0;
+    }
+    Hwi_restore(key);
+}
+
+/**
+ * Gets the number of latencies recorded, and the largest.
+ * @param count: set to the number of latencies recorded
+ * @param max_us: set to the largest latency, in microseconds, or 0 if none
+ * was recorded
+ */
+void latency_summary(uint32_t *count, uint32_t *max_us) {
+    UInt key = Hwi_disable();
+    *count = STATS.count;
+    *max_us = STATS.max_us;
+    Hwi_restore(key);
+}
+
+/**
+ * Prints the latency distribution.
+ * @param context: CLI context to print to.
+ */
+void latency_report(CLIContext *context) {
+    int i;
+    uint32_t seen, p50_ms = 0, p99_ms = 0;
+    LatencyStats stats;
+    // Take a consistent copy of the statistics.
+    UInt key = Hwi_disable();
+    stats = STATS;
+    Hwi_restore(key);
+    if (stats.count == 0) {
+        cli_printf(context, "No latency samples\r\n");
+        return;
+    }
+    cli_printf(context, "RX to durable latency, %lu samples\r\n",
+               (unsigned long)stats.count);
+    cli_printf(context, "min %lu us, max %lu us, mean %lu us\r\n",
+               (unsigned long)stats.min_us, (unsigned long)stats.max_us,
+               (unsigned long)(stats.total_us / stats.count));
+    // Percentiles are reported as the upper bound of their bucket.
+    seen = 0;
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats.buckets[i];
+        if (p50_ms == 0 && seen * 2 >= stats.count) {
+            p50_ms = 1UL << i;
+        }
+        if (p99_ms == 0 && seen * 100 >= stats.count * 99) {
+            p99_ms = 1UL << i;
+        }
+    }
+    cli_printf(context, "p50 < %lu ms, p99 < %lu ms\r\n",
+               (unsigned long)p50_ms, (unsigned long)p99_ms);
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        if (stats.buckets[i] != 0) {
+            cli_printf(context, "  < %5lu ms: %lu\r\n", 1UL << i,
+                       (unsigned long)stats.buckets[i]);
+        }
+    }
+}
+
+/**
+ * Adds a latency to the distribution.
+ * @param latency_us: latency in microseconds
+ */
+static void record_latency(uint32_t latency_us) {
+    int bucket = 0;
+    uint32_t latency_ms = latency_us / 1000;
+    UInt key;
+    // Find log2 bucket.
+    while (latency_ms != 0 && bucket < LATENCY_BUCKETS - 1) {
+        latency_ms >>= 1;
+        bucket++;
+    }
+    key = Hwi_disable();
+    if (STATS.count == 0 || latency_us < STATS.min_us) {
+        STATS.min_us = latency_us;
+    }
+    if (latency_us > STATS.max_us) {
+        STATS.max_us = latency_us;
+    }
+    STATS.count++;
+    STATS.total_us += latency_us;
+    STATS.buckets[bucket]++;
+    Hwi_restore(key);
+}
@@ -0,0 +1,60 @@
+/**
+ * @file latency.h
+ * Implements end to end latency measurement, from a byte arriving on the
+ * logged UART to the f_sync call that makes it durable on the SD card.
+ *
+ * Not every byte is measured. The first byte of each block written to the SD
+ * card is sampled, up to a limit per sync. The first block written after each
+ * sync holds the oldest, so worst case, unsynced byte, and is always sampled.
+ * When a sync completes, the latency of all pending samples is added to the
+ * latency distribution.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+#include "cli.h"
+
+/**
+ * Notes that a block was written to the SD card, and samples the arrival
+ * time of its first byte if required. Should be called for every block
+ * written by the logger.
+ * @param arrival: timebase value the first byte of the block arrived at.
+ */
+void latency_sample(uint64_t arrival);
+
+/**
+ * Records the completion of a sync, adding the latency of all pending
+ * samples to the distribution.
+ * @param synced: timebase value the sync completed at.
+ */
+void latency_synced(uint64_t synced);
+
+/**
+ * Discards pending samples without recording them. Should be called if
+ * written data will not be synced, such as when the SD card is unmounted.
+ */
+void latency_discard(void);
+
+/**
+ * Resets the latency distribution.
+ */
+void latency_reset(void);
+
+/**
+ * Gets the number of latencies recorded, and the largest.
+ * @param count: set to the number of latencies recorded
+ * @param max_us: set to the largest latency, in microseconds, or 0 if none
+ * was recorded
+ */
+void latency_summary(uint32_t *count, uint32_t *max_us);
+
+/**
+ * Prints the latency distribution.
+ * @param context: CLI context to print to.
+ */
+void latency_report(CLIContext *context);
+
+#endif
@@ -0,0 +1,322 @@
+/**
+ * @file lock.c
+ * Implements instrumented mutex wrappers, used to find which code paths
+ * contend on the locks shared with the ingest path. See lock.h for usage.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/knl/Task.h>
+
+/* Pthread support */
+#include <ti/sysbios/posix/pthread.h>
+
+#include <stdint.h>
+
+#include "cli.h"
+#include "lock.h"
+#include "timebase.h"
+
+/**
+ * Initializes a lock. Locks use priority inheritance, so a low priority task
+ * holding a lock runs at the priority of the highest task waiting for it.
+ * @param lock: lock to initialize
+ * @param name: name of the lock, used when reporting. Must be a static string.
+ * @return 0 on success, or a pthread error value.
+ */
+int lock_init(Lock *lock, const char *name) {
+    pthread_mutexattr_t attrs;
+    int ret;
+    lock->name = name;
+#ifdef PROFILING
+    lock->hold_site = -1;
+#endif
+    ret = pthread_mutexattr_init(&attrs);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = pthread_mutexattr_setprotocol(&attrs, PTHREAD_PRIO_INHERIT);
+    if (ret == 0) {
+        ret = pthread_mutex_init(&lock->mutex, &attrs);
+    }
+    pthread_mutexattr_destroy(&attrs);
+    return ret;
+}
+
+#ifdef PROFILING
+
+// Maximum number of distinct (lock, task) pairs tracked.
+#define LOCK_MAX_SITES 24
+
+typedef struct {
+    /*! lock and calling task this site tracks, and the name of the task */
+    Lock *lock;
+    Task_Handle task;
+    const char *site;
+    /*! number of acquisitions, and how many of those had to wait */
+    uint32_t acquisitions;
+    uint32_t contended;
+    /*! total and max time spent waiting for the lock, in timebase ticks */
+    uint64_t wait_total;
+    uint32_t wait_max;
+    /*! total and max time the lock was held, in timebase ticks */
+    uint64_t hold_total;
+    uint32_t hold_max;
+} LockSite;
+
+static LockSite SITES[LOCK_MAX_SITES];
+static int SITE_COUNT = 0;
+
+static int find_site(Lock *lock);
+static void start_hold(Lock *lock, int site_idx);
+static void record_hold(int site_idx, uint64_t hold);
+static void print_stats(CLIContext *context, const char *name,
+                        const LockSite *stats);
+
+/**
+ * Acquires a lock, blocking until it is available. Use lock_acquire().
+ * @param lock: lock to acquire
+ * @return 0 on success, or a pthread error value.
+ */
+int lock_acquire_profiled(Lock *lock) {
+    int ret, idx;
+    uint64_t start, wait;
+    idx = find_site(lock);
+    // Try the lock first, so uncontended acquisitions are cheap.
+    if (pthread_mutex_trylock(&lock->mutex) == 0) {
+        start_hold(lock, idx);
+        return 0;
+    }
+    start = timebase_now();
+    ret = pthread_mutex_lock(&lock->mutex);
+    if (ret != 0) {
+        return ret;
+    }
+    wait = timebase_now() - start;
+    // Statistics are protected by the lock we now own.
+    SITES[idx].contended++;
+    SITES[idx].wait_total += wait;
+    if (wait > SITES[idx].wait_max) {
+        SITES[idx].wait_max = (uint32_t)wait;
+    }
+    start_hold(lock, idx);
+    return 0;
+}
+
+/**
+ * Attempts to acquire a lock without blocking. Use lock_try().
+ * @param lock: lock to acquire
+ * @return 0 on success, or a pthread error value.
+ */
+int lock_try_profiled(Lock *lock) {
+    int ret, idx;
+    UInt key;
+    idx = find_site(lock);
+    ret = pthread_mutex_trylock(&lock->mutex);
+    if (ret == 0) {
+        start_hold(lock, idx);
+    } else {
+        // We do not own the lock, so protect the statistics update.
+        key = Hwi_disable();
+        SITES[idx].contended++;
+        Hwi_restore(key);
+    }
+    return ret;
+}
+
+/**
+ * Releases a lock. Use lock_release().
+ * @param lock: lock to release
+ * @return 0 on success, or a pthread error value.
+ */
+int lock_release_profiled(Lock *lock) {
+    int site_idx = lock->hold_site, ret;
+    uint64_t hold = timebase_now() - lock->hold_start;
+    lock->hold_site = -1;
+    ret = pthread_mutex_unlock(&lock->mutex);
+    if (ret != 0) {
+        // Caller did not own the lock, it is still held by its owner.
+        lock->hold_site = site_idx;
+        return ret;
+    }
+    if (site_idx >= 0) {
+        record_hold(site_idx, hold);
+    }
+    return 0;
+}
+
+/**
+ * Resets the statistics of all locks.
+ */
+void lock_stats_reset(void) {
+    int i;
+    UInt key = Hwi_disable();
+    for (i = 0; i < SITE_COUNT; i++) {
+        SITES[i].acquisitions = 0;
+        SITES[i].contended = 0;
+        SITES[i].wait_total = 0;
+        SITES[i].wait_max = 0;
+        SITES[i].hold_total = 0;
+        SITES[i].hold_max = 0;
+    }
+    Hwi_restore(key);
+}
+
+/**
+ * Prints the statistics of all locks, per lock and per calling task.
+ * @param context: CLI context to print to.
+ */
+void lock_stats_report(CLIContext *context) {
+    int i, j;
+    LockSite site, total;
+    UInt key;
+    cli_printf(context, "%-24s %8s %8s %10s %8s %10s %8s\r\n", "lock/task",
+               "acquire", "contend", "wait_us", "wmax_us", "hold_us",
+               "hmax_us");
+    for (i = 0; i < SITE_COUNT; i++) {
+        // Only print each lock once, before all of its sites.
+        for (j = 0; j < i; j++) {
+            if (SITES[j].lock == SITES[i].lock) {
+                break;
+            }
+        }
+        if (j != i) {
+            continue;
+        }
+        total = (LockSite){0};
+        for (j = i; j < SITE_COUNT; j++) {
+            if (SITES[j].lock != SITES[i].lock) {
+                continue;
+            }
+            key = Hwi_disable();
+            site = SITES[j];
+            Hwi_restore(key);
+            total.acquisitions += site.acquisitions;
+            total.contended += site.contended;
+            total.wait_total += site.wait_total;
+            total.hold_total += site.hold_total;
+            if (site.wait_max > total.wait_max) {
+                total.wait_max = site.wait_max;
+            }
+            if (site.hold_max > total.hold_max) {
+                total.hold_max = site.hold_max;
+            }
+        }
+        print_stats(context, SITES[i].lock->name, &total);
+        for (j = i; j < SITE_COUNT; j++) {
+            if (SITES[j].lock == SITES[i].lock) {
+                key = Hwi_disable();
+                site = SITES[j];
+                Hwi_restore(key);
+                print_stats(context, site.site, &site);
+            }
+        }
+    }
+}
+
+/**
+ * Finds the statistics entry for a lock and the calling task, creating it if
+ * needed.
+ * @param lock: lock being used
+ * @return index of the site in SITES.
+ */
+static int find_site(Lock *lock) {
+    Task_Handle task = NULL;
+    const char *name = "main";
+    int i;
+    UInt key;
+    // Locks are also taken from main(), before BIOS starts.
+    if (BIOS_getThreadType() == BIOS_ThreadType_Task) {
+        task = Task_self();
+    }
+    for (i = 0; i < SITE_COUNT; i++) {
+        if (SITES[i].lock == lock && SITES[i].task == task) {
+            return i;
+        }
+    }
+    if (task != NULL) {
+        name = Task_Handle_name(task);
+        if (name == NULL) {
+            name = "(unnamed task)";
+        }
+    }
+    key = Hwi_disable();
+    // Another task may have added the site, so check again.
+    for (; i < SITE_COUNT; i++) {
+        if (SITES[i].lock == lock && SITES[i].task == task) {
+            Hwi_restore(key);
+            return i;
+        }
+    }
+    if (SITE_COUNT == LOCK_MAX_SITES) {
+        Hwi_restore(key);
+        System_abort("Too many lock sites, increase LOCK_MAX_SITES");
+    }
+    i = SITE_COUNT;
+    SITES[i] = (LockSite){0};
+    SITES[i].lock = lock;
+    SITES[i].task = task;
+    SITES[i].site = name;
+    SITE_COUNT++;
+    Hwi_restore(key);
+    return i;
+}
+
+/**
+ * Records that a lock was just acquired.
+ * @param lock: lock that was acquired
+ * @param site_idx: index of site that acquired the lock
+ */
+static void start_hold(Lock *lock, int site_idx) {
+    SITES[site_idx].acquisitions++;
+    lock->hold_site = site_idx;
+    lock->hold_start = timebase_now();
+}
+
+/**
+ * Adds a hold time to the statistics of a site.
+ * @param site_idx: index of site that held the lock
+ * @param hold: time lock was held for, in timebase ticks
+ */
+static void record_hold(int site_idx, uint64_t hold) {
+    LockSite *site = &SITES[site_idx];
+    // The lock may already be released, so protect the statistics update.
+    UInt key = Hwi_disable();
+    site->hold_total += hold;
+    if (hold > site->hold_max) {
+        site->hold_max = (uint32_t)hold;
+    }
+    Hwi_restore(key);
+}
+
+/**
+ * Prints one row of lock statistics, converted to microseconds.
+ * @param context: CLI context to print to
+ * @param name: name of the row
+ * @param stats: statistics to print
+ */
+static void print_stats(CLIContext *context, const char *name,
+                        const LockSite *stats) {
+    cli_printf(context, "%-24.24s %8lu %8lu %10lu %8lu %10lu %8lu\r\n", name,
+               (unsigned long)stats->acquisitions,
+               (unsigned long)stats->contended,
+               (unsigned long)timebase_to_us(stats->wait_total),
+               (unsigned long)timebase_to_us(stats->wait_max),
+               (unsigned long)timebase_to_us(stats->hold_total),
+               (unsigned long)timebase_to_us(stats->hold_max));
+}
+
+#else
+
+void lock_stats_reset(void) {}
+
+void lock_stats_report(CLIContext *context) {
+    cli_printf(context, "Lock profiling is not enabled in this build\r\n");
+}
+
+#endif
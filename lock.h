@@ -0,0 +1,79 @@
+/**
+ * @file lock.h
+ * Implements instrumented mutex wrappers, used to find which code paths
+ * contend on the locks shared with the ingest path.
+ *
+ * When PROFILING is defined (debug builds), every acquisition records
+ * whether it was contended, how long it waited, and how long the lock was
+ * held, both per lock and per calling task. Locks are mostly taken inside
+ * wrappers such as write_sd(), so the calling function would name the
+ * wrapper rather than the path that used it, while the task tells the
+ * writer from the console. In other builds the wrappers compile to the
+ * plain pthread calls.
+ */
+
+#ifndef LOCK_H
+#define LOCK_H
+
+/* Pthread support */
+#include <ti/sysbios/posix/pthread.h>
+
+#include <stdint.h>
+
+#include "cli.h"
+
+typedef struct {
+    /*! underlying pthread mutex */
+    pthread_mutex_t mutex;
+    /*! name of the lock, for reporting */
+    const char *name;
+#ifdef PROFILING
+    /*! timebase value the lock was acquired at */
+    uint64_t hold_start;
+    /*! index of the site (lock and task) holding the lock */
+    int hold_site;
+#endif
+} Lock;
+
+/**
+ * Initializes a lock. Locks use priority inheritance, so a low priority task
+ * holding a lock runs at the priority of the highest task waiting for it.
+ * @param lock: lock to initialize
+ * @param name: name of the lock, used when reporting. Must be a static string.
+ * @return 0 on success, or a pthread error value.
+ */
+int lock_init(Lock *lock, const char *name);
+
+#ifdef PROFILING
+
+int lock_acquire_profiled(Lock *lock);
+int lock_try_profiled(Lock *lock);
+int lock_release_profiled(Lock *lock);
+
+/** Acquires a lock, blocking until it is available. */
+#define lock_acquire(lock) lock_acquire_profiled(lock)
+/** Attempts to acquire a lock without blocking. */
+#define lock_try(lock) lock_try_profiled(lock)
+/** Releases a lock. */
+#define lock_release(lock) lock_release_profiled(lock)
+
+#else
+
+#define lock_acquire(lock) pthread_mutex_lock(&(lock)->mutex)
+#define lock_try(lock) pthread_mutex_trylock(&(lock)->mutex)
+#define lock_release(lock) pthread_mutex_unlock(&(lock)->mutex)
+
+#endif
+
+/**
+ * Resets the statistics of all locks.
+ */
+void lock_stats_reset(void);
+
+/**
+ * Prints the statistics of all locks, per lock and per calling task.
+ * @param context: CLI context to print to.
+ */
+void lock_stats_report(CLIContext *context);
+
+#endif
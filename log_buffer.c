@@ -0,0 +1,110 @@
+/**
+ * @file log_buffer.c
+ * Implements the pool of data blocks passed from the UART ingest path to the
+ * SD card writer. Free and committed blocks are each kept in a mailbox of
+ * block pointers.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/Error.h>
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/knl/Mailbox.h>
+
+#include <stddef.h>
+
+#include "log_buffer.h"
+#include "supervisor.h"
+#include "trace.h"
+
+static LogBlock BLOCKS[LOG_BLOCK_COUNT];
+static Mailbox_Handle FREE_BLOCKS;
+static Mailbox_Handle FULL_BLOCKS;
+
+/**
+ * Sets up the block pool. Should be called before BIOS starts, after
+ * supervisor_prebios().
+ */
+void log_buffer_prebios(void) {
+    Error_Block eb;
+    Mailbox_Params full_params;
+    LogBlock *block;
+    int i;
+    Error_init(&eb);
+    FREE_BLOCKS =
+        Mailbox_create(sizeof(LogBlock *), LOG_BLOCK_COUNT, NULL, &eb);
+    // SUP_EVT_BLOCK is set whenever committed blocks are waiting.
+    Mailbox_Params_init(&full_params);
+    full_params.readerEvent = supervisor_event();
+    full_params.readerEventId = SUP_EVT_BLOCK;
+    FULL_BLOCKS =
+        Mailbox_create(sizeof(LogBlock *), LOG_BLOCK_COUNT, &full_params, &eb);
+    if (FREE_BLOCKS == NULL || FULL_BLOCKS == NULL) {
+        System_abort("Failed to create log buffer mailboxes\n");
+    }
+    // All blocks start free.
+    for (i = 0; i < LOG_BLOCK_COUNT; i++) {
+        block = &BLOCKS[i];
+        block->len = 0;
+        Mailbox_post(FREE_BLOCKS, &block, BIOS_NO_WAIT);
+    }
+}
+
+/**
+ * Gets a free block for the ingest path to fill. Does not block, and is safe
+ * to call from any context.
+ * @return an empty block, or NULL if all blocks are in use.
+ */
+LogBlock *log_buffer_get_free(void) {
+    LogBlock *block;
+    if (!Mailbox_pend(FREE_BLOCKS, &block, BIOS_NO_WAIT)) {
+        return NULL;
+    }
+    block->len = 0;
+    block->rx_errors = 0;
+    return block;
+}
+
+/**
+ * Commits a filled block to the writer. Does not block, and is safe to call
+ * from any context.
+ * @param block: block to commit
+ */
+void log_buffer_commit(LogBlock *block) {
+    /*
+     * There are only LOG_BLOCK_COUNT blocks, so the full mailbox always has
+     * space.
+     */
+    Mailbox_post(FULL_BLOCKS, &block, BIOS_NO_WAIT);
+    trace_event(TRACE_BUF_FILL, Mailbox_getNumPendingMsgs(FULL_BLOCKS));
+}
+
+/**
+ * Waits for a committed block. Should only be called by the writer.
+ * @param timeout: time to wait, in clock ticks, or BIOS_WAIT_FOREVER.
+ * @return oldest committed block, or NULL if the wait timed out.
+ */
+LogBlock *log_buffer_get_full(unsigned int timeout) {
+    LogBlock *block;
+    if (!Mailbox_pend(FULL_BLOCKS, &block, timeout)) {
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * Releases a block the writer is done with, back to the free pool.
+ * @param block: block to release
+ */
+void log_buffer_release(LogBlock *block) {
+    Mailbox_post(FREE_BLOCKS, &block, BIOS_NO_WAIT);
+}
+
+/**
+ * Gets the number of committed blocks waiting on the writer.
+ * @return number of blocks waiting.
+ */
+int log_buffer_pending(void) { return Mailbox_getNumPendingMsgs(FULL_BLOCKS); }
\ No newline at end of file
@@ -0,0 +1,80 @@
+/**
+ * @file log_buffer.h
+ * Implements the pool of data blocks passed from the UART ingest path to the
+ * SD card writer.
+ *
+ * The ingest path takes a free block, fills it with logged data, and commits
+ * it. The writer takes committed blocks in order, writes them out, and
+ * releases them back to the free pool. Getting and committing blocks never
+ * blocks, and is safe from a Hwi, so the ingest path can never be held up by
+ * the writer. If no free blocks are available, the ingest path must discard
+ * data. Committed blocks set SUP_EVT_BLOCK in the supervisor events.
+ */
+
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+#include <stdint.h>
+
+/* Block configuration */
+#define LOG_BLOCK_SIZE 512
+#define LOG_BLOCK_COUNT 6
+
+/* UART receive errors, in the order of the error bits in UARTDR */
+#define LOG_RXERR_FRAMING 0x01
+#define LOG_RXERR_PARITY 0x02
+#define LOG_RXERR_BREAK 0x04
+#define LOG_RXERR_OVERRUN 0x08
+
+typedef struct {
+    /*! number of valid bytes in data */
+    uint16_t len;
+    /*! LOG_RXERR_* flags for UART errors flagged in the block, recorded
+     * after its data */
+    uint8_t rx_errors;
+    /*! timebase value the first byte of the block arrived at */
+    uint64_t first_arrival;
+    /*! logged data */
+    char data[LOG_BLOCK_SIZE];
+} LogBlock;
+
+/**
+ * Sets up the block pool. Should be called before BIOS starts, after
+ * supervisor_prebios().
+ */
+void log_buffer_prebios(void);
+
+/**
+ * Gets a free block for the ingest path to fill. Does not block, and is safe
+ * to call from any context.
+ * @return an empty block, or NULL if all blocks are in use.
+ */
+LogBlock *log_buffer_get_free(void);
+
+/**
+ * Commits a filled block to the writer. Does not block, and is safe to call
+ * from any context.
+ * @param block: block to commit
+ */
+void log_buffer_commit(LogBlock *block);
+
+/**
+ * Waits for a committed block. Should only be called by the writer.
+ * @param timeout: time to wait, in clock ticks, or BIOS_WAIT_FOREVER.
+ * @return oldest committed block, or NULL if the wait timed out.
+ */
+LogBlock *log_buffer_get_full(unsigned int timeout);
+
+/**
+ * Releases a block the writer is done with, back to the free pool.
+ * @param block: block to release
+ */
+void log_buffer_release(LogBlock *block);
+
+/**
+ * Gets the number of committed blocks waiting on the writer.
+ * @return number of blocks waiting.
+ */
+int log_buffer_pending(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,226 @@
+/**
+ * @file persist.c
+ * Implements persistent logger state. See persist.h for the EEPROM layout.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/knl/Clock.h>
+
+/* TivaWare driver files */
+#include <driverlib/eeprom.h>
+#include <driverlib/sysctl.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lock.h"
+#include "persist.h"
+#include "sd_card.h"
+#include "uart_logger_task.h"
+
+#define PERSIST_MAGIC 0x50455253 // "PERS"
+// One slot per 64 byte EEPROM block, over the 2 KB EEPROM.
+#define PERSIST_SLOT_SIZE 64
+#define PERSIST_SLOTS 32
+// Minimum time between checkpoints written after a sync. Each slot is
+// written once every PERSIST_SLOTS checkpoints, so at one a minute the
+// EEPROM's 500k write cycles last about 30 years.
+#define PERSIST_INTERVAL_MS 60000
+
+// Protects the state between the SD writer and the console.
+static Lock PERSIST_MUTEX;
+// Current state, and the state in the last checkpoint written.
+static PersistRecord STATE;
+static PersistRecord SAVED;
+// State restored at boot.
+static PersistRecord RESTORED;
+// Slot the next checkpoint is written to.
+static uint32_t NEXT_SLOT = 0;
+// Clock ticks at the last checkpoint.
+static uint32_t SAVED_AT = 0;
+// Ingest drop count at the last update, so resetting the ingest statistics
+// does not lose or double count dropped bytes.
+static uint32_t LAST_DROPPED = 0;
+
+static uint32_t record_check(const PersistRecord *record);
+static void update_dropped(void);
+static int write_slot(void);
+
+/**
+ * Restores the newest checkpoint from the EEPROM, and starts a new session.
+ * Should be called before BIOS starts.
+ */
+void persist_prebios(void) {
+    PersistRecord record;
+    uint32_t slot;
+    bool found = false;
+    if (lock_init(&PERSIST_MUTEX, "PERSIST_MUTEX") != 0) {
+        System_abort("Failed to create persist mutex\n");
+    }
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_EEPROM0);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_EEPROM0)) {
+        // Wait for the EEPROM to be ready.
+    }
+    if (EEPROMInit() != EEPROM_INIT_OK) {
+        System_abort("EEPROM failed to initialize\n");
+    }
+    for (slot = 0; slot < PERSIST_SLOTS; slot++) {
+        EEPROMRead((uint32_t *)&record, slot * PERSIST_SLOT_SIZE,
+                   sizeof(record));
+        if (record.magic != PERSIST_MAGIC ||
+            record.check != record_check(&record)) {
+            continue;
+        }
+        if (!found || (int32_t)(record.seq - RESTORED.seq) > 0) {
+            found = true;
+            RESTORED = record;
+            NEXT_SLOT = (slot + 1) % PERSIST_SLOTS;
+        }
+    }
+    if (!found) {
+        RESTORED = (PersistRecord){0};
+    }
+    STATE = RESTORED;
+    STATE.magic = PERSIST_MAGIC;
+    STATE.session++;
+    // Record the new session straight away, so a crash loop still counts.
+    write_slot();
+}
+
+/**
+ * Gets the state as of the last checkpoint, with the counters updated to
+ * now.
+ * @param record: filled with the current state.
+ */
+void persist_state(PersistRecord *record) {
+    lock_acquire(&PERSIST_MUTEX);
+    update_dropped();
+    *record = STATE;
+    lock_release(&PERSIST_MUTEX);
+}
+
+/**
+ * Gets the log file index restored at boot.
+ * @return rotated log file index, or 0 for the default log file.
+ */
+uint32_t persist_log_index(void) { return RESTORED.log_index; }
+
+/**
+ * Gets the log file size restored at boot.
+ * @return size of the log file at the last checkpoint before boot.
+ */
+uint32_t persist_log_size(void) { return RESTORED.log_size; }
+
+/**
+ * Adds to the lifetime count of logged bytes. Should be called by the SD
+ * writer for every block written.
+ * @param bytes: number of bytes logged
+ */
+void persist_count_logged(uint32_t bytes) {
+    lock_acquire(&PERSIST_MUTEX);
+    STATE.bytes_logged += bytes;
+    lock_release(&PERSIST_MUTEX);
+}
+
+/**
+ * Adds to the lifetime count of dropped bytes, for output dropped after the
+ * ingest path, as the flash log was full.
+ * @param bytes: number of bytes dropped
+ */
+void persist_count_dropped(uint32_t bytes) {
+    lock_acquire(&PERSIST_MUTEX);
+    STATE.bytes_dropped += bytes;
+    lock_release(&PERSIST_MUTEX);
+}
+
+/**
+ * Writes a checkpoint of the current state to the next EEPROM slot.
+ * @return 0 on success, or -1 if the EEPROM write failed.
+ */
+int persist_checkpoint(void) {
+    int ret;
+    lock_acquire(&PERSIST_MUTEX);
+    update_dropped();
+    STATE.log_index = log_file_index();
+    if (sd_card_mounted()) {
+        STATE.log_size = filesize();
+    }
+    ret = write_slot();
+    lock_release(&PERSIST_MUTEX);
+    return ret;
+}
+
+/**
+ * Writes a checkpoint if the state changed, and the last checkpoint is
+ * older than PERSIST_INTERVAL_MS. Should be called by the SD writer after
+ * each sync.
+ */
+void persist_checkpoint_if_due(void) {
+    bool changed;
+    if (Clock_getTicks() - SAVED_AT < PERSIST_INTERVAL_MS) {
+        return;
+    }
+    lock_acquire(&PERSIST_MUTEX);
+    update_dropped();
+    changed = STATE.bytes_logged != SAVED.bytes_logged ||
+              STATE.bytes_dropped != SAVED.bytes_dropped ||
+              log_file_index() != SAVED.log_index;
+    lock_release(&PERSIST_MUTEX);
+    if (changed) {
+        persist_checkpoint();
+    }
+}
+
+/**
+ * Computes the FNV-1a hash of a record's fields, up to the check field.
+ * @param record: record to check
+ * @return hash of the record.
+ */
+static uint32_t record_check(const PersistRecord *record) {
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint32_t hash = 2166136261u;
+    uint32_t i;
+    for (i = 0; i < offsetof(PersistRecord, check); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Adds the bytes dropped by the ingest path since the last update to the
+ * lifetime count. Must be called with PERSIST_MUTEX held, or before BIOS
+ * starts.
+ */
+static void update_dropped(void) {
+    IngestStats stats;
+    ingest_stats(&stats);
+    if (stats.dropped < LAST_DROPPED) {
+        // The ingest statistics were reset.
+        LAST_DROPPED = 0;
+    }
+    STATE.bytes_dropped += stats.dropped - LAST_DROPPED;
+    LAST_DROPPED = stats.dropped;
+}
+
+/**
+ * Writes the current state to the next slot. Must be called with
+ * PERSIST_MUTEX held, or before BIOS starts.
+ * @return 0 on success, or -1 if the EEPROM write failed.
+ */
+static int write_slot(void) {
+    STATE.seq++;
+    STATE.check = record_check(&STATE);
+    SAVED = STATE;
+    SAVED_AT = Clock_getTicks();
+    if (EEPROMProgram((uint32_t *)&STATE, NEXT_SLOT * PERSIST_SLOT_SIZE,
+                      sizeof(STATE)) != 0) {
+        return -1;
+    }
+    NEXT_SLOT = (NEXT_SLOT + 1) % PERSIST_SLOTS;
+    return 0;
+}
\ No newline at end of file
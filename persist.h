@@ -0,0 +1,97 @@
+/**
+ * @file persist.h
+ * Implements persistent logger state, kept in the on-chip EEPROM: the boot
+ * session number, lifetime logged and dropped byte counts, and the log file
+ * being written with its size at the last checkpoint.
+ *
+ * The EEPROM is split into PERSIST_SLOTS slots of one 64 byte EEPROM block
+ * each. Every checkpoint writes the next slot in turn, so wear is spread
+ * over all of them, and a checkpoint torn by a reset leaves the previous
+ * slot intact. At boot, the valid slot with the highest sequence number is
+ * restored.
+ *
+ * The FatFS file object itself can't be restored: the log file is still
+ * opened and seeked on mount. What is restored is which file to open, and
+ * where rotation continues numbering from, so mounting does not have to
+ * search the card for them.
+ */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    /*! PERSIST_MAGIC if the slot holds a record */
+    uint32_t magic;
+    /*! checkpoint sequence number */
+    uint32_t seq;
+    /*! bytes logged to the SD card or flash log, over the logger's life */
+    uint64_t bytes_logged;
+    /*! bytes dropped by the ingest path, or as the flash log was full, over
+     * the logger's life */
+    uint64_t bytes_dropped;
+    /*! number of boots */
+    uint32_t session;
+    /*! rotated log file index, or 0 for the default log file */
+    uint32_t log_index;
+    /*! size of the log file at the checkpoint */
+    uint32_t log_size;
+    /*! checksum of the fields above */
+    uint32_t check;
+} PersistRecord;
+
+/**
+ * Restores the newest checkpoint from the EEPROM, and starts a new session.
+ * Should be called before BIOS starts.
+ */
+void persist_prebios(void);
+
+/**
+ * Gets the state as of the last checkpoint, with the counters updated to
+ * now.
+ * @param record: filled with the current state.
+ */
+void persist_state(PersistRecord *record);
+
+/**
+ * Gets the log file index restored at boot.
+ * @return rotated log file index, or 0 for the default log file.
+ */
+uint32_t persist_log_index(void);
+
+/**
+ * Gets the log file size restored at boot.
+ * @return size of the log file at the last checkpoint before boot.
+ */
+uint32_t persist_log_size(void);
+
+/**
+ * Adds to the lifetime count of logged bytes. Should be called by the SD
+ * writer for every block written.
+ * @param bytes: number of bytes logged
+ */
+void persist_count_logged(uint32_t bytes);
+
+/**
+ * Adds to the lifetime count of dropped bytes, for output dropped after the
+ * ingest path, as the flash log was full.
+ * @param bytes: number of bytes dropped
+ */
+void persist_count_dropped(uint32_t bytes);
+
+/**
+ * Writes a checkpoint of the current state to the next EEPROM slot.
+ * @return 0 on success, or -1 if the EEPROM write failed.
+ */
+int persist_checkpoint(void);
+
+/**
+ * Writes a checkpoint if the state changed, and the last checkpoint is
+ * older than PERSIST_INTERVAL_MS. Should be called by the SD writer after
+ * each sync.
+ */
+void persist_checkpoint_if_due(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,655 @@
+/**
+ * @file pipeline.c
+ * Implements the processing of logged data on its way to storage. See
+ * pipeline.h for the in-band control sequences and the log level formats.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "filter.h"
+#include "log_buffer.h"
+#include "pipeline.h"
+#include "sd_card.h"
+#include "timebase.h"
+
+// In-band sequences are ESC ] <tag> ; <command> BEL.
+#define INBAND_PREFIX_FORMAT "\033]%lu;"
+#define INBAND_PREFIX_MAXLEN 12
+#define INBAND_END '\a'
+// Longest in-band command, including the terminator.
+#define INBAND_CMD_MAXLEN 64
+// Longest line passed on whole. Longer lines are passed on in pieces.
+#define LINE_MAXLEN 256
+// Longest printk timestamp skipped before a "<N>" level, with the brackets.
+#define PRINTK_TIME_MAXLEN 20
+
+static PipelineSink SINK = NULL;
+static PipelineActionFxn ACTION = NULL;
+static PipelineLineSink ERRORS = NULL;
+
+// In-band sequence prefix for INBAND_TAG, or empty if in-band control is off.
+static char INBAND_PREFIX[INBAND_PREFIX_MAXLEN];
+static int INBAND_PREFIX_LEN = 0;
+static uint32_t INBAND_TAG = 0;
+// Bytes of the prefix matched so far. Once the whole prefix has matched, the
+// command is collected until the terminator.
+static int MATCHED = 0;
+static char INBAND_CMD[INBAND_CMD_MAXLEN];
+static int INBAND_CMD_LEN = 0;
+
+// Line being assembled, and the estimated arrival time of its first byte.
+static char LINE[LINE_MAXLEN + 1];
+static int LINE_LEN = 0;
+static uint64_t LINE_ARRIVAL;
+// Set if lines are prefixed with their arrival time.
+static bool HIRES = false;
+// Set if the line being output is dropped by the filter rules.
+static bool LINE_DROP = false;
+// Set if the next byte output starts a line.
+static bool LINE_START = true;
+// Arrival time of the block being processed, and the time taken by a byte.
+static uint64_t BLOCK_ARRIVAL;
+static uint32_t BYTE_TICKS;
+// Estimated arrival time of the last byte of the previous block, or 0 before
+// the first block, and the time the last time anchor was output.
+static uint64_t LAST_BYTE_AT = 0;
+static uint64_t LAST_ANCHOR_AT = 0;
+
+// Boot banner and panic pattern, and the config change count they were read
+// at. Text values start out empty, so they are up to date until the config
+// first changes.
+static char BANNER[CONFIG_TEXT_MAXLEN];
+static int BANNER_LEN = 0;
+static char PANIC[CONFIG_TEXT_MAXLEN];
+static int PANIC_LEN = 0;
+static uint32_t TEXT_CHANGES = 0;
+// Reason for a segment boundary before the next line, or NULL.
+static const char *BOOT_PENDING = NULL;
+// Set while no line was output since the last segment boundary.
+static bool SEGMENT_EMPTY = false;
+
+// Kernel log level of the assembled line, and the lines seen at each level.
+static int LINE_LEVEL = PIPE_LEVEL_NONE;
+static uint32_t LEVEL_COUNTS[PIPE_LEVELS];
+// Level names, as printed by "dmesg -x".
+static const char *const LEVEL_NAMES[PIPE_LEVELS] = {
+    "emerg", "alert", "crit", "err", "warn", "notice", "info", "debug", "none",
+};
+
+// Last line output whole, and its hash, for finding repeats. PREV_LEN is 0
+// if the next line is output regardless.
+static char PREV[LINE_MAXLEN];
+static int PREV_LEN = 0;
+static uint32_t PREV_HASH;
+// Repeats of PREV not output, and the arrival times of the first and last.
+static uint32_t REPEATS = 0;
+static uint64_t REPEAT_FIRST;
+static uint64_t REPEAT_LAST;
+
+static void mark_time(void);
+static void time_record(const char *format, ...);
+static void record_rx_errors(uint8_t errors, int offset);
+static void update_config(void);
+static bool inband_byte(char c);
+static void inband_abandon(int offset);
+static void inband_command(void);
+static void request(PipelineAction action, const char *reason);
+static void emit_data(const char *data, int len, int offset);
+static void emit_line(void);
+static void check_boot(void);
+static int parse_level(const char *line);
+static bool repeated_line(void);
+static void end_repeats(void);
+static void emit_record(const char *format, ...);
+static void emit_record_va(const char *format, va_list args);
+static void emit_time(uint64_t arrival);
+
+/**
+ * Sets the functions output and actions are passed to. Should be called by
+ * the SD writer before any data is fed in.
+ * @param sink: function receiving the processed output
+ * @param action: function carrying out actions
+ * @param errors: function receiving copies of error lines
+ */
+void pipeline_start(PipelineSink sink, PipelineActionFxn action,
+                    PipelineLineSink errors) {
+    SINK = sink;
+    ACTION = action;
+    ERRORS = errors;
+}
+
+/**
+ * Processes a block of logged data, followed by any UART errors flagged in
+ * it. Should only be called by the SD writer.
+ * @param block: block taken from the log buffer
+ */
+void pipeline_input(const LogBlock *block) {
+    const char *data = block->data;
+    int i, start = 0, len = block->len;
+    update_config();
+    BLOCK_ARRIVAL = block->first_arrival;
+    // 10 bits per byte, with the start and stop bits.
+    BYTE_TICKS = (timebase_freq() * 10) / config_get(CONFIG_BAUD);
+    if (len == 0) {
+        record_rx_errors(block->rx_errors, 0);
+        return;
+    }
+    mark_time();
+    for (i = 0; i < len; i++) {
+        if (MATCHED == 0) {
+            if (INBAND_PREFIX_LEN != 0 && data[i] == INBAND_PREFIX[0]) {
+                // Output the data before what may be a sequence.
+                emit_data(data + start, i - start, start);
+                MATCHED = 1;
+                INBAND_CMD_LEN = 0;
+                start = i + 1;
+            }
+        } else if (inband_byte(data[i])) {
+            start = i + 1;
+        } else {
+            /*
+             * Not a sequence after all. Output the bytes held back, then
+             * look at this byte again as data. The prefix only starts with
+             * ESC, so it can't hold the start of another sequence.
+             */
+            inband_abandon(i);
+            start = i;
+            i--;
+        }
+    }
+    if (MATCHED == 0) {
+        emit_data(data + start, len - start, start);
+    }
+    LAST_BYTE_AT = BLOCK_ARRIVAL + (uint64_t)(len - 1) * BYTE_TICKS;
+    record_rx_errors(block->rx_errors, len);
+}
+
+/**
+ * Passes a marker record to the sink, in order with the logged data. Should
+ * only be called by the SD writer.
+ * @param format: printf style format string for the record contents
+ */
+void pipeline_record(const char *format, ...) {
+    va_list args;
+    // Keep the record after the data received before it.
+    pipeline_flush();
+    va_start(args, format);
+    emit_record_va(format, args);
+    va_end(args);
+    // Show the line after a record, even if it repeats the one before.
+    PREV_LEN = 0;
+}
+
+/**
+ * Checks if the pipeline holds a partial line, waiting for the rest of it.
+ * @param arrival: if not NULL, set to the timebase value the first byte
+ * held arrived at
+ * @return true if data is held.
+ */
+bool pipeline_held(uint64_t *arrival) {
+    if (LINE_LEN != 0 && arrival != NULL) {
+        *arrival = LINE_ARRIVAL;
+    }
+    return LINE_LEN != 0;
+}
+
+/**
+ * Checks if the pipeline is counting a run of repeated lines.
+ * @param since: if not NULL, set to the timebase value the first repeat
+ * arrived at
+ * @return true if a run is being counted.
+ */
+bool pipeline_repeating(uint64_t *since) {
+    if (REPEATS != 0 && since != NULL) {
+        *since = REPEAT_FIRST;
+    }
+    return REPEATS != 0;
+}
+
+/**
+ * Passes a held partial line, and the record for a run of repeated lines,
+ * to the sink. Should be called by the SD writer once the logged UART went
+ * idle, so a prompt without a line ending is not held indefinitely, and once
+ * a run of repeats is too old.
+ */
+void pipeline_flush(void) {
+    end_repeats();
+    if (LINE_LEN != 0) {
+        emit_line();
+    }
+}
+
+/**
+ * Gets the number of lines classified at each kernel log level. The counts
+ * are updated by the writer while they are read, so may be a line apart.
+ * @param counts: filled with PIPE_LEVELS counts, indexed by level
+ */
+void pipeline_level_counts(uint32_t *counts) {
+    memcpy(counts, LEVEL_COUNTS, sizeof(LEVEL_COUNTS));
+}
+
+/**
+ * Clears the log level counts.
+ */
+void pipeline_level_reset(void) {
+    memset(LEVEL_COUNTS, 0, sizeof(LEVEL_COUNTS));
+}
+
+/**
+ * Gets the name of a kernel log level.
+ * @param level: level, from 0 to PIPE_LEVEL_NONE
+ * @return name of the level, such as "err".
+ */
+const char *pipeline_level_name(int level) { return LEVEL_NAMES[level]; }
+
+/**
+ * Checks if lines are prefixed with their arrival time.
+ * @return true if high resolution timestamps are on.
+ */
+bool pipeline_hires(void) { return HIRES; }
+
+/**
+ * Outputs an idle record if the line was silent for longer than
+ * CONFIG_IDLE_GAP_MS before the block being processed, and a time anchor if
+ * CONFIG_ANCHOR_S passed since the last one. Gaps longer than the block
+ * commit time always fall between blocks, so checking here is enough.
+ */
+static void mark_time(void) {
+    char wall_buf[32];
+    uint32_t gap_ms = config_get(CONFIG_IDLE_GAP_MS);
+    uint32_t anchor_s = config_get(CONFIG_ANCHOR_S);
+    uint32_t boot_idle_s = config_get(CONFIG_BOOT_IDLE_S);
+    uint64_t idle_us, now_us;
+    if (LAST_BYTE_AT != 0 && BLOCK_ARRIVAL > LAST_BYTE_AT) {
+        idle_us = timebase_to_us(BLOCK_ARRIVAL - LAST_BYTE_AT);
+        if (gap_ms != 0 && idle_us >= (uint64_t)gap_ms * 1000) {
+            time_record("Idle for %lu ms", (unsigned long)(idle_us / 1000));
+        }
+        if (boot_idle_s != 0 && idle_us >= (uint64_t)boot_idle_s * 1000000) {
+            BOOT_PENDING = "target boot (idle)";
+        }
+    }
+    if (anchor_s != 0 && BLOCK_ARRIVAL - LAST_ANCHOR_AT >=
+                             (uint64_t)anchor_s * timebase_freq()) {
+        // Uptime and wall time read together, to map one onto the other.
+        now_us = timebase_now_us();
+        format_wall_time(wall_buf, sizeof(wall_buf));
+        time_record("Time anchor: %lu.%06lu s, %s",
+                    (unsigned long)(now_us / 1000000),
+                    (unsigned long)(now_us % 1000000), wall_buf);
+        LAST_ANCHOR_AT = BLOCK_ARRIVAL;
+    }
+}
+
+/**
+ * Passes a record on the timing of the logged data to the sink, after any
+ * partial line held. Unlike pipeline_record(), a run of repeated lines is
+ * not ended, and the line after the record is still compared with the one
+ * before it, so a line repeated slowly is not cut into runs by idle
+ * records and time anchors.
+ * @param format: printf style format string for the record contents
+ */
+static void time_record(const char *format, ...) {
+    va_list args;
+    if (LINE_LEN != 0) {
+        emit_line();
+    }
+    va_start(args, format);
+    emit_record_va(format, args);
+    va_end(args);
+}
+
+/**
+ * Outputs a record for UART errors at the end of a block. A break or framing
+ * error usually means the target reset, or its baud rate changed.
+ * @param errors: LOG_RXERR_* flags from the block
+ * @param offset: offset in the block the errors followed
+ */
+static void record_rx_errors(uint8_t errors, int offset) {
+    if (errors == 0) {
+        return;
+    }
+    if (MATCHED != 0) {
+        // A sequence can't continue across a reset of the target.
+        inband_abandon(offset);
+    }
+    pipeline_record("UART error:%s%s%s%s",
+                    (errors & LOG_RXERR_BREAK) ? " break" : "",
+                    (errors & LOG_RXERR_FRAMING) ? " framing" : "",
+                    (errors & LOG_RXERR_PARITY) ? " parity" : "",
+                    (errors & LOG_RXERR_OVERRUN) ? " overrun" : "");
+    if ((errors & LOG_RXERR_BREAK) && config_get(CONFIG_BOOT_BREAK) != 0) {
+        BOOT_PENDING = "target boot (break)";
+    }
+}
+
+/**
+ * Rebuilds the in-band sequence prefix if the configured tag changed, and
+ * gets the boot banner again if the config changed.
+ */
+static void update_config(void) {
+    uint32_t tag = config_get(CONFIG_INBAND_TAG);
+    uint32_t changes = config_changes();
+    if (changes != TEXT_CHANGES) {
+        TEXT_CHANGES = changes;
+        BANNER_LEN = config_get_text(CONFIG_BOOT_BANNER, BANNER);
+        PANIC_LEN = config_get_text(CONFIG_PANIC_PATTERN, PANIC);
+    }
+    if (tag == INBAND_TAG) {
+        return;
+    }
+    if (MATCHED != 0) {
+        // Output a sequence started with the old tag as data.
+        inband_abandon(0);
+    }
+    INBAND_TAG = tag;
+    INBAND_PREFIX_LEN =
+        tag == 0 ? 0
+                 : snprintf(INBAND_PREFIX, sizeof(INBAND_PREFIX),
+                            INBAND_PREFIX_FORMAT, (unsigned long)tag);
+}
+
+/**
+ * Matches a byte against the rest of an in-band sequence.
+ * @param c: byte received
+ * @return true if the byte is part of the sequence, or false if the bytes
+ * so far are not a sequence.
+ */
+static bool inband_byte(char c) {
+    if (MATCHED < INBAND_PREFIX_LEN) {
+        if (c != INBAND_PREFIX[MATCHED]) {
+            return false;
+        }
+        MATCHED++;
+        return true;
+    }
+    if (c == INBAND_END) {
+        INBAND_CMD[INBAND_CMD_LEN] = '\0';
+        MATCHED = 0;
+        inband_command();
+        return true;
+    }
+    if (c < ' ' || c > '~' || INBAND_CMD_LEN == INBAND_CMD_MAXLEN - 1) {
+        return false;
+    }
+    INBAND_CMD[INBAND_CMD_LEN++] = c;
+    return true;
+}
+
+/**
+ * Outputs the bytes of a partial in-band sequence, which turned out not to
+ * be one.
+ * @param offset: offset in the block the sequence ended at
+ */
+static void inband_abandon(int offset) {
+    int prefix_len = MATCHED;
+    MATCHED = 0;
+    emit_data(INBAND_PREFIX, prefix_len, offset);
+    if (prefix_len == INBAND_PREFIX_LEN) {
+        emit_data(INBAND_CMD, INBAND_CMD_LEN, offset);
+    }
+}
+
+/**
+ * Carries out a complete in-band command, held in INBAND_CMD.
+ */
+static void inband_command(void) {
+    if (strcmp(INBAND_CMD, "sync") == 0) {
+        request(PIPE_ACT_SYNC, NULL);
+    } else if (strcmp(INBAND_CMD, "rotate") == 0) {
+        request(PIPE_ACT_ROTATE, "in-band command");
+    } else if (strcmp(INBAND_CMD, "mark") == 0) {
+        pipeline_record("Marker");
+    } else if (strncmp(INBAND_CMD, "mark ", 5) == 0) {
+        pipeline_record("Marker: %s", INBAND_CMD + 5);
+    } else if (strcmp(INBAND_CMD, "hires on") == 0) {
+        HIRES = true;
+    } else if (strcmp(INBAND_CMD, "hires off") == 0) {
+        HIRES = false;
+    } else {
+        pipeline_record("Unknown in-band command \"%s\"", INBAND_CMD);
+    }
+}
+
+/**
+ * Requests an action from the writer, after passing it all output so far.
+ * @param action: action to carry out
+ * @param reason: reason for the action, or NULL
+ */
+static void request(PipelineAction action, const char *reason) {
+    pipeline_flush();
+    ACTION(action, reason);
+}
+
+/**
+ * Assembles data into lines, passing each to the sink once complete.
+ * @param data: data to output
+ * @param len: length of data
+ * @param offset: offset of the data in the block, for its arrival time
+ */
+static void emit_data(const char *data, int len, int offset) {
+    const char *end;
+    int n;
+    while (len > 0) {
+        if (LINE_LEN == 0) {
+            LINE_ARRIVAL = BLOCK_ARRIVAL + (uint64_t)offset * BYTE_TICKS;
+        }
+        end = memchr(data, '\n', len);
+        n = end != NULL ? end - data + 1 : len;
+        if (n > LINE_MAXLEN - LINE_LEN) {
+            n = LINE_MAXLEN - LINE_LEN;
+        }
+        memcpy(LINE + LINE_LEN, data, n);
+        LINE_LEN += n;
+        data += n;
+        len -= n;
+        offset += n;
+        if (LINE[LINE_LEN - 1] == '\n' || LINE_LEN == LINE_MAXLEN) {
+            emit_line();
+        }
+    }
+}
+
+/**
+ * Passes the assembled line to the sink, prefixed with its arrival time if
+ * high resolution timestamps are on. The line may also be a piece of a
+ * longer one, or a partial line flushed when the UART went idle, in which
+ * case only the first piece is treated as the start of a line, and matched
+ * against the filter rules.
+ */
+static void emit_line(void) {
+    bool start = LINE_START;
+    LINE[LINE_LEN] = '\0';
+    if (start) {
+        LINE_LEVEL = PIPE_LEVEL_NONE;
+        if (config_get(CONFIG_LEVELS) != 0) {
+            LINE_LEVEL = parse_level(LINE);
+            LEVEL_COUNTS[LINE_LEVEL]++;
+        }
+        LINE_DROP = filter_drop(LINE, LINE_LEN);
+    }
+    if (LINE_DROP) {
+        LINE_START = LINE[LINE_LEN - 1] == '\n';
+        LINE_LEN = 0;
+        return;
+    }
+    if (repeated_line()) {
+        LINE_LEN = 0;
+        return;
+    }
+    end_repeats();
+    if (start) {
+        check_boot();
+        if (PANIC_LEN != 0 && strstr(LINE, PANIC) != NULL) {
+            ACTION(PIPE_ACT_PANIC, "panic pattern");
+        }
+        if (HIRES) {
+            emit_time(LINE_ARRIVAL);
+        }
+    }
+    SINK(LINE, LINE_LEN);
+    if (LINE_LEVEL <= config_get(CONFIG_ERRORS_LEVEL)) {
+        ERRORS(LINE, LINE_LEN, start ? LINE_ARRIVAL : 0);
+    }
+    LINE_START = LINE[LINE_LEN - 1] == '\n';
+    LINE_LEN = 0;
+    SEGMENT_EMPTY = false;
+}
+
+/**
+ * Starts a new log segment before the assembled line, if a target boot was
+ * detected since the last line, or the line holds the boot banner. Nothing
+ * is done if the current segment has no lines yet, so a break followed by
+ * the banner gives one segment.
+ */
+static void check_boot(void) {
+    const char *reason = BOOT_PENDING;
+    if (BANNER_LEN != 0 && strstr(LINE, BANNER) != NULL) {
+        reason = "target boot (banner)";
+    }
+    BOOT_PENDING = NULL;
+    if (reason == NULL || SEGMENT_EMPTY) {
+        return;
+    }
+    SEGMENT_EMPTY = true;
+    ACTION(PIPE_ACT_SEGMENT, reason);
+}
+
+/**
+ * Checks if the assembled line repeats the last line output whole, counting
+ * it if so. Otherwise, a whole line becomes the one later lines are
+ * compared with. Lines passed on in pieces are never counted as repeats.
+ * @return true if the line is a repeat, and should not be output.
+ */
+static bool repeated_line(void) {
+    uint32_t hash = 2166136261u;
+    int i;
+    if (!LINE_START || LINE[LINE_LEN - 1] != '\n' ||
+        config_get(CONFIG_REPEATS) == 0) {
+        PREV_LEN = 0;
+        return false;
+    }
+    // FNV-1a, so a different line is almost always told apart by its hash.
+    for (i = 0; i < LINE_LEN; i++) {
+        hash = (hash ^ (uint8_t)LINE[i]) * 16777619u;
+    }
+    if (hash == PREV_HASH && LINE_LEN == PREV_LEN &&
+        memcmp(LINE, PREV, LINE_LEN) == 0) {
+        if (REPEATS++ == 0) {
+            REPEAT_FIRST = LINE_ARRIVAL;
+        }
+        REPEAT_LAST = LINE_ARRIVAL;
+        return true;
+    }
+    PREV_HASH = hash;
+    PREV_LEN = LINE_LEN;
+    memcpy(PREV, LINE, LINE_LEN);
+    return false;
+}
+
+/**
+ * Outputs the record for a run of repeated lines, if one is being counted.
+ * The line the run repeats stays in PREV, so a new run can follow.
+ */
+static void end_repeats(void) {
+    uint64_t first_us, last_us;
+    if (REPEATS == 0) {
+        return;
+    }
+    first_us = timebase_to_us(REPEAT_FIRST);
+    last_us = timebase_to_us(REPEAT_LAST);
+    emit_record("Last line repeated %lu time%s, %lu.%06lu s to %lu.%06lu s",
+                (unsigned long)REPEATS, REPEATS == 1 ? "" : "s",
+                (unsigned long)(first_us / 1000000),
+                (unsigned long)(first_us % 1000000),
+                (unsigned long)(last_us / 1000000),
+                (unsigned long)(last_us % 1000000));
+    REPEATS = 0;
+}
+
+/**
+ * Passes a record to the sink, without first flushing the pipeline, for use
+ * while a line is being output.
+ * @param format: printf style format string for the record contents
+ */
+static void emit_record(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    emit_record_va(format, args);
+    va_end(args);
+}
+
+/**
+ * Passes a record to the sink.
+ * @param format: printf style format string for the record contents
+ * @param args: arguments for the format string
+ */
+static void emit_record_va(const char *format, va_list args) {
+    char record_buf[RECORD_MAXLEN];
+    int len = format_record(record_buf, sizeof(record_buf), format, args);
+    SINK(record_buf, len);
+    LINE_START = true;
+}
+
+/**
+ * Reads the kernel log level of a line, from a "<N>" prefix, which may
+ * follow a printk timestamp, or from a "dmesg -x" style prefix.
+ * @param line: line, NUL terminated
+ * @return level, or PIPE_LEVEL_NONE if the line has none.
+ */
+static int parse_level(const char *line) {
+    const char *p = line, *end;
+    unsigned long value;
+    size_t len;
+    int level;
+    end = strchr(p, ']');
+    if (*p == '[' && end != NULL && end - p < PRINTK_TIME_MAXLEN) {
+        p = end + 1;
+        while (*p == ' ') {
+            p++;
+        }
+    }
+    if (*p == '<' && isdigit((unsigned char)p[1])) {
+        // Syslog style priorities also carry the facility, above the level.
+        value = strtoul(p + 1, (char **)&end, 10);
+        return *end == '>' ? (int)(value & 7) : PIPE_LEVEL_NONE;
+    }
+    // "dmesg -x" pads the facility and the level, each ending in ':'.
+    p = strchr(line, ':');
+    if (p == NULL || p - line > 8) {
+        return PIPE_LEVEL_NONE;
+    }
+    for (level = 0; level < PIPE_LEVEL_NONE; level++) {
+        len = strlen(LEVEL_NAMES[level]);
+        if (strncmp(p + 1, LEVEL_NAMES[level], len) == 0) {
+            p += 1 + len;
+            while (*p == ' ') {
+                p++;
+            }
+            return *p == ':' ? level : PIPE_LEVEL_NONE;
+        }
+    }
+    return PIPE_LEVEL_NONE;
+}
+
+/**
+ * Passes an arrival time to the sink, as a line prefix.
+ * @param arrival: timebase value to output
+ */
+static void emit_time(uint64_t arrival) {
+    char time_buf[24];
+    uint64_t arrival_us;
+    int len;
+    arrival_us = timebase_to_us(arrival);
+    len = snprintf(time_buf, sizeof(time_buf), "[%5lu.%06lu] ",
+                   (unsigned long)(arrival_us / 1000000),
+                   (unsigned long)(arrival_us % 1000000));
+    SINK(time_buf, len);
+}
\ No newline at end of file
@@ -0,0 +1,179 @@
+/**
+ * @file pipeline.h
+ * Implements the processing of logged data on its way from the log buffer to
+ * storage. The SD writer feeds in each block it takes from the buffer, and
+ * the processed output is passed to the writer's sink function, in order.
+ * Everything here runs in the writer task, so nothing is added to the
+ * ingest path.
+ *
+ * Data is assembled into lines, which are passed on once complete. A
+ * partial line is held until the rest arrives, or until the writer flushes
+ * it once the logged UART goes idle.
+ *
+ * In-band control: the logged target can control the logger by printing
+ *
+ *     ESC ] <tag> ; <command> BEL
+ *
+ * where <tag> is the config value inband_tag (see config.h), or 0 to turn
+ * this off. The sequence is stripped from the stored log. Commands are:
+ *
+ *     sync          syncs everything received so far to the SD card
+ *     mark [text]   inserts a marker record
+ *     rotate        moves logging to the next log file
+ *     hires on|off  prefixes each line with its arrival time
+ *
+ * A kernel can print "\033]7777;sync\a" just before panicking, for example.
+ *
+ * Time records: when the line was silent for longer than the config value
+ * idle_gap_ms, an "Idle for N ms" record is output before the data that
+ * ended the silence. Before the first data at least anchor_s after the last
+ * time anchor, a time anchor record holds the uptime and the wall time, read
+ * together. Both are checked once per block, not per byte.
+ *
+ * Arrival times of lines are estimated from the arrival time of the block
+ * and the byte time at the configured baud rate. With the uDMA receive path,
+ * a block is closed when the line goes idle, so the data in a block arrived
+ * back to back and the estimate is close.
+ *
+ * UART errors: a break, framing, parity or overrun error on the logged UART
+ * is output as a "UART error" record after the data received before it. A
+ * break or framing error usually marks a reset of the target.
+ *
+ * Boot segmentation: each boot of the target can go to a log segment of its
+ * own. A new segment is started before a line holding the config text
+ * boot_banner, such as "Linux version", and before the first line after a
+ * break (boot_break) or a silence longer than boot_idle_s. The writer moves
+ * to the next log file, and lists it in the log index.
+ *
+ * Log levels: with the config value levels on, each line is classified by
+ * its kernel log level, and counted. The level is read from a "<N>" prefix,
+ * which may follow a "[    1.234567] " printk timestamp, or from a
+ * "dmesg -x" style "kern  :err   : " prefix. Lines at errors_level or more
+ * severe are also passed to the errors sink, so they can be read without
+ * scanning the whole log.
+ *
+ * Repeated lines: with the config value repeats on, a line identical to the
+ * one before it is not output. Instead, the run of repeats is output as one
+ * record with its count and the arrival times of its first and last lines.
+ * The record is output before the next different line or record, or when
+ * the writer flushes the pipeline, which it does once the run is as old as
+ * the sync policy allows unsynced data to be.
+ *
+ * Filtering: lines dropped by the filter rules (see filter.h) are not
+ * output, copied to the errors sink, or compared for repeats, but are still
+ * counted by level. A line longer than the line buffer is matched on its
+ * first piece, and the rest follows its fate.
+ *
+ * Panic snapshots: a line holding the config text panic_pattern, such as
+ * "Kernel panic", makes the writer start a panic snapshot just before it.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "log_buffer.h"
+
+// Kernel log levels run from KERN_EMERG (0) to KERN_DEBUG (7), followed by
+// lines without a level.
+#define PIPE_LEVEL_NONE 8
+#define PIPE_LEVELS 9
+
+/*! Actions requested from the writer */
+typedef enum {
+    /*! sync all output so far to the SD card */
+    PIPE_ACT_SYNC,
+    /*! move to the next log file */
+    PIPE_ACT_ROTATE,
+    /*! move to the next log file, as the target booted */
+    PIPE_ACT_SEGMENT,
+    /*! start a panic snapshot at the next output */
+    PIPE_ACT_PANIC
+} PipelineAction;
+
+/*! Receives processed output */
+typedef void (*PipelineSink)(const char *data, int len);
+/*! Receives copies of lines at or above the errors level. The arrival time
+ * is the timebase value of the first byte of the line, or 0 for the rest of
+ * a line passed on in pieces. */
+typedef void (*PipelineLineSink)(const char *data, int len, uint64_t arrival);
+/*! Carries out an action, after all output before it was passed to the
+ * sink. The reason is a static string, or NULL for PIPE_ACT_SYNC. */
+typedef void (*PipelineActionFxn)(PipelineAction action, const char *reason);
+
+/**
+ * Sets the functions output and actions are passed to. Should be called by
+ * the SD writer before any data is fed in.
+ * @param sink: function receiving the processed output
+ * @param action: function carrying out actions
+ * @param errors: function receiving copies of error lines
+ */
+void pipeline_start(PipelineSink sink, PipelineActionFxn action,
+                    PipelineLineSink errors);
+
+/**
+ * Processes a block of logged data, followed by any UART errors flagged in
+ * it. Should only be called by the SD writer.
+ * @param block: block taken from the log buffer
+ */
+void pipeline_input(const LogBlock *block);
+
+/**
+ * Passes a marker record to the sink, in order with the logged data. Should
+ * only be called by the SD writer.
+ * @param format: printf style format string for the record contents
+ */
+void pipeline_record(const char *format, ...);
+
+/**
+ * Checks if the pipeline holds a partial line, waiting for the rest of it.
+ * @param arrival: if not NULL, set to the timebase value the first byte
+ * held arrived at
+ * @return true if data is held.
+ */
+bool pipeline_held(uint64_t *arrival);
+
+/**
+ * Checks if the pipeline is counting a run of repeated lines.
+ * @param since: if not NULL, set to the timebase value the first repeat
+ * arrived at
+ * @return true if a run is being counted.
+ */
+bool pipeline_repeating(uint64_t *since);
+
+/**
+ * Passes a held partial line, and the record for a run of repeated lines,
+ * to the sink. Should be called by the SD writer once the logged UART went
+ * idle, so a prompt without a line ending is not held indefinitely, and once
+ * a run of repeats is too old.
+ */
+void pipeline_flush(void);
+
+/**
+ * Gets the number of lines classified at each kernel log level. The counts
+ * are updated by the writer while they are read, so may be a line apart.
+ * @param counts: filled with PIPE_LEVELS counts, indexed by level
+ */
+void pipeline_level_counts(uint32_t *counts);
+
+/**
+ * Clears the log level counts.
+ */
+void pipeline_level_reset(void);
+
+/**
+ * Gets the name of a kernel log level.
+ * @param level: level, from 0 to PIPE_LEVEL_NONE
+ * @return name of the level, such as "err".
+ */
+const char *pipeline_level_name(int level);
+
+/**
+ * Checks if lines are prefixed with their arrival time.
+ * @return true if high resolution timestamps are on.
+ */
+bool pipeline_hires(void);
+
+#endif
\ No newline at end of file
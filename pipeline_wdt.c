@@ -0,0 +1,333 @@
+/**
+ * @file pipeline_wdt.c
+ * Implements the pipeline watchdog. See pipeline_wdt.h for how stages report
+ * progress, and what happens on a stall.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/Error.h>
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/knl/Clock.h>
+
+/* TI-RTOS drivers */
+#include <ti/drivers/GPIO.h>
+#include <ti/drivers/Watchdog.h>
+
+/* TivaWare driver files */
+#include <driverlib/sysctl.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Board Header file */
+#include "Board.h"
+
+#include "cli.h"
+#include "pipeline_wdt.h"
+#include "sd_card.h"
+#include "timebase.h"
+
+// Period of the stage check, which also feeds the hardware watchdog.
+#define WDT_CHECK_MS 250
+// Period of the check while every stage is idle, so an idle logger wakes
+// less often. Well within the hardware watchdog's 1 s reload period.
+#define WDT_IDLE_CHECK_MS 750
+/*
+ * Hibernation module data words holding the stall record: a marker word,
+ * followed by the StallRecord fields. Word 0 is used by the RTC.
+ */
+#define HIB_DATA_STALL 1
+#define HIB_DATA_STALL_WORDS (1 + sizeof(StallRecord) / sizeof(uint32_t))
+#define STALL_NEW_MAGIC 0x53544C4E   // "STLN"
+#define STALL_TAKEN_MAGIC 0x53544C54 // "STLT"
+
+typedef struct {
+    /*! true if the stage has work in hand */
+    bool busy;
+    /*! clock tick of the last progress, or of going busy */
+    uint32_t last;
+} StageState;
+
+/*
+ * Longest time each stage may go without progress while busy, in ms. The
+ * ingest path commits within LOG_COMMIT_MS. The writer and console wait on
+ * SD card I/O, which can take hundreds of ms while the card erases.
+ */
+static const uint32_t STAGE_LIMIT_MS[WDT_STAGE_COUNT] = {500, 5000, 10000};
+static const char *const STAGE_NAMES[WDT_STAGE_COUNT + 1] = {
+    "ingest", "writer", "console", "system"};
+
+static StageState STAGES[WDT_STAGE_COUNT];
+static Clock_Handle CHECK_CLOCK;
+static Watchdog_Handle WATCHDOG;
+// Timebase value of the last stage check, used when the hardware fires.
+static uint64_t LAST_CHECK = 0;
+// True once the SD card was power cycled to recover a stall.
+static bool CARD_CYCLED = false;
+static uint32_t CARD_RECOVERIES = 0;
+// Stage whose stall last made the check power cycle the card, until the SD
+// writer takes it to log, or -1.
+static volatile int CYCLED_STAGE = -1;
+static uint32_t RESET_CAUSE;
+
+static void wdt_check_fxn(UArg arg);
+static void wdt_hw_callback(UArg arg);
+static void record_stall(uint32_t stage, uint32_t stalled_ms);
+
+/**
+ * Sets up the stage checks and starts the hardware watchdog. Should be
+ * called before BIOS starts, after the timebase and GPIO are set up.
+ */
+void wdt_prebios(void) {
+    Error_Block eb;
+    Clock_Params clock_params;
+    Watchdog_Params wdt_params;
+    // Note why we were reset, before anything else can.
+    RESET_CAUSE = SysCtlResetCauseGet();
+    SysCtlResetCauseClear(RESET_CAUSE);
+    Error_init(&eb);
+    Clock_Params_init(&clock_params);
+    // One shot, restarted by each check with the period for the next one.
+    clock_params.period = 0;
+    clock_params.startFlag = TRUE;
+    CHECK_CLOCK =
+        Clock_create(wdt_check_fxn, WDT_CHECK_MS, &clock_params, &eb);
+    if (CHECK_CLOCK == NULL) {
+        System_abort("Failed to create watchdog clock\n");
+    }
+    /*
+     * The hardware watchdog interrupts when it is not fed for a reload
+     * period, and resets on the second period.
+     */
+    Board_initWatchdog();
+    Watchdog_Params_init(&wdt_params);
+    wdt_params.callbackFxn = wdt_hw_callback;
+    wdt_params.resetMode = Watchdog_RESET_ON;
+    wdt_params.debugStallMode = Watchdog_DEBUG_STALL_ON;
+    WATCHDOG = Watchdog_open(Board_WATCHDOG0, &wdt_params);
+    if (WATCHDOG == NULL) {
+        System_abort("Failed to open hardware watchdog\n");
+    }
+    LAST_CHECK = timebase_now();
+}
+
+/**
+ * Marks a stage as having work in hand. The stage must check in at least
+ * once per stall limit until it goes idle. Does nothing if the stage is
+ * already busy. Safe to call from any context.
+ * @param stage: stage that has work
+ */
+void wdt_busy(WdtStage stage) {
+    UInt key = Hwi_disable();
+    if (!STAGES[stage].busy) {
+        STAGES[stage].busy = true;
+        STAGES[stage].last = Clock_getTicks();
+    }
+    Hwi_restore(key);
+}
+
+/**
+ * Records forward progress of a stage. Safe to call from any context.
+ * @param stage: stage that made progress
+ */
+void wdt_checkin(WdtStage stage) { STAGES[stage].last = Clock_getTicks(); }
+
+/**
+ * Marks a stage as waiting for work, so it is not checked. Safe to call from
+ * any context.
+ * @param stage: stage that is waiting
+ */
+void wdt_idle(WdtStage stage) { STAGES[stage].busy = false; }
+
+/**
+ * Takes the stall record of the last reset, if it has not been taken yet.
+ * Used by the SD writer to log the stall once.
+ * @param record: filled with the stall record
+ * @return true if an untaken record was found, or false otherwise.
+ */
+bool wdt_take_stall(StallRecord *record) {
+    uint32_t words[HIB_DATA_STALL_WORDS];
+    hib_data_get(HIB_DATA_STALL, words, HIB_DATA_STALL_WORDS);
+    if (words[0] != STALL_NEW_MAGIC) {
+        return false;
+    }
+    *record = *(StallRecord *)&words[1];
+    words[0] = STALL_TAKEN_MAGIC;
+    hib_data_set(HIB_DATA_STALL, words, 1);
+    return true;
+}
+
+/**
+ * Takes the name of the stage whose stall made the check power cycle the SD
+ * card, if it has not been taken yet. Used by the SD writer to log the
+ * cycle once the card is remounted.
+ * @return stage name, or NULL if the card was not cycled since the last
+ * call.
+ */
+const char *wdt_take_card_cycle(void) {
+    UInt key = Hwi_disable();
+    int stage = CYCLED_STAGE;
+    CYCLED_STAGE = -1;
+    Hwi_restore(key);
+    return stage >= 0 ? STAGE_NAMES[stage] : NULL;
+}
+
+/**
+ * Formats a stall record into a string, such as
+ * "writer stalled for 5012 ms at 2021-03-04 05:06:07 UTC".
+ * @param buf: buffer to write string into
+ * @param len: length of buf in bytes
+ * @param record: record to format
+ * @return number of characters written, as snprintf.
+ */
+int wdt_format_stall(char *buf, int len, const StallRecord *record) {
+    time_t seconds = record->rtc_seconds;
+    struct tm tm;
+    int num_chars;
+    num_chars = snprintf(buf, len, "%s stalled for %lu ms at ",
+                         record->stage <= WDT_STAGE_SYSTEM
+                             ? STAGE_NAMES[record->stage]
+                             : "unknown",
+                         (unsigned long)record->stalled_ms);
+    if (num_chars >= len) {
+        return num_chars;
+    }
+    if (seconds == 0) {
+        return num_chars + snprintf(buf + num_chars, len - num_chars,
+                                    "unknown wall time");
+    }
+    gmtime_r(&seconds, &tm);
+    return num_chars + snprintf(buf + num_chars, len - num_chars,
+                                "%04d-%02d-%02d %02d:%02d:%02d UTC",
+                                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                                tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/**
+ * Prints the state of each stage, the reset cause, and the last stall
+ * record.
+ * @param ctx: CLI context to print to
+ */
+void wdt_report(CLIContext *ctx) {
+    uint32_t words[HIB_DATA_STALL_WORDS], now = Clock_getTicks();
+    char stall_buf[80];
+    StageState state;
+    UInt key;
+    int i;
+    for (i = 0; i < WDT_STAGE_COUNT; i++) {
+        key = Hwi_disable();
+        state = STAGES[i];
+        Hwi_restore(key);
+        if (state.busy) {
+            cli_printf(ctx, "%-8s busy, progress %lu ms ago (limit %lu ms)\r\n",
+                       STAGE_NAMES[i], (unsigned long)(now - state.last),
+                       (unsigned long)STAGE_LIMIT_MS[i]);
+        } else {
+            cli_printf(ctx, "%-8s idle\r\n", STAGE_NAMES[i]);
+        }
+    }
+    cli_printf(ctx, "Last reset: %s, SD card recoveries: %lu\r\n",
+               (RESET_CAUSE & SYSCTL_CAUSE_WDOG0) ? "watchdog" : "other",
+               (unsigned long)CARD_RECOVERIES);
+    hib_data_get(HIB_DATA_STALL, words, HIB_DATA_STALL_WORDS);
+    if (words[0] != STALL_NEW_MAGIC && words[0] != STALL_TAKEN_MAGIC) {
+        cli_printf(ctx, "No stall recorded\r\n");
+        return;
+    }
+    wdt_format_stall(stall_buf, sizeof(stall_buf), (StallRecord *)&words[1]);
+    cli_printf(ctx, "Last stall: %s, %lu stall resets\r\n", stall_buf,
+               (unsigned long)((StallRecord *)&words[1])->count);
+}
+
+/**
+ * Clock function, run in Swi context every WDT_CHECK_MS, or every
+ * WDT_IDLE_CHECK_MS while every stage is idle. Feeds the hardware watchdog
+ * if no stage is stalled, and otherwise attempts recovery or resets. A stage
+ * that goes busy during an idle period is checked at the end of it.
+ * @param arg: unused
+ */
+static void wdt_check_fxn(UArg arg) {
+    uint32_t now = Clock_getTicks(), elapsed;
+    bool any_busy = false;
+    StageState state;
+    UInt key;
+    int i;
+    LAST_CHECK = timebase_now();
+    for (i = 0; i < WDT_STAGE_COUNT; i++) {
+        key = Hwi_disable();
+        state = STAGES[i];
+        Hwi_restore(key);
+        if (!state.busy) {
+            continue;
+        }
+        any_busy = true;
+        elapsed = now - state.last;
+        if (elapsed <= STAGE_LIMIT_MS[i]) {
+            continue;
+        }
+        if (!CARD_CYCLED && sd_io_active()) {
+            /*
+             * The stage is most likely waiting on a wedged SD card. Cut its
+             * power so the pending I/O fails, and the writer remounts it.
+             * The stage gets one more limit to recover. The writer logs
+             * the cycle, as printing needs more of the system stack than a
+             * Swi can spare.
+             */
+            CYCLED_STAGE = i;
+            GPIO_write(Board_SDCARD_VCC, Board_LED_OFF);
+            CARD_CYCLED = true;
+            CARD_RECOVERIES++;
+            wdt_checkin((WdtStage)i);
+            continue;
+        }
+        record_stall(i, elapsed);
+        SysCtlReset();
+    }
+    // Allow another recovery once every stage has caught up.
+    if (!any_busy) {
+        CARD_CYCLED = false;
+    }
+    Watchdog_clear(WATCHDOG);
+    Clock_setTimeout(CHECK_CLOCK, any_busy ? WDT_CHECK_MS : WDT_IDLE_CHECK_MS);
+    Clock_start(CHECK_CLOCK);
+}
+
+/**
+ * Hardware watchdog callback, run in Hwi context when the watchdog was not
+ * fed for a reload period. The stage check Clock has stopped running, so
+ * record the stall. The watchdog resets the system on the next period.
+ * @param arg: unused
+ */
+static void wdt_hw_callback(UArg arg) {
+    record_stall(WDT_STAGE_SYSTEM,
+                 (uint32_t)(timebase_to_us(timebase_now() - LAST_CHECK) /
+                            1000));
+}
+
+/**
+ * Records a stall in the hibernation module memory, which survives the
+ * reset.
+ * @param stage: stalled stage, a WdtStage
+ * @param stalled_ms: time the stage went without progress
+ */
+static void record_stall(uint32_t stage, uint32_t stalled_ms) {
+    uint32_t words[HIB_DATA_STALL_WORDS];
+    StallRecord *record = (StallRecord *)&words[1];
+    hib_data_get(HIB_DATA_STALL, words, HIB_DATA_STALL_WORDS);
+    if (words[0] != STALL_NEW_MAGIC && words[0] != STALL_TAKEN_MAGIC) {
+        // First stall since the hibernation module lost power.
+        record->count = 0;
+    }
+    words[0] = STALL_NEW_MAGIC;
+    record->stage = stage;
+    record->stalled_ms = stalled_ms;
+    record->rtc_seconds = rtc_valid() ? rtc_get(NULL) : 0;
+    record->count++;
+    hib_data_set(HIB_DATA_STALL, words, HIB_DATA_STALL_WORDS);
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+/**
+ * @file pipeline_wdt.h
+ * Implements the pipeline watchdog, which checks that the UART ingest path,
+ * the SD writer and the console keep making forward progress, backed by the
+ * hardware watchdog.
+ *
+ * Each stage marks itself busy while it has work in hand, checks in whenever
+ * it makes progress, and marks itself idle before it waits for more work. A
+ * Clock checks the stages every WDT_CHECK_MS, or less often while all of
+ * them are idle, and only feeds the hardware watchdog while no busy stage
+ * has gone longer than its limit without progress. If the Clock itself
+ * stops running, the hardware watchdog fires.
+ *
+ * When a stage stalls while SD card I/O is in progress, the card is assumed
+ * to be wedged: its power is cycled so the pending I/O fails, and the writer
+ * remounts it. If the stage is still stalled after another limit, or the
+ * card was not the culprit, the stalled stage and the stall duration are
+ * recorded in the hibernation module's battery backed memory, and the
+ * system is reset. The SD writer writes the record into the log after the
+ * next mount.
+ */
+
+#ifndef PIPELINE_WDT_H
+#define PIPELINE_WDT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cli.h"
+
+typedef enum {
+    WDT_STAGE_INGEST = 0,
+    WDT_STAGE_WRITER,
+    WDT_STAGE_CONSOLE,
+    WDT_STAGE_COUNT,
+    /*! not a stage, recorded when the hardware watchdog fires */
+    WDT_STAGE_SYSTEM = WDT_STAGE_COUNT
+} WdtStage;
+
+typedef struct {
+    /*! stage that stalled, a WdtStage */
+    uint32_t stage;
+    /*! time the stage went without progress, in ms */
+    uint32_t stalled_ms;
+    /*! wall clock time of the reset, in seconds since the unix epoch, or 0 if
+     * the RTC was not set */
+    uint32_t rtc_seconds;
+    /*! number of stall resets recorded since the hibernation module lost
+     * power */
+    uint32_t count;
+} StallRecord;
+
+/**
+ * Sets up the stage checks and starts the hardware watchdog. Should be
+ * called before BIOS starts, after the timebase and GPIO are set up.
+ */
+void wdt_prebios(void);
+
+/**
+ * Marks a stage as having work in hand. The stage must check in at least
+ * once per stall limit until it goes idle. Does nothing if the stage is
+ * already busy. Safe to call from any context.
+ * @param stage: stage that has work
+ */
+void wdt_busy(WdtStage stage);
+
+/**
+ * Records forward progress of a stage. Safe to call from any context.
+ * @param stage: stage that made progress
+ */
+void wdt_checkin(WdtStage stage);
+
+/**
+ * Marks a stage as waiting for work, so it is not checked. Safe to call from
+ * any context.
+ * @param stage: stage that is waiting
+ */
+void wdt_idle(WdtStage stage);
+
+/**
+ * Takes the stall record of the last reset, if it has not been taken yet.
+ * Used by the SD writer to log the stall once.
+ * @param record: filled with the stall record
+ * @return true if an untaken record was found, or false otherwise.
+ */
+bool wdt_take_stall(StallRecord *record);
+
+/**
+ * Takes the name of the stage whose stall made the check power cycle the SD
+ * card, if it has not been taken yet. Used by the SD writer to log the
+ * cycle once the card is remounted.
+ * @return stage name, or NULL if the card was not cycled since the last
+ * call.
+ */
+const char *wdt_take_card_cycle(void);
+
+/**
+ * Formats a stall record into a string, such as
+ * "writer stalled for 5012 ms at 2021-03-04 05:06:07 UTC".
+ * @param buf: buffer to write string into
+ * @param len: length of buf in bytes
+ * @param record: record to format
+ * @return number of characters written, as snprintf.
+ */
+int wdt_format_stall(char *buf, int len, const StallRecord *record);
+
+/**
+ * Prints the state of each stage, the reset cause, and the last stall
+ * record.
+ * @param ctx: CLI context to print to
+ */
+void wdt_report(CLIContext *ctx);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+/**
+ * @file power.c
+ * Implements the low power idle. See power.h for the sleep modes used.
+ */
+
+/* XDCtools Header files */
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/hal/Hwi.h>
+
+/* TivaWare driver files */
+#include <driverlib/interrupt.h>
+#include <driverlib/sysctl.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "power.h"
+#include "timebase.h"
+
+static bool SLEEP_ENABLED = true;
+static PowerStats STATS;
+// Timebase value the core last woke at, or 0 while it is awake.
+static volatile uint64_t WOKE_AT = 0;
+
+/**
+ * Idle function, puts the core to sleep until the next interrupt. Added to
+ * the Idle task in the cfg file.
+ */
+void power_idle(void) {
+    uint64_t start, duration;
+    if (!SLEEP_ENABLED) {
+        return;
+    }
+    /*
+     * Mask interrupts with PRIMASK, which SYS/BIOS does not use. A pending
+     * interrupt still wakes the core from WFI, but is not taken until
+     * PRIMASK is cleared, so the wake time is recorded before any Hwi runs.
+     */
+    IntMasterDisable();
+    start = timebase_now();
+    SysCtlSleep();
+    WOKE_AT = timebase_now();
+    duration = WOKE_AT - start;
+    STATS.sleeps++;
+    STATS.asleep += duration;
+    if (duration > STATS.sleep_max) {
+        STATS.sleep_max = (uint32_t)duration;
+    }
+    // Pending Hwis run here.
+    IntMasterEnable();
+    WOKE_AT = 0;
+}
+
+/**
+ * Records that the logged UART's RX edge woke the core. Should be called
+ * from the RX edge Hwi.
+ */
+void power_rx_wake(void) {
+    uint64_t woke_at = WOKE_AT, latency;
+    if (woke_at == 0) {
+        // The edge arrived while the core was awake.
+        return;
+    }
+    latency = timebase_now() - woke_at;
+    STATS.rx_wakes++;
+    if (latency > STATS.wake_latency_max) {
+        STATS.wake_latency_max = (uint32_t)latency;
+    }
+}
+
+/**
+ * Enables or disables sleeping in the Idle task.
+ * @param enable: true to sleep when idle, false to spin
+ */
+void power_sleep_enable(bool enable) { SLEEP_ENABLED = enable; }
+
+/**
+ * Checks if the Idle task sleeps.
+ * @return true if sleep is enabled, false otherwise.
+ */
+bool power_sleep_enabled(void) { return SLEEP_ENABLED; }
+
+/**
+ * Gets the sleep statistics.
+ * @param stats: filled with the current statistics.
+ */
+void power_stats(PowerStats *stats) {
+    UInt key = Hwi_disable();
+    *stats = STATS;
+    Hwi_restore(key);
+}
+
+/**
+ * Resets the sleep statistics.
+ */
+void power_stats_reset(void) {
+    UInt key = Hwi_disable();
+    STATS = (PowerStats){0};
+    STATS.since = timebase_now();
+    Hwi_restore(key);
+}
\ No newline at end of file
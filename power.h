@@ -0,0 +1,82 @@
+/**
+ * @file power.h
+ * Implements the low power idle. When every task is blocked and no Hwi or
+ * Swi is pending, the Idle task puts the core to sleep until the next
+ * interrupt. The Clock module runs in dynamic tick mode (see the cfg file),
+ * so the tick timer only fires for the next scheduled Clock timeout, such as
+ * a sync deadline, rather than every 1 ms.
+ *
+ * While the logged UART is silent, the Clocks still scheduled are the
+ * status LEDs every 50 ms, unless turned off with "power leds off", the
+ * pipeline watchdog check every 750 ms while every stage is idle, and the
+ * timebase poll every 10 s. So an idle logger wakes about 21 times a
+ * second, or about 1.4 times with the LEDs off.
+ *
+ * Only sleep mode is used, not deep sleep. Sleep gates the core clock only,
+ * so the UARTs, uDMA, SSI and timers keep running from the system clock and
+ * no received byte can be lost on wake. Deep sleep would move the system
+ * clock to the internal oscillator, changing the baud rate of the UARTs and
+ * the rate of the SYS/BIOS tick and timebase timers.
+ *
+ * While the logged UART is silent, the receive path stops its commit Clock
+ * and wakes on the falling edge of the RX pin's start bit, see
+ * uart_logger_task.c.
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    /*! number of times the core went to sleep */
+    uint32_t sleeps;
+    /*! number of sleeps ended by an edge on the logged UART's RX pin */
+    uint32_t rx_wakes;
+    /*! total and longest time asleep, in timebase ticks */
+    uint64_t asleep;
+    uint32_t sleep_max;
+    /*! longest time from waking to entering the RX edge Hwi, in timebase
+     * ticks */
+    uint32_t wake_latency_max;
+    /*! timebase value the statistics were reset at */
+    uint64_t since;
+} PowerStats;
+
+/**
+ * Idle function, puts the core to sleep until the next interrupt. Added to
+ * the Idle task in the cfg file.
+ */
+void power_idle(void);
+
+/**
+ * Records that the logged UART's RX edge woke the core. Should be called
+ * from the RX edge Hwi.
+ */
+void power_rx_wake(void);
+
+/**
+ * Enables or disables sleeping in the Idle task.
+ * @param enable: true to sleep when idle, false to spin
+ */
+void power_sleep_enable(bool enable);
+
+/**
+ * Checks if the Idle task sleeps.
+ * @return true if sleep is enabled, false otherwise.
+ */
+bool power_sleep_enabled(void);
+
+/**
+ * Gets the sleep statistics.
+ * @param stats: filled with the current statistics.
+ */
+void power_stats(PowerStats *stats);
+
+/**
+ * Resets the sleep statistics.
+ */
+void power_stats_reset(void);
+
+#endif
\ No newline at end of file
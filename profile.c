@@ -0,0 +1,104 @@
+/**
+ * @file profile.c
+ * Implements a lightweight hot path profiler, built on the Cortex-M4 DWT
+ * cycle counter. See profile.h for usage.
+ */
+
+/* BIOS Header files */
+#include <ti/sysbios/hal/Hwi.h>
+
+#include <stdint.h>
+
+#include "cli.h"
+#include "profile.h"
+
+#ifdef PROFILING
+
+// Debug registers used to enable the cycle counter.
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA 0x1
+#define DEMCR (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA 0x01000000
+
+// Names of profiled regions, in the same order as ProfRegion.
+static const char *const REGION_NAMES[PROF_REGION_COUNT] = {
+    "uart_isr", "writer_block", "mount_check", "sd_mutex",
+    "f_write",  "logvar_mutex", "forward"};
+
+ProfStats PROF_STATS[PROF_REGION_COUNT];
+// Cycles taken by an empty region, subtracted from all measurements.
+uint32_t PROF_OVERHEAD = 0;
+
+/**
+ * Enables the DWT cycle counter and resets profiling statistics.
+ * Should be called before BIOS starts.
+ */
+void prof_init(void) {
+    // Enable trace, then the cycle counter.
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    // Measure the cost of an empty region.
+    prof_reset();
+    PROF_ENTER(PROF_UART_ISR);
+    PROF_EXIT(PROF_UART_ISR);
+    PROF_OVERHEAD = PROF_STATS[PROF_UART_ISR].min;
+    prof_reset();
+}
+
+/**
+ * Resets the statistics of all profiled regions.
+ */
+void prof_reset(void) {
+    int i;
+    UInt key;
+    // Stop regions being updated while they are cleared.
+    key = Hwi_disable();
+    for (i = 0; i < PROF_REGION_COUNT; i++) {
+        PROF_STATS[i].count = 0;
+        PROF_STATS[i].total = 0;
+        PROF_STATS[i].min = UINT32_MAX;
+        PROF_STATS[i].max = 0;
+    }
+    Hwi_restore(key);
+}
+
+/**
+ * Prints the statistics of all profiled regions.
+ * @param context: CLI context to print to.
+ */
+void prof_report(CLIContext *context) {
+    int i;
+    ProfStats stats;
+    UInt key;
+    cli_printf(context, "%-13s %10s %14s %8s %10s %8s\r\n", "region", "count",
+               "total", "min", "max", "avg");
+    for (i = 0; i < PROF_REGION_COUNT; i++) {
+        // Take a consistent copy of the region statistics.
+        key = Hwi_disable();
+        stats = PROF_STATS[i];
+        Hwi_restore(key);
+        if (stats.count == 0) {
+            cli_printf(context, "%-13s %10lu\r\n", REGION_NAMES[i], 0UL);
+            continue;
+        }
+        cli_printf(context, "%-13s %10lu %14llu %8lu %10lu %8lu\r\n",
+                   REGION_NAMES[i], (unsigned long)stats.count,
+                   (unsigned long long)stats.total, (unsigned long)stats.min,
+                   (unsigned long)stats.max,
+                   (unsigned long)(stats.total / stats.count));
+    }
+    cli_printf(context, "All values in CPU cycles\r\n");
+}
+
+#else
+
+void prof_init(void) {}
+
+void prof_reset(void) {}
+
+void prof_report(CLIContext *context) {
+    cli_printf(context, "Profiling is not enabled in this build\r\n");
+}
+
+#endif
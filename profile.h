@@ -0,0 +1,108 @@
+/**
+ * @file profile.h
+ * Implements a lightweight hot path profiler, built on the Cortex-M4 DWT
+ * cycle counter. Code is profiled by wrapping it in named regions:
+ *   PROF_ENTER(PROF_F_WRITE);
+ *   f_write(...);
+ *   PROF_EXIT(PROF_F_WRITE);
+ * Each region tracks its count, as well as the total, min and max cycles
+ * spent within it. Regions may nest, but a region must not be entered
+ * again before it exits, so each region should only be used from one task.
+ *
+ * Profiling is only compiled in when PROFILING is defined (debug builds).
+ * In other builds the region macros compile to nothing.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#include "cli.h"
+
+/** Profiled regions. Add new regions here, and their name in profile.c */
+typedef enum {
+    PROF_UART_ISR = 0,   // Logger UART Hwi, draining the RX FIFO
+    PROF_WRITER_BLOCK,   // Writer handling of one block, after the wait
+    PROF_MOUNT_CHECK,    // Writer check of SD card mount status
+    PROF_SD_MUTEX,       // Acquiring SD_CARD_RW_MUTEX for writer output
+    PROF_F_WRITE,        // f_write call for writer output
+    PROF_LOG_VAR_MUTEX,  // Acquiring LOG_VAR_MUTEX in the writer
+    PROF_FORWARD,        // Forwarding data to the CLI
+    PROF_REGION_COUNT
+} ProfRegion;
+
+typedef struct {
+    /*! cycle count at region entry */
+    uint32_t start;
+    /*! number of times region was exited */
+    uint32_t count;
+    /*! total cycles spent in region */
+    uint64_t total;
+    /*! min and max cycles spent in the region */
+    uint32_t min;
+    uint32_t max;
+} ProfStats;
+
+#ifdef PROFILING
+
+// DWT cycle counter register.
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+
+extern ProfStats PROF_STATS[PROF_REGION_COUNT];
+extern uint32_t PROF_OVERHEAD;
+
+/**
+ * Marks entry to a profiled region.
+ * @param region: region being entered
+ */
+static inline void prof_enter(ProfRegion region) {
+    PROF_STATS[region].start = DWT_CYCCNT;
+}
+
+/**
+ * Marks exit from a profiled region, and updates its statistics.
+ * @param region: region being exited
+ */
+static inline void prof_exit(ProfRegion region) {
+    ProfStats *stats = &PROF_STATS[region];
+    uint32_t cycles = DWT_CYCCNT - stats->start;
+    cycles = cycles > PROF_OVERHEAD ? cycles - PROF_OVERHEAD : 0;
+    stats->count++;
+    stats->total += cycles;
+    if (cycles < stats->min) {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+}
+
+#define PROF_ENTER(region) prof_enter(region)
+#define PROF_EXIT(region) prof_exit(region)
+
+#else
+
+#define PROF_ENTER(region)
+#define PROF_EXIT(region)
+
+#endif
+
+/**
+ * Enables the DWT cycle counter and resets profiling statistics.
+ * Should be called before BIOS starts.
+ */
+void prof_init(void);
+
+/**
+ * Resets the statistics of all profiled regions.
+ */
+void prof_reset(void);
+
+/**
+ * Prints the statistics of all profiled regions.
+ * @param context: CLI context to print to.
+ */
+void prof_report(CLIContext *context);
+
+#endif
@@ -9,7 +9,6 @@
  * MISO- PB6
  * MOSI- PB7
  * CS- PA5
- * PF4- SD write activity LED.
  * PA2- See below
  * If hotplugging the SD card is desired, PA2 will be pulled high when the
  * system wants to power the SD card. a MOSFET or BJT will be  required because
@@ -18,12 +17,8 @@
 
 /* XDCtools Header files */
 #include <xdc/runtime/System.h>
-#include <xdc/runtime/Timestamp.h>
 #include <xdc/std.h>
 
-/* Pthread support */
-#include <ti/sysbios/posix/pthread.h>
-
 /* BIOS Header files */
 #include <ti/sysbios/knl/Task.h>
 
@@ -34,33 +29,62 @@
 /* FatFS driver */
 #include <ti/mw/fatfs/ff.h>
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 // Board header file
 #include "Board.h"
 
-// Drive number, as well as macros to convert it to a string
-#define DRIVE_NUM 0
-#define STR_(n) #n
-#define STR(n) STR_(n)
+#include "lock.h"
+#include "profile.h"
+#include "sd_card.h"
+#include "supervisor.h"
+#include "timebase.h"
+#include "trace.h"
+
+// Maximum length of a marker record written to the log.
+#define RECORD_START "\n-------"
+#define RECORD_END " -----------\n"
+// Rotated log files are named LOG_NNNN.TXT, with NNNN counting up from 1.
+#define ROTATE_FORMAT STR(DRIVE_NUM) ":LOG_%04u.TXT"
+#define ROTATE_MAX 9999
+#define LOGFILE_NAME_MAXLEN 16
+// Index of the log files, one line per file started.
+#define INDEX_FILE STR(DRIVE_NUM) ":INDEX.TXT"
+#define SNAPSHOT_FORMAT STR(DRIVE_NUM) ":PANIC_%04u.TXT"
 
 // Global variables.
-pthread_cond_t SD_CARD_READY;
-pthread_mutex_t SD_CARD_RW_MUTEX;
+Lock SD_CARD_RW_MUTEX;
 bool SD_CARD_MOUNTED = false;
 SDSPI_Handle SDSPI_HANDLE;
 FIL LOGFILE;
+// Second file object, for files written alongside the log file.
+static FIL AUX_FILE;
+// Name of the log file written to. Changed by log rotation.
+static char LOGFILE_NAME[LOGFILE_NAME_MAXLEN] = STR(DRIVE_NUM) ":uart_log.txt";
+static unsigned int LOGFILE_INDEX = 0;
+// Name and index of the last snapshot file created.
+static char SNAPSHOT_NAME[LOGFILE_NAME_MAXLEN] = "";
+static unsigned int SNAPSHOT_INDEX = 0;
+// The log file, opened again to read a snapshot's data from in order, so
+// LOGFILE is never seeked back. Without fast seek, a seek walks the file's
+// cluster chain from its start.
+static FIL SNAPSHOT_SRC;
+static bool SNAPSHOT_OPEN = false;
+// True while the SD card mutex holder is waiting on the card.
+static volatile bool SD_IO_ACTIVE = false;
 
 static bool sd_online(const char *drive_num, FATFS **fs);
 static bool open_file(const char *filename, FIL *outfile);
+static int write_log(void *data, int n, bool profiled);
 
 /**
  * Runs required setup for the SD card. Should be called before BIOS starts.
  */
 void sd_setup(void) {
-    pthread_cond_init(&SD_CARD_READY, NULL);
-    if (pthread_mutex_init(&SD_CARD_RW_MUTEX, NULL) != 0) {
+    if (lock_init(&SD_CARD_RW_MUTEX, "SD_CARD_RW_MUTEX") != 0) {
         System_abort("Failed to create SD write mutex\n");
     }
     // Set up SPI bus.
@@ -68,21 +92,20 @@ void sd_setup(void) {
 }
 
 /**
- * Attempts to mount the SD card. If the mount succeeds, notifies any tasks
- * waiting for the SD card to be mounted that it has been.
+ * Attempts to mount the SD card. If the mount succeeds, posts
+ * SUP_EVT_MOUNTED to the supervisor.
  * @return true if mount succeeds, or false otherwise.
  */
 bool attempt_sd_mount(void) {
     SDSPI_Params sdspi_params;
-    const char logfilename[] = STR(DRIVE_NUM) ":uart_log.txt";
     bool success;
     // First, lock the sd card access mutex.
-    if (pthread_mutex_lock(&SD_CARD_RW_MUTEX) != 0) {
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
         System_abort("could not lock sd card mutex");
     }
     if (SD_CARD_MOUNTED) {
         // No need to attempt mounting. Return success.
-        pthread_mutex_unlock(&SD_CARD_RW_MUTEX);
+        lock_release(&SD_CARD_RW_MUTEX);
         System_printf("Mount requested, but SD card already mounted\n");
         System_flush();
         return SD_CARD_MOUNTED;
@@ -106,14 +129,17 @@ bool attempt_sd_mount(void) {
     } else {
         System_printf("SPI Bus for Drive %u started\n", DRIVE_NUM);
     }
+    SD_IO_ACTIVE = true;
     success = SD_CARD_MOUNTED = sd_online(STR(DRIVE_NUM), &(LOGFILE.fs));
+    SD_IO_ACTIVE = false;
+    trace_event(TRACE_SD_MOUNT, success);
     if (success) {
         // Sd card did mount. Open the log file for writing.
-        if (!open_file(logfilename, &LOGFILE)) {
+        if (!open_file(LOGFILE_NAME, &LOGFILE)) {
             System_abort("SD card is mounted, but cannot write file");
         }
-        // Signal waiting tasks that the SD card is ready.
-        pthread_cond_broadcast(&SD_CARD_READY);
+        // Tell the writer that the SD card is ready.
+        supervisor_post(SUP_EVT_MOUNTED);
     } else {
         // Sd card is not mounted. Undo SPI bus initialization.
         SDSPI_close(SDSPI_HANDLE);
@@ -121,29 +147,37 @@ bool attempt_sd_mount(void) {
         GPIO_write(Board_SDCARD_VCC, Board_LED_OFF);
     }
     // Unlock the mutex.
-    pthread_mutex_unlock(&SD_CARD_RW_MUTEX);
+    lock_release(&SD_CARD_RW_MUTEX);
     System_flush();
     return success;
 }
 
 /**
- * Unmounts the SD card.
+ * Unmounts the SD card, and posts SUP_EVT_UNMOUNTED to the supervisor.
  */
 void unmount_sd_card(void) {
     // First, lock the sd card access mutex.
-    if (pthread_mutex_lock(&SD_CARD_RW_MUTEX) != 0) {
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
         System_abort("could not lock sd card mutex");
     }
     // Flush all pending writes to the SD card, and close the log file.
+    SD_IO_ACTIVE = true;
     f_sync(&LOGFILE);
     f_close(&LOGFILE);
+    if (SNAPSHOT_OPEN) {
+        f_close(&SNAPSHOT_SRC);
+        SNAPSHOT_OPEN = false;
+    }
+    SD_IO_ACTIVE = false;
     // Power the SD card VCC back off.
     GPIO_write(Board_SDCARD_VCC, Board_LED_OFF);
     // Undo SPI bus initialization.
     SDSPI_close(SDSPI_HANDLE);
     SD_CARD_MOUNTED = false;
+    trace_event(TRACE_SD_UNMOUNT, 0);
     // Unlock the mutex.
-    pthread_mutex_unlock(&SD_CARD_RW_MUTEX);
+    lock_release(&SD_CARD_RW_MUTEX);
+    supervisor_post(SUP_EVT_UNMOUNTED);
 }
 
 /**
@@ -153,51 +187,102 @@ void unmount_sd_card(void) {
 bool sd_card_mounted(void) {
     bool mounted;
     // First, lock the sd card access mutex.
-    if (pthread_mutex_lock(&SD_CARD_RW_MUTEX) != 0) {
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
         System_abort("could not lock sd card mutex");
     }
     mounted = SD_CARD_MOUNTED;
     // Unlock the mutex.
-    pthread_mutex_unlock(&SD_CARD_RW_MUTEX);
+    lock_release(&SD_CARD_RW_MUTEX);
     return mounted;
 }
 
 /**
- * Waits for the SD card to be mounted.
+ * Writes data to the SD card.
+ * @param data data buffer to write to the SD card.
+ * @param n number of bytes to write.
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
  */
-void wait_sd_ready(void) {
-    // First, lock the sd card access mutex.
-    if (pthread_mutex_lock(&SD_CARD_RW_MUTEX) != 0) {
-        System_abort("could not lock sd card mutex");
-    }
-    pthread_cond_wait(&SD_CARD_READY, &SD_CARD_RW_MUTEX);
-    // Unlock the mutex.
-    pthread_mutex_unlock(&SD_CARD_RW_MUTEX);
-}
+int write_sd(void *data, int n) { return write_log(data, n, false); }
 
 /**
- * Writes data to the SD card.
+ * Writes data to the SD card, as write_sd(), and profiles the wait for the
+ * SD card mutex and the write. Profiled regions must only be used from one
+ * task, so this is only called by the SD writer.
  * @param data data buffer to write to the SD card.
  * @param n number of bytes to write.
- * @return number of bytes written, or -1 on error.
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
+ */
+int write_sd_profiled(void *data, int n) { return write_log(data, n, true); }
+
+/**
+ * Flushes all data written to the log file to the SD card, so it is durable.
+ * @return 0 on success, or -1 on error or if the card is not mounted.
  */
-int write_sd(void *data, int n) {
+int sync_sd(void) {
     FRESULT fresult;
-    unsigned int bytes_written;
     // First, lock the sd card access mutex.
-    if (pthread_mutex_lock(&SD_CARD_RW_MUTEX) != 0) {
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
         System_abort("could not lock sd card mutex");
     }
-    fresult = f_write(&LOGFILE, data, n, &bytes_written);
-    // Unlock the mutex
-    pthread_mutex_unlock(&SD_CARD_RW_MUTEX);
-    if (fresult) {
+    if (!SD_CARD_MOUNTED) {
+        lock_release(&SD_CARD_RW_MUTEX);
         return -1;
-    } else {
-        // Toggle write activity LED.
-        GPIO_toggle(Board_WRITE_ACTIVITY_LED);
-        return (int)bytes_written;
     }
+    SD_IO_ACTIVE = true;
+    fresult = f_sync(&LOGFILE);
+    SD_IO_ACTIVE = false;
+    lock_release(&SD_CARD_RW_MUTEX);
+    trace_event(TRACE_SD_SYNC, fresult != FR_OK);
+    return fresult == FR_OK ? 0 : -1;
+}
+
+/**
+ * Checks if a task is waiting on the SD card, such as in a write or sync.
+ * Used by the pipeline watchdog to tell if a stall is caused by the card.
+ * Safe to call from any context.
+ * @return true if SD card I/O is in progress, false otherwise.
+ */
+bool sd_io_active(void) { return SD_IO_ACTIVE; }
+
+/**
+ * Writes a marker record to the SD card logs. Records are a single line,
+ * set apart from the logged data by dashes.
+ * @param format: printf style format string for the record contents
+ * @return 0 on success, or another value on error.
+ */
+int write_record(const char *format, ...) {
+    char record_buf[RECORD_MAXLEN];
+    va_list args;
+    int num_chars;
+    va_start(args, format);
+    num_chars = format_record(record_buf, sizeof(record_buf), format, args);
+    va_end(args);
+    return (write_sd(record_buf, num_chars) == num_chars ? 0 : -1);
+}
+
+/**
+ * Formats a marker record, as written by write_record(). A record that does
+ * not fit is truncated.
+ * @param buf: buffer to format the record into
+ * @param len: size of buf, at least RECORD_MAXLEN
+ * @param format: printf style format string for the record contents
+ * @param args: arguments for the format string
+ * @return length of the record.
+ */
+int format_record(char *buf, int len, const char *format, va_list args) {
+    int num_chars, max_body;
+    // Leave space for the record end string.
+    max_body = len - (sizeof(RECORD_END) - 1);
+    num_chars = snprintf(buf, max_body, RECORD_START);
+    num_chars += vsnprintf(buf + num_chars, max_body - num_chars, format, args);
+    // If the record was truncated, write as much of it as fit.
+    if (num_chars > max_body - 1) {
+        num_chars = max_body - 1;
+    }
+    num_chars += snprintf(buf + num_chars, len - num_chars, RECORD_END);
+    return num_chars;
 }
 
 /**
@@ -205,13 +290,15 @@ int write_sd(void *data, int n) {
  * @return 0 on success, or another value on error.
  */
 int write_timestamp(void) {
-    char ts_string_buf[80];
-    int num_chars;
-    // Print the formatted timestamp into buffer.
-    num_chars =
-        snprintf(ts_string_buf, 80, "\n-------Log Timestamp: %lu -----------\n",
-                 Timestamp_get32());
-    return (write_sd(ts_string_buf, num_chars) == num_chars ? 0 : -1);
+    char wall_buf[32];
+    uint64_t uptime_us;
+    // Get the uptime and wall clock time at the same point.
+    uptime_us = timebase_now_us();
+    format_wall_time(wall_buf, sizeof(wall_buf));
+    trace_event(TRACE_TIMESTAMP, 0);
+    return write_record("Log Timestamp: %lu.%06lu s, %s",
+                        (unsigned long)(uptime_us / 1000000),
+                        (unsigned long)(uptime_us % 1000000), wall_buf);
 }
 
 /**
@@ -221,14 +308,335 @@ int write_timestamp(void) {
 int filesize(void) {
     int filesize;
     // First, lock the sd card access mutex.
-    if (pthread_mutex_lock(&SD_CARD_RW_MUTEX) != 0) {
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
         System_abort("could not lock sd card mutex");
     }
     filesize = f_size(&LOGFILE);
-    pthread_mutex_unlock(&SD_CARD_RW_MUTEX);
+    lock_release(&SD_CARD_RW_MUTEX);
     return filesize;
 }
 
+/**
+ * Closes the log file, and opens the next unused rotated log file,
+ * LOG_NNNN.TXT. Data is synced to the old file before it is closed. If the
+ * new file can't be opened, the old one is reopened, and logging carries on
+ * at its end.
+ * @return index of the new log file, or -1 on error.
+ */
+int rotate_log_file(void) {
+    char name[LOGFILE_NAME_MAXLEN];
+    unsigned int index;
+    FILINFO info;
+    int ret = -1;
+    // First, lock the sd card access mutex.
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (!SD_CARD_MOUNTED) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    // Find the first unused file name after the current one.
+    for (index = LOGFILE_INDEX + 1; index <= ROTATE_MAX; index++) {
+        snprintf(name, sizeof(name), ROTATE_FORMAT, index);
+        if (f_stat(name, &info) == FR_NO_FILE) {
+            break;
+        }
+    }
+    if (index <= ROTATE_MAX) {
+        f_close(&LOGFILE);
+        if (open_file(name, &LOGFILE)) {
+            strcpy(LOGFILE_NAME, name);
+            LOGFILE_INDEX = index;
+            trace_event(TRACE_ROTATE, index);
+            ret = index;
+        } else if (!open_file(LOGFILE_NAME, &LOGFILE)) {
+            // Writes now fail, so the writer remounts the card.
+            System_printf("Could not reopen \"%s\"\n", LOGFILE_NAME);
+            System_flush();
+        }
+    }
+    lock_release(&SD_CARD_RW_MUTEX);
+    return ret;
+}
+
+/**
+ * Lists the log file in INDEX.TXT, with the uptime, the wall time, and the
+ * reason it was started, so the log of a given target boot can be found
+ * without reading the logs.
+ * @param reason: reason the log file was started
+ * @return 0 on success, or -1 on error.
+ */
+int write_index_entry(const char *reason) {
+    char wall_buf[32];
+    char entry_buf[RECORD_MAXLEN];
+    uint64_t uptime_us;
+    int len;
+    uptime_us = timebase_now_us();
+    format_wall_time(wall_buf, sizeof(wall_buf));
+    // Drop the drive number from the file name.
+    len = snprintf(entry_buf, sizeof(entry_buf), "%s, %lu.%06lu s, %s, %s\r\n",
+                   LOGFILE_NAME + sizeof(STR(DRIVE_NUM) ":") - 1,
+                   (unsigned long)(uptime_us / 1000000),
+                   (unsigned long)(uptime_us % 1000000), wall_buf, reason);
+    if (len >= sizeof(entry_buf)) {
+        len = sizeof(entry_buf) - 1;
+    }
+    return append_sd_file(INDEX_FILE, entry_buf, len) == len ? 0 : -1;
+}
+
+/**
+ * Creates the next unused snapshot file, PANIC_NNNN.TXT, and opens the log
+ * file again to read the snapshot's data from, from offset on. The log file
+ * is synced first, so the data written so far can be read back. The data
+ * is then copied by copy_log_snapshot(), and the log file closed again by
+ * close_log_snapshot(). The log file must not be rotated in between.
+ * @param offset: offset in the log file of the first byte to copy
+ * @return 0 on success, or -1 on error or if the card is not mounted.
+ */
+int create_log_snapshot(uint32_t offset) {
+    char name[LOGFILE_NAME_MAXLEN];
+    unsigned int index;
+    FILINFO info;
+    FRESULT fresult;
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (!SD_CARD_MOUNTED || SNAPSHOT_OPEN) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    // Find the first unused file name after the last snapshot.
+    for (index = SNAPSHOT_INDEX + 1; index <= ROTATE_MAX; index++) {
+        snprintf(name, sizeof(name), SNAPSHOT_FORMAT, index);
+        if (f_stat(name, &info) == FR_NO_FILE) {
+            break;
+        }
+    }
+    if (index > ROTATE_MAX) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    SD_IO_ACTIVE = true;
+    fresult = f_open(&AUX_FILE, name, FA_CREATE_NEW | FA_WRITE);
+    if (fresult == FR_OK) {
+        fresult = f_close(&AUX_FILE);
+    }
+    if (fresult == FR_OK) {
+        strcpy(SNAPSHOT_NAME, name);
+    } else {
+        SNAPSHOT_NAME[0] = '\0';
+    }
+    // Skip the name even if creating it failed, as the file may exist.
+    SNAPSHOT_INDEX = index;
+    // The reader sees the size and data on the card, not in LOGFILE's buffer.
+    if (fresult == FR_OK) {
+        fresult = f_sync(&LOGFILE);
+    }
+    if (fresult == FR_OK) {
+        fresult = f_open(&SNAPSHOT_SRC, LOGFILE_NAME, FA_READ);
+    }
+    if (fresult == FR_OK) {
+        SNAPSHOT_OPEN = true;
+        fresult = f_lseek(&SNAPSHOT_SRC, offset);
+    }
+    SD_IO_ACTIVE = false;
+    lock_release(&SD_CARD_RW_MUTEX);
+    if (fresult != FR_OK) {
+        close_log_snapshot();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Appends the next chunk of the log file to the snapshot file created last.
+ * The data is read on from where the last chunk ended, and only as far as
+ * the log file was when the snapshot was created. Writing to the log file
+ * carries on meanwhile, so a snapshot can be copied a chunk at a time
+ * between writes to the log.
+ * @param end: offset after the last byte to copy
+ * @param buf: buffer to copy through
+ * @param len: size of buf, and most bytes to copy
+ * @return number of bytes copied, 0 once the copy reaches end, or -1 on
+ * error or if the card is not mounted.
+ */
+int copy_log_snapshot(uint32_t end, void *buf, int len) {
+    unsigned int n, bytes;
+    FRESULT fresult;
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (!SD_CARD_MOUNTED || !SNAPSHOT_OPEN) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    if (end > f_size(&SNAPSHOT_SRC)) {
+        end = f_size(&SNAPSHOT_SRC);
+    }
+    if (f_tell(&SNAPSHOT_SRC) >= end) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return 0;
+    }
+    n = end - f_tell(&SNAPSHOT_SRC);
+    if (n > (unsigned int)len) {
+        n = len;
+    }
+    // The snapshot file is short, so seeking to its end is cheap.
+    if (!open_file(SNAPSHOT_NAME, &AUX_FILE)) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    SD_IO_ACTIVE = true;
+    fresult = f_read(&SNAPSHOT_SRC, buf, n, &bytes);
+    if (fresult == FR_OK && bytes == n) {
+        fresult = f_write(&AUX_FILE, buf, n, &bytes);
+    }
+    if (fresult == FR_OK && bytes != n) {
+        // Short read, or the card is full.
+        fresult = FR_DISK_ERR;
+    }
+    if (f_close(&AUX_FILE) != FR_OK) {
+        fresult = FR_DISK_ERR;
+    }
+    SD_IO_ACTIVE = false;
+    lock_release(&SD_CARD_RW_MUTEX);
+    return fresult == FR_OK ? (int)n : -1;
+}
+
+/**
+ * Closes the log file opened by create_log_snapshot(), once the snapshot is
+ * copied or given up on. Does nothing if it is not open.
+ */
+void close_log_snapshot(void) {
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (SNAPSHOT_OPEN) {
+        // Opened for reading only, so closing it writes nothing.
+        f_close(&SNAPSHOT_SRC);
+        SNAPSHOT_OPEN = false;
+    }
+    lock_release(&SD_CARD_RW_MUTEX);
+}
+
+/**
+ * Appends data to a file other than the log file. The file is opened and
+ * closed again on each call, so the log file stays open.
+ * @param name: file to append to, including the drive number
+ * @param data: data to write
+ * @param n: number of bytes to write
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
+ */
+int append_sd_file(const char *name, const void *data, int n) {
+    FRESULT fresult;
+    unsigned int bytes_written;
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (!SD_CARD_MOUNTED || !open_file(name, &AUX_FILE)) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    SD_IO_ACTIVE = true;
+    fresult = f_write(&AUX_FILE, data, n, &bytes_written);
+    if (f_close(&AUX_FILE) != FR_OK) {
+        fresult = FR_DISK_ERR;
+    }
+    SD_IO_ACTIVE = false;
+    lock_release(&SD_CARD_RW_MUTEX);
+    return fresult == FR_OK ? (int)bytes_written : -1;
+}
+
+/**
+ * Reads the start of a file other than the log file.
+ * @param name: file to read, including the drive number
+ * @param data: buffer to read into
+ * @param n: size of the buffer
+ * @return number of bytes read, or -1 on error, if the file does not exist,
+ * or if the card is not mounted.
+ */
+int read_sd_file(const char *name, void *data, int n) {
+    FRESULT fresult;
+    unsigned int bytes_read;
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (!SD_CARD_MOUNTED || f_open(&AUX_FILE, name, FA_READ) != FR_OK) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    SD_IO_ACTIVE = true;
+    fresult = f_read(&AUX_FILE, data, n, &bytes_read);
+    f_close(&AUX_FILE);
+    SD_IO_ACTIVE = false;
+    lock_release(&SD_CARD_RW_MUTEX);
+    return fresult == FR_OK ? (int)bytes_read : -1;
+}
+
+/**
+ * Replaces the contents of a file other than the log file, creating it if
+ * needed.
+ * @param name: file to write, including the drive number
+ * @param data: data to write
+ * @param n: number of bytes to write
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
+ */
+int replace_sd_file(const char *name, const void *data, int n) {
+    FRESULT fresult;
+    unsigned int bytes_written;
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (!SD_CARD_MOUNTED ||
+        f_open(&AUX_FILE, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    SD_IO_ACTIVE = true;
+    fresult = f_write(&AUX_FILE, data, n, &bytes_written);
+    if (f_close(&AUX_FILE) != FR_OK) {
+        fresult = FR_DISK_ERR;
+    }
+    SD_IO_ACTIVE = false;
+    lock_release(&SD_CARD_RW_MUTEX);
+    return fresult == FR_OK ? (int)bytes_written : -1;
+}
+
+/**
+ * Gets the name of the log file being written to.
+ * @return log file name, including the drive number.
+ */
+const char *log_file_name(void) { return LOGFILE_NAME; }
+
+/**
+ * Gets the name of the last snapshot file created.
+ * @return snapshot file name, including the drive number, or an empty
+ * string if none was created.
+ */
+const char *snapshot_file_name(void) { return SNAPSHOT_NAME; }
+
+/**
+ * Gets the index of the log file being written to.
+ * @return rotated log file index, or 0 for the default log file.
+ */
+unsigned int log_file_index(void) { return LOGFILE_INDEX; }
+
+/**
+ * Selects the log file to open on the next mount, such as the file restored
+ * from a checkpoint. Should be called before BIOS starts.
+ * @param index: rotated log file index, or 0 for the default log file
+ */
+void select_log_file(unsigned int index) {
+    if (index == 0 || index > ROTATE_MAX) {
+        return;
+    }
+    snprintf(LOGFILE_NAME, sizeof(LOGFILE_NAME), ROTATE_FORMAT, index);
+    LOGFILE_INDEX = index;
+}
+
 /**
  * Checks if the SD card is online by attempting to check the free cluster
  * count.
@@ -283,4 +691,50 @@ static bool open_file(const char *filename, FIL *outfile) {
         }
     }
     return true;
+}
+
+/**
+ * Writes data to the log file.
+ * @param data data buffer to write to the SD card.
+ * @param n number of bytes to write.
+ * @param profiled: if true, profile the wait for the mutex and the write
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
+ */
+static int write_log(void *data, int n, bool profiled) {
+    FRESULT fresult;
+    unsigned int bytes_written;
+    // First, lock the sd card access mutex.
+    if (profiled) {
+        PROF_ENTER(PROF_SD_MUTEX);
+    }
+    if (lock_acquire(&SD_CARD_RW_MUTEX) != 0) {
+        System_abort("could not lock sd card mutex");
+    }
+    if (profiled) {
+        PROF_EXIT(PROF_SD_MUTEX);
+    }
+    if (!SD_CARD_MOUNTED) {
+        // The card was unmounted, so the log file is closed.
+        lock_release(&SD_CARD_RW_MUTEX);
+        return -1;
+    }
+    trace_event(TRACE_SD_WRITE_START, n);
+    if (profiled) {
+        PROF_ENTER(PROF_F_WRITE);
+    }
+    SD_IO_ACTIVE = true;
+    fresult = f_write(&LOGFILE, data, n, &bytes_written);
+    SD_IO_ACTIVE = false;
+    if (profiled) {
+        PROF_EXIT(PROF_F_WRITE);
+    }
+    trace_event(TRACE_SD_WRITE_END, fresult ? 0xFFFF : bytes_written);
+    // Unlock the mutex
+    lock_release(&SD_CARD_RW_MUTEX);
+    if (fresult) {
+        return -1;
+    } else {
+        return (int)bytes_written;
+    }
 }
\ No newline at end of file
@@ -9,7 +9,6 @@
  * MISO- PB6
  * MOSI- PB7
  * CS- PA5
- * PF4- SD write activity LED.
  * PA2- See below
  * If hotplugging the SD card is desired, PA2 will be pulled high when the
  * system wants to power the SD card. a MOSFET or BJT will be  required because
@@ -18,32 +17,38 @@
 
 #ifndef SD_CARD_H
 #define SD_CARD_H
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+// Longest marker record, including the dashes around it.
+#define RECORD_MAXLEN 160
+// Drive number, as well as macros to convert it to a string
+#define DRIVE_NUM 0
+#define STR_(n) #n
+#define STR(n) STR_(n)
+// Prefix of the names of files on the SD card, such as "0:".
+#define DRIVE_PREFIX STR(DRIVE_NUM) ":"
 
 /**
- * Sets up required mutex and condition variables for SD card management.
+ * Sets up the required mutex for SD card management.
  * Also enables GPIO pins control required for SD card hotplug.
  * Should be called before BIOS starts.
  */
 void sd_setup(void);
 
 /**
- * Attempts to mount the SD card. If the mount succeeds, notifies any tasks
- * waiting for the SD card to be mounted that it has been.
+ * Attempts to mount the SD card. If the mount succeeds, posts
+ * SUP_EVT_MOUNTED to the supervisor.
  * @return true if mount succeeds, or false otherwise.
  */
 bool attempt_sd_mount(void);
 
 /**
- * Unmounts the SD card.
+ * Unmounts the SD card, and posts SUP_EVT_UNMOUNTED to the supervisor.
  */
 void unmount_sd_card(void);
 
-/**
- * Waits for the SD card to be mounted.
- */
-void wait_sd_ready(void);
-
 /**
  * Gets the mount status of the SD card.
  * @return true if card is mounted, false otherwise.
@@ -54,20 +59,172 @@ bool sd_card_mounted(void);
  * Writes data to the SD card.
  * @param data data buffer to write to the SD card.
  * @param n number of bytes to write.
- * @return number of bytes written, or -1 on error.
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
  */
 int write_sd(void *data, int n);
 
+/**
+ * Writes data to the SD card, as write_sd(), and profiles the wait for the
+ * SD card mutex and the write. Profiled regions must only be used from one
+ * task, so this is only called by the SD writer.
+ * @param data data buffer to write to the SD card.
+ * @param n number of bytes to write.
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
+ */
+int write_sd_profiled(void *data, int n);
+
 /**
  * Gets the size of the log file in bytes.
  * @return size of file in bytes.
  */
 int filesize(void);
 
+/**
+ * Flushes all data written to the log file to the SD card, so it is durable.
+ * @return 0 on success, or -1 on error or if the card is not mounted.
+ */
+int sync_sd(void);
+
+/**
+ * Checks if a task is waiting on the SD card, such as in a write or sync.
+ * Used by the pipeline watchdog to tell if a stall is caused by the card.
+ * Safe to call from any context.
+ * @return true if SD card I/O is in progress, false otherwise.
+ */
+bool sd_io_active(void);
+
+/**
+ * Writes a marker record to the SD card logs. Records are a single line,
+ * set apart from the logged data by dashes.
+ * @param format: printf style format string for the record contents
+ * @return 0 on success, or another value on error.
+ */
+int write_record(const char *format, ...);
+
+/**
+ * Formats a marker record, as written by write_record(). A record that does
+ * not fit is truncated.
+ * @param buf: buffer to format the record into
+ * @param len: size of buf, at least RECORD_MAXLEN
+ * @param format: printf style format string for the record contents
+ * @param args: arguments for the format string
+ * @return length of the record.
+ */
+int format_record(char *buf, int len, const char *format, va_list args);
+
 /**
  * Writes a timestamp to the SD card logs
  * @return 0 on success, or another value on error.
  */
 int write_timestamp(void);
 
+/**
+ * Closes the log file, and opens the next unused rotated log file,
+ * LOG_NNNN.TXT. Data is synced to the old file before it is closed. If the
+ * new file can't be opened, the old one is reopened, and logging carries on
+ * at its end.
+ * @return index of the new log file, or -1 on error.
+ */
+int rotate_log_file(void);
+
+/**
+ * Lists the log file in INDEX.TXT, with the uptime, the wall time, and the
+ * reason it was started, so the log of a given target boot can be found
+ * without reading the logs.
+ * @param reason: reason the log file was started
+ * @return 0 on success, or -1 on error.
+ */
+int write_index_entry(const char *reason);
+
+/**
+ * Creates the next unused snapshot file, PANIC_NNNN.TXT, and opens the log
+ * file again to read the snapshot's data from, from offset on. The log file
+ * is synced first, so the data written so far can be read back. The data
+ * is then copied by copy_log_snapshot(), and the log file closed again by
+ * close_log_snapshot(). The log file must not be rotated in between.
+ * @param offset: offset in the log file of the first byte to copy
+ * @return 0 on success, or -1 on error or if the card is not mounted.
+ */
+int create_log_snapshot(uint32_t offset);
+
+/**
+ * Appends the next chunk of the log file to the snapshot file created last.
+ * The data is read on from where the last chunk ended, and only as far as
+ * the log file was when the snapshot was created. Writing to the log file
+ * carries on meanwhile, so a snapshot can be copied a chunk at a time
+ * between writes to the log.
+ * @param end: offset after the last byte to copy
+ * @param buf: buffer to copy through
+ * @param len: size of buf, and most bytes to copy
+ * @return number of bytes copied, 0 once the copy reaches end, or -1 on
+ * error or if the card is not mounted.
+ */
+int copy_log_snapshot(uint32_t end, void *buf, int len);
+
+/**
+ * Closes the log file opened by create_log_snapshot(), once the snapshot is
+ * copied or given up on. Does nothing if it is not open.
+ */
+void close_log_snapshot(void);
+
+/**
+ * Gets the name of the last snapshot file created.
+ * @return snapshot file name, including the drive number, or an empty
+ * string if none was created.
+ */
+const char *snapshot_file_name(void);
+
+/**
+ * Appends data to a file other than the log file. The file is opened and
+ * closed again on each call, so the log file stays open.
+ * @param name: file to append to, including the drive number
+ * @param data: data to write
+ * @param n: number of bytes to write
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
+ */
+int append_sd_file(const char *name, const void *data, int n);
+
+/**
+ * Reads the start of a file other than the log file.
+ * @param name: file to read, including the drive number
+ * @param data: buffer to read into
+ * @param n: size of the buffer
+ * @return number of bytes read, or -1 on error, if the file does not exist,
+ * or if the card is not mounted.
+ */
+int read_sd_file(const char *name, void *data, int n);
+
+/**
+ * Replaces the contents of a file other than the log file, creating it if
+ * needed.
+ * @param name: file to write, including the drive number
+ * @param data: data to write
+ * @param n: number of bytes to write
+ * @return number of bytes written, or -1 on error or if the card is not
+ * mounted.
+ */
+int replace_sd_file(const char *name, const void *data, int n);
+
+/**
+ * Gets the name of the log file being written to.
+ * @return log file name, including the drive number.
+ */
+const char *log_file_name(void);
+
+/**
+ * Gets the index of the log file being written to.
+ * @return rotated log file index, or 0 for the default log file.
+ */
+unsigned int log_file_index(void);
+
+/**
+ * Selects the log file to open on the next mount, such as the file restored
+ * from a checkpoint. Should be called before BIOS starts.
+ * @param index: rotated log file index, or 0 for the default log file
+ */
+void select_log_file(unsigned int index);
+
 #endif
\ No newline at end of file
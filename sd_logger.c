@@ -12,8 +12,16 @@
 /* Board Header file */
 #include "Board.h"
 
-#include "heartbeat_task.h"
+#include "config.h"
+#include "filter.h"
+#include "flash_log.h"
+#include "persist.h"
+#include "pipeline_wdt.h"
+#include "profile.h"
 #include "sd_card.h"
+#include "status_led.h"
+#include "supervisor.h"
+#include "timebase.h"
 #include "uart_console_task.h"
 #include "uart_logger_task.h"
 
@@ -23,14 +31,28 @@
 int main(void) {
     /* Call general board init*/
     Board_initGeneral();
+    // Start the uptime timebase and RTC first, so everything can timestamp.
+    timebase_prebios();
+    prof_init();
     Board_initUART(); // Done here since both the console and logger use it.
     uart_console_prebios();
-    // Enable the heartbeat task
     Board_initGPIO();
-    heartbeat_prebios();
+    status_led_prebios();
+    // Events are posted by the logger and SD card, so set them up first.
+    supervisor_prebios();
     uart_logger_prebios();
-    // Setup required pthread variables for the SD card.
+    // Config values are read on mount, and until then are the defaults.
+    config_prebios();
+    filter_prebios();
+    // The flash log's brown-out flush takes blocks from the log buffer.
+    flash_log_prebios();
+    // Setup the SD card mutex and SPI bus.
     sd_setup();
+    // Restore the checkpoint, and carry on with the log file it was writing.
+    persist_prebios();
+    select_log_file(persist_log_index());
+    // Start checking the pipeline once everything it checks is set up.
+    wdt_prebios();
     /* Start BIOS */
     BIOS_start();
     return (0);
@@ -0,0 +1,892 @@
+/**
+ * @file sd_writer.c
+ * Implements the task responsible for writing log blocks filled by the UART
+ * logger to the SD card log file, and syncing them so they are durable.
+ *
+ * The writer is the highest priority task, and also acts as the supervisor:
+ * it blocks on the supervisor events (see supervisor.h), and handles log
+ * blocks, mounts and unmounts, triggers, log rotation and the button as they
+ * are posted. The wait times out exactly when the next
+ * sync is due, so nothing is polled.
+ *
+ * When the console holds the SD card mutex, priority inheritance raises it
+ * to the writer's priority until the mutex is released.
+ *
+ * Each block is passed through the processing pipeline (see pipeline.h), and
+ * its output staged in OUT, which is written out when full and at the end of
+ * the block. While the SD card is unmounted, output is captured to the
+ * emergency flash log instead (see flash_log.h).
+ *
+ * SD card errors are recovered from by remounting the card, rather than
+ * aborting. The pipeline watchdog cuts the card's power if a write hangs,
+ * which makes it fail, and so also ends up here.
+ *
+ * Output from the pipeline comes a line at a time. A partial line held by
+ * the pipeline is written out under the same policy as unsynced data, so a
+ * prompt without a line ending still reaches the card. A run of repeated
+ * lines counted by the pipeline is written out once it is as old as
+ * unsynced data may be, but not when the line goes idle, as a slow run
+ * would then be cut into runs of one.
+ *
+ * Each move to a new log file is listed in the log index, with its reason,
+ * which includes boots of the target detected by the pipeline.
+ *
+ * Lines the pipeline classifies as errors are also staged in ERR_OUT, each
+ * prefixed with the log file and its arrival time, and appended to
+ * ERRORS_FILE on each sync. While the card is unmounted they wait in
+ * ERR_OUT, and lines that don't fit are counted, then noted in the file.
+ *
+ * A panic snapshot copies the log data from panic_before_kb before its
+ * trigger to panic_after_kb after it into a PANIC_NNNN.TXT file of its own,
+ * so the context of a crash can be read without copying the whole log. The
+ * data before the trigger is read back from the log file, so no RAM is
+ * spent on a history window. The copy starts once the data after the
+ * trigger was written, or the logged UART was silent for SNAPSHOT_IDLE_MS,
+ * as a panicked target often stops printing. It is made a chunk at a time,
+ * when no blocks are waiting, so it does not delay the logged data, and
+ * reads the log file in order, as seeking back in it is slow. A log
+ * rotation waits for the copy to finish, as it reads from the old file.
+ *
+ * The lifetime counters and the log file are checkpointed to the EEPROM
+ * (see persist.h) at most once a minute after a sync, and on rotation and
+ * unmount.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/knl/Task.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "filter.h"
+#include "flash_log.h"
+#include "latency.h"
+#include "log_buffer.h"
+#include "persist.h"
+#include "pipeline.h"
+#include "pipeline_wdt.h"
+#include "profile.h"
+#include "sd_card.h"
+#include "sd_writer.h"
+#include "status_led.h"
+#include "supervisor.h"
+#include "timebase.h"
+#include "uart_logger_task.h"
+
+/*
+ * Sync policy, set by the config (see config.h). Written data is synced to
+ * the SD card once no new blocks have arrived for CONFIG_SYNC_IDLE_MS, or
+ * once the oldest unsynced or held byte is CONFIG_SYNC_MAX_MS old, whichever
+ * is first. The log file is rotated after a sync once it reaches
+ * CONFIG_ROTATE_KB.
+ */
+// Time the SD card is left unpowered when recovering from an error.
+#define LOG_RECOVER_OFF_MS 100
+// Copies of lines at or above the errors level, see pipeline.h.
+#define ERRORS_FILE DRIVE_PREFIX "ERRORS.TXT"
+// Silence after which a panic snapshot is written without all the data
+// after its trigger.
+#define SNAPSHOT_IDLE_MS 2000
+
+// Writer state. Only accessed by the writer task.
+static bool MOUNTED = false;
+static bool UNSYNCED = false;
+// Set once the boot message is written, and while recovering from an error.
+static bool BOOTED = false;
+static bool RECOVERING = false;
+// Arrival time of the oldest unsynced data, and time of the last block or
+// write.
+static uint64_t UNSYNCED_SINCE = 0;
+static uint64_t LAST_ACTIVITY = 0;
+// Output staged for the SD card or flash log. If a write fails, the output
+// is held, and written after the card is remounted.
+static char OUT[LOG_BLOCK_SIZE];
+static int OUT_LEN = 0;
+static bool OUT_HELD = false;
+// Arrival time of the block being processed, and whether any of its output
+// was written to the SD card.
+static uint64_t BLOCK_ARRIVAL = 0;
+static bool BLOCK_WRITTEN = false;
+// Error lines staged for ERRORS_FILE, and the lines dropped as it was full.
+static char ERR_OUT[LOG_BLOCK_SIZE];
+static int ERR_OUT_LEN = 0;
+static uint32_t ERR_DROPPED = 0;
+// Panic snapshot waiting for the data after its trigger: the range of the
+// log file it copies, and its reason, or NULL if there is none.
+static const char *SNAPSHOT_REASON = NULL;
+static uint32_t SNAPSHOT_START;
+static uint32_t SNAPSHOT_END;
+static bool SNAPSHOT_COPYING = false;
+static uint32_t SNAPSHOT_COPIED;
+// Reason for a rotation waiting for the snapshot copy, or NULL.
+static const char *ROTATE_PENDING = NULL;
+// Set when a rotation failed, so the size limit does not retry it on every
+// sync. Cleared by a rotation or a mount.
+static bool ROTATE_FAILED = false;
+// Bytes captured to the flash log since the SD card was last mounted.
+static uint32_t CAPTURED = 0;
+// Published status, read by the status LEDs.
+static WriterStatus STATUS;
+
+static void handle_mount(void);
+static void handle_unmount(void);
+static void handle_blocks(void);
+static void process_block(LogBlock *block);
+static void output(const char *data, int len);
+static void flush_output(void);
+static void flush_pipeline(void);
+static void error_line(const char *data, int len, uint64_t arrival);
+static void flush_errors(void);
+static void pipeline_action(PipelineAction action, const char *reason);
+static void handle_trigger(void);
+static void handle_rotate(void);
+static void handle_filters(void);
+static void handle_panic(void);
+static void start_snapshot(const char *reason);
+static void begin_snapshot(void);
+static void copy_snapshot_chunk(void);
+static void end_snapshot(const char *problem);
+static void rotate_now(const char *reason);
+static void sync_data(void);
+static void recover_card(void);
+static UInt sync_timeout(void);
+static UInt snapshot_timeout(void);
+static bool rotate_due(void);
+
+/*
+ * Task entry for the SD writer. This task is created statically,
+ * see the "Task creation" section of the cfg file.
+ * @param arg0 unused
+ * @param arg1 unused
+ */
+void sd_writer_task_entry(UArg arg0, UArg arg1) {
+    UInt events, timeout;
+    pipeline_start(output, pipeline_action, error_line);
+    wdt_busy(WDT_STAGE_WRITER);
+    // Try to mount the SD card. On success, SUP_EVT_MOUNTED is posted.
+    attempt_sd_mount();
+    while (1) {
+        // Waiting for events is not a stall.
+        wdt_idle(WDT_STAGE_WRITER);
+        timeout = sync_timeout();
+        if (snapshot_timeout() < timeout) {
+            timeout = snapshot_timeout();
+        }
+        events = supervisor_pend(SUP_EVT_ALL, timeout);
+        wdt_busy(WDT_STAGE_WRITER);
+        if (events & SUP_EVT_UNMOUNTED) {
+            handle_unmount();
+        }
+        if ((events & SUP_EVT_MOUNTED) && sd_card_mounted()) {
+            handle_mount();
+        }
+        if (events & SUP_EVT_BLOCK) {
+            handle_blocks();
+        }
+        if (events & SUP_EVT_TRIGGER) {
+            handle_trigger();
+        }
+        if (events & SUP_EVT_ROTATE) {
+            handle_rotate();
+        }
+        if (events & SUP_EVT_FILTERS) {
+            handle_filters();
+        }
+        if (events & SUP_EVT_PANIC) {
+            handle_panic();
+        }
+        if (events & SUP_EVT_BUTTON) {
+            status_led_toggle_heartbeat();
+        }
+        // Sync if the line went idle, or the unsynced data is too old.
+        if ((UNSYNCED || pipeline_held(NULL) || pipeline_repeating(NULL)) &&
+            sync_timeout() == 0) {
+            flush_pipeline();
+            if (UNSYNCED) {
+                sync_data();
+            }
+            if (rotate_due()) {
+                rotate_now("size limit");
+            }
+        }
+        if (SNAPSHOT_REASON != NULL && !SNAPSHOT_COPYING &&
+            (snapshot_timeout() == 0 || (uint32_t)filesize() >= SNAPSHOT_END)) {
+            begin_snapshot();
+        }
+        // Copy a chunk of the snapshot, unless blocks are waiting.
+        if (SNAPSHOT_COPYING && log_buffer_pending() == 0) {
+            copy_snapshot_chunk();
+        }
+    }
+}
+
+/**
+ * Gets the published status of the writer. Safe to call from any context.
+ * @param status: filled with the current status.
+ */
+void sd_writer_status(WriterStatus *status) {
+    UInt key = Hwi_disable();
+    *status = STATUS;
+    Hwi_restore(key);
+}
+
+/**
+ * Handles the SD card being mounted. Writes the boot message on the first
+ * mount, a timestamp, then any output held over from before an unmount.
+ */
+static void handle_mount(void) {
+    char start_str[] = "\r\n--------UART Logger Boot---------\r\n";
+    char stall_buf[80];
+    StallRecord stall;
+    PersistRecord state;
+    const char *stage;
+    int values_set, rules;
+    System_printf("SD card mounted\n");
+    System_flush();
+    MOUNTED = true;
+    STATUS.mounted = true;
+    ROTATE_FAILED = false;
+    if (!BOOTED) {
+        // Write boot notification.
+        if (write_sd(start_str, sizeof(start_str) - 1) !=
+            sizeof(start_str) - 1) {
+            recover_card();
+            return;
+        }
+        BOOTED = true;
+        persist_state(&state);
+        write_record("Session %lu, %lu KB logged, %lu KB dropped in total",
+                     (unsigned long)state.session,
+                     (unsigned long)(state.bytes_logged / 1024),
+                     (unsigned long)(state.bytes_dropped / 1024));
+        // The file only grows between checkpoints, unless the card changed.
+        if (log_file_index() == persist_log_index() &&
+            (uint32_t)filesize() < persist_log_size()) {
+            write_record("Log file is shorter than at the last checkpoint "
+                         "(%lu bytes), was the card changed?",
+                         (unsigned long)persist_log_size());
+        }
+        // Log why the last boot ended, if the watchdog reset it.
+        if (wdt_take_stall(&stall)) {
+            wdt_format_stall(stall_buf, sizeof(stall_buf), &stall);
+            write_record("Watchdog reset: %s", stall_buf);
+        }
+    }
+    stage = wdt_take_card_cycle();
+    if (stage != NULL) {
+        write_record("Watchdog power cycled the SD card: %s stalled in SD "
+                     "card I/O", stage);
+    }
+    // The card may have been changed, so read its config on every mount.
+    values_set = config_load();
+    if (values_set > 0) {
+        write_record("Config: %d values set from %s", values_set,
+                     CONFIG_FILE);
+    }
+    rules = filter_load();
+    if (rules > 0) {
+        write_record("Filters: %d rules from %s", rules, FILTER_FILE);
+    }
+    if (RECOVERING) {
+        write_record("Remounted after SD card error, unsynced data was lost");
+    }
+    if (CAPTURED != 0) {
+        // Put the last partial page in flash, so it can be copied.
+        flash_log_flush();
+        write_record("%lu bytes captured to the flash log while unmounted, "
+                     "see \"flashlog\"",
+                     (unsigned long)CAPTURED);
+        CAPTURED = 0;
+    }
+    // Write a notification to the SD card that the logs just started.
+    if (write_timestamp() != 0) {
+        recover_card();
+        return;
+    }
+    RECOVERING = false;
+    if (OUT_HELD) {
+        OUT_HELD = false;
+        flush_output();
+    }
+}
+
+/**
+ * Handles the SD card being unmounted.
+ */
+static void handle_unmount(void) {
+    System_printf("SD card was unmounted\n");
+    System_flush();
+    MOUNTED = false;
+    STATUS.mounted = false;
+    // Unmounting syncs the file, but the time is not known.
+    latency_discard();
+    if (SNAPSHOT_REASON != NULL) {
+        System_printf("Panic snapshot dropped, SD card was unmounted\n");
+        System_flush();
+        SNAPSHOT_REASON = NULL;
+        SNAPSHOT_COPYING = false;
+    }
+    if (ROTATE_PENDING != NULL) {
+        System_printf("Rotation dropped, SD card was unmounted\n");
+        System_flush();
+        ROTATE_PENDING = NULL;
+    }
+    UNSYNCED = false;
+    persist_checkpoint();
+}
+
+/**
+ * Processes all committed blocks, writing their output to the SD card, or
+ * capturing it to the flash log if the card is unmounted.
+ */
+static void handle_blocks(void) {
+    LogBlock *block;
+    if (!MOUNTED && OUT_HELD) {
+        // The card was not remounted, so capture the held output.
+        OUT_HELD = false;
+        flush_output();
+    }
+    // While output is held, blocks wait in the buffer for the remount.
+    while (!OUT_HELD && (block = log_buffer_get_full(BIOS_NO_WAIT)) != NULL) {
+        process_block(block);
+    }
+}
+
+/**
+ * Forwards one block to the CLI, passes it through the pipeline, writes out
+ * its output, and releases it.
+ * @param block: block to process
+ */
+static void process_block(LogBlock *block) {
+    PROF_ENTER(PROF_WRITER_BLOCK);
+    BLOCK_ARRIVAL = block->first_arrival;
+    BLOCK_WRITTEN = false;
+    LAST_ACTIVITY = timebase_now();
+    /*
+     * The CLI sees the data as the target sent it, without the timestamps
+     * and records the pipeline adds, or the lines it drops and collapses.
+     */
+    forward_log_data(block->data, block->len);
+    pipeline_input(block);
+    flush_output();
+    if (BLOCK_WRITTEN) {
+        latency_sample(block->first_arrival);
+    }
+    wdt_checkin(WDT_STAGE_WRITER);
+    log_buffer_release(block);
+    PROF_EXIT(PROF_WRITER_BLOCK);
+}
+
+/**
+ * Pipeline sink. Stages output, writing it out each time OUT fills.
+ * @param data: output data
+ * @param len: length of data
+ */
+static void output(const char *data, int len) {
+    int n;
+    while (len > 0) {
+        if (OUT_LEN == sizeof(OUT)) {
+            /*
+             * If the output is held, this captures it to the flash log, as
+             * the card is now unmounted. Later output follows it there, so
+             * the order is kept.
+             */
+            OUT_HELD = false;
+            flush_output();
+        }
+        n = sizeof(OUT) - OUT_LEN;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(OUT + OUT_LEN, data, n);
+        OUT_LEN += n;
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * Writes the staged output to the SD card, or captures it to the flash log
+ * if the card is unmounted. If the write fails, the output is held, and the
+ * card is recovered.
+ */
+static void flush_output(void) {
+    int captured;
+    if (OUT_LEN == 0 || OUT_HELD) {
+        return;
+    }
+    if (!MOUNTED) {
+        // Output past the end of a full flash log is dropped.
+        captured = flash_log_write(OUT, OUT_LEN);
+        CAPTURED += captured;
+        persist_count_logged(captured);
+        if (captured < OUT_LEN) {
+            persist_count_dropped(OUT_LEN - captured);
+        }
+        OUT_LEN = 0;
+        return;
+    }
+    if (write_sd_profiled(OUT, OUT_LEN) != OUT_LEN) {
+        OUT_HELD = true;
+        PROF_ENTER(PROF_MOUNT_CHECK);
+        if (sd_card_mounted()) {
+            PROF_EXIT(PROF_MOUNT_CHECK);
+            recover_card();
+            return;
+        }
+        PROF_EXIT(PROF_MOUNT_CHECK);
+        // SUP_EVT_UNMOUNTED is pending, so stop writing.
+        MOUNTED = false;
+        STATUS.mounted = false;
+        return;
+    }
+    LAST_ACTIVITY = timebase_now();
+    STATUS.blocks_written++;
+    persist_count_logged(OUT_LEN);
+    OUT_LEN = 0;
+    BLOCK_WRITTEN = true;
+    if (!UNSYNCED) {
+        UNSYNCED = true;
+        UNSYNCED_SINCE = BLOCK_ARRIVAL;
+    }
+}
+
+/**
+ * Writes out a partial line held by the pipeline, along with all other
+ * staged output.
+ */
+static void flush_pipeline(void) {
+    pipeline_flush();
+    flush_output();
+}
+
+/**
+ * Pipeline errors sink. Stages a copy of an error line for ERRORS_FILE.
+ * @param data: line, or a piece of it
+ * @param len: length of data
+ * @param arrival: timebase value the line arrived at, or 0 for the rest of a
+ * line
+ */
+static void error_line(const char *data, int len, uint64_t arrival) {
+    char prefix[40];
+    uint64_t arrival_us = timebase_to_us(arrival);
+    int prefix_len = 0;
+    if (arrival != 0) {
+        // Drop the drive number from the file name.
+        prefix_len = snprintf(prefix, sizeof(prefix), "%s [%5lu.%06lu] ",
+                              log_file_name() + sizeof(DRIVE_PREFIX) - 1,
+                              (unsigned long)(arrival_us / 1000000),
+                              (unsigned long)(arrival_us % 1000000));
+    }
+    if (ERR_OUT_LEN + prefix_len + len > sizeof(ERR_OUT)) {
+        flush_errors();
+        if (ERR_OUT_LEN + prefix_len + len > sizeof(ERR_OUT)) {
+            ERR_DROPPED++;
+            return;
+        }
+    }
+    memcpy(ERR_OUT + ERR_OUT_LEN, prefix, prefix_len);
+    memcpy(ERR_OUT + ERR_OUT_LEN + prefix_len, data, len);
+    ERR_OUT_LEN += prefix_len + len;
+}
+
+/**
+ * Appends the staged error lines to ERRORS_FILE, if the card is mounted,
+ * noting any lines dropped before them.
+ */
+static void flush_errors(void) {
+    char note[48];
+    int len;
+    if (!MOUNTED || ERR_OUT_LEN == 0) {
+        return;
+    }
+    if (ERR_DROPPED != 0) {
+        len = snprintf(note, sizeof(note), "%lu error lines dropped\r\n",
+                       (unsigned long)ERR_DROPPED);
+        if (append_sd_file(ERRORS_FILE, note, len) == len) {
+            ERR_DROPPED = 0;
+        }
+    }
+    if (append_sd_file(ERRORS_FILE, ERR_OUT, ERR_OUT_LEN) != ERR_OUT_LEN) {
+        // Leave the lines staged. A card error also fails the next sync.
+        return;
+    }
+    ERR_OUT_LEN = 0;
+}
+
+/**
+ * Carries out an action requested by the pipeline, after writing out the
+ * output before it.
+ * @param action: action to carry out
+ * @param reason: reason for the action, or NULL
+ */
+static void pipeline_action(PipelineAction action, const char *reason) {
+    flush_output();
+    switch (action) {
+    case PIPE_ACT_SYNC:
+        if (UNSYNCED) {
+            sync_data();
+        }
+        break;
+    case PIPE_ACT_ROTATE:
+    case PIPE_ACT_SEGMENT:
+        rotate_now(reason);
+        break;
+    case PIPE_ACT_PANIC:
+        start_snapshot(reason);
+        break;
+    }
+}
+
+/**
+ * Writes a trigger marker to the SD card, and syncs it immediately.
+ */
+static void handle_trigger(void) {
+    char text[SUP_TRIGGER_MAXLEN];
+    supervisor_trigger_text(text);
+    if (!MOUNTED) {
+        System_printf("Trigger dropped, SD card is not mounted\n");
+        System_flush();
+        return;
+    }
+    // Write out data received before the trigger first.
+    handle_blocks();
+    flush_pipeline();
+    if (write_record("Trigger: %s", text) != 0) {
+        return;
+    }
+    UNSYNCED = true;
+    sync_data();
+}
+
+/**
+ * Moves logging to the next rotated log file.
+ */
+static void handle_rotate(void) {
+    // Data received before the rotation belongs in the old file.
+    handle_blocks();
+    flush_pipeline();
+    rotate_now("rotate command");
+}
+
+/**
+ * Reads the filter rules again, after writing out the data received before
+ * the request, so the new rules only apply to data after it.
+ */
+static void handle_filters(void) {
+    int rules;
+    if (!MOUNTED) {
+        System_printf("Filter reload dropped, SD card is not mounted\n");
+        System_flush();
+        return;
+    }
+    handle_blocks();
+    flush_pipeline();
+    rules = filter_load();
+    if (rules < 0) {
+        write_record("Filters: could not use %s, not filtering", FILTER_FILE);
+    } else {
+        write_record("Filters: %d rules from %s", rules, FILTER_FILE);
+    }
+}
+
+/**
+ * Starts a panic snapshot around now, after writing out the data received
+ * before the request.
+ */
+static void handle_panic(void) {
+    handle_blocks();
+    flush_pipeline();
+    start_snapshot("panic command");
+}
+
+/**
+ * Starts a panic snapshot at the end of the output so far. A trigger while
+ * a snapshot is waiting for its data is covered by it, so is ignored.
+ * @param reason: reason for the snapshot, a static string
+ */
+static void start_snapshot(const char *reason) {
+    uint32_t trigger, before;
+    if (!MOUNTED) {
+        System_printf("Panic snapshot dropped, SD card is not mounted\n");
+        System_flush();
+        return;
+    }
+    if (SNAPSHOT_REASON != NULL) {
+        return;
+    }
+    flush_output();
+    trigger = filesize();
+    before = config_get(CONFIG_PANIC_BEFORE_KB) * 1024;
+    SNAPSHOT_START = trigger > before ? trigger - before : 0;
+    SNAPSHOT_END = trigger + config_get(CONFIG_PANIC_AFTER_KB) * 1024;
+    SNAPSHOT_REASON = reason;
+}
+
+/**
+ * Starts copying the waiting panic snapshot to its file, up to the end of
+ * the data written so far.
+ */
+static void begin_snapshot(void) {
+    uint32_t size;
+    flush_output();
+    if (!MOUNTED) {
+        end_snapshot("SD card is not mounted");
+        return;
+    }
+    if (OUT_HELD) {
+        end_snapshot("output is held after a write error");
+        return;
+    }
+    if (create_log_snapshot(SNAPSHOT_START) != 0) {
+        end_snapshot("could not create its file");
+        return;
+    }
+    size = filesize();
+    if (SNAPSHOT_END > size) {
+        SNAPSHOT_END = size;
+    }
+    SNAPSHOT_COPYING = true;
+    SNAPSHOT_COPIED = 0;
+}
+
+/**
+ * Copies the next chunk of the panic snapshot to its file, and notes the
+ * file in the log once the copy is done.
+ */
+static void copy_snapshot_chunk(void) {
+    int copied;
+    flush_output();
+    if (!MOUNTED || OUT_HELD) {
+        end_snapshot("SD card write failed");
+        return;
+    }
+    // OUT is empty once flushed, so the copy is made through it.
+    copied = copy_log_snapshot(SNAPSHOT_END, OUT, sizeof(OUT));
+    wdt_checkin(WDT_STAGE_WRITER);
+    if (copied < 0) {
+        end_snapshot("copy failed");
+    } else if (copied == 0) {
+        end_snapshot(NULL);
+    } else {
+        SNAPSHOT_COPIED += copied;
+    }
+}
+
+/**
+ * Ends the panic snapshot, and notes how it went in the log. Then carries
+ * out a rotation that waited for the copy.
+ * @param problem: reason the snapshot was not written, or NULL if it was
+ */
+static void end_snapshot(const char *problem) {
+    const char *reason = SNAPSHOT_REASON;
+    const char *rotate = ROTATE_PENDING;
+    SNAPSHOT_REASON = NULL;
+    SNAPSHOT_COPYING = false;
+    ROTATE_PENDING = NULL;
+    close_log_snapshot();
+    if (!MOUNTED) {
+        System_printf("Panic snapshot dropped, %s\n", problem);
+        System_flush();
+    } else if (problem != NULL) {
+        write_record("Panic snapshot (%s) could not be written: %s", reason,
+                     problem);
+    } else {
+        // Drop the drive number from the file name.
+        write_record("Panic snapshot (%s): %s, %lu bytes", reason,
+                     snapshot_file_name() + sizeof(DRIVE_PREFIX) - 1,
+                     (unsigned long)SNAPSHOT_COPIED);
+    }
+    if (MOUNTED) {
+        UNSYNCED = true;
+        sync_data();
+    }
+    if (rotate != NULL) {
+        rotate_now(rotate);
+    }
+}
+
+/**
+ * Moves logging to the next rotated log file, after syncing the old one,
+ * and lists the new file in the log index. A panic snapshot copies from the
+ * old file, so while one is waiting or copying, its copy is started and the
+ * rotation waits for it to end. The blocks that arrive meanwhile are still
+ * written to the old file, a chunk of the copy at a time.
+ * @param reason: reason for the rotation, for the log and the index
+ */
+static void rotate_now(const char *reason) {
+    int index;
+    if (!MOUNTED) {
+        System_printf("Rotation dropped, SD card is not mounted\n");
+        System_flush();
+        return;
+    }
+    if (SNAPSHOT_REASON != NULL && !SNAPSHOT_COPYING) {
+        begin_snapshot();
+    }
+    if (SNAPSHOT_COPYING) {
+        // Rotations requested meanwhile are folded into the first.
+        if (ROTATE_PENDING == NULL) {
+            ROTATE_PENDING = reason;
+        }
+        return;
+    }
+    if (UNSYNCED) {
+        sync_data();
+    }
+    write_record("Log rotated: %s", reason);
+    index = rotate_log_file();
+    if (index < 0) {
+        System_printf("Log rotation failed\n");
+        System_flush();
+        ROTATE_FAILED = true;
+        // Fails if the old file could not be reopened either.
+        if (write_record("Log rotation failed, still logging here") != 0 &&
+            sd_card_mounted()) {
+            recover_card();
+        }
+        return;
+    }
+    ROTATE_FAILED = false;
+    System_printf("Logging to %s\n", log_file_name());
+    System_flush();
+    if (write_index_entry(reason) != 0) {
+        System_printf("Could not update the log index\n");
+        System_flush();
+    }
+    persist_checkpoint();
+    if (write_timestamp() != 0) {
+        recover_card();
+    }
+}
+
+/**
+ * Syncs written data to the SD card, and records its latency.
+ */
+static void sync_data(void) {
+    flush_errors();
+    if (sync_sd() == 0) {
+        latency_synced(timebase_now());
+        persist_checkpoint_if_due();
+    } else {
+        if (sd_card_mounted()) {
+            recover_card();
+        }
+        // The data was synced by an unmount, or lost with the card.
+        latency_discard();
+    }
+    UNSYNCED = false;
+}
+
+/**
+ * Recovers from an SD card error by power cycling and remounting the card.
+ * Blocks wait in the buffer until SUP_EVT_MOUNTED is handled. If the card
+ * fails again before a timestamp could be written after the remount, it is
+ * left unmounted, and can be remounted from the console.
+ */
+static void recover_card(void) {
+    MOUNTED = false;
+    STATUS.mounted = false;
+    // Posts SUP_EVT_UNMOUNTED, and leaves the card unpowered.
+    unmount_sd_card();
+    if (RECOVERING) {
+        System_printf("SD card failed again after remount, leaving it "
+                      "unmounted\n");
+        System_flush();
+        return;
+    }
+    System_printf("SD card error, remounting\n");
+    System_flush();
+    RECOVERING = true;
+    Task_sleep(LOG_RECOVER_OFF_MS);
+    // Posts SUP_EVT_MOUNTED if the card comes back.
+    attempt_sd_mount();
+}
+
+/**
+ * Gets the time until the next sync, or write of a held partial line or
+ * run of repeats, is due.
+ * @return clock ticks until the next sync, 0 if it is due now, or
+ * BIOS_WAIT_FOREVER if no data is waiting to be synced or written.
+ */
+static UInt sync_timeout(void) {
+    uint64_t now, oldest = UINT64_MAX, held_since, repeat_since;
+    uint64_t idle_deadline, age_deadline, deadline;
+    bool held = pipeline_held(&held_since);
+    bool repeating = pipeline_repeating(&repeat_since);
+    if (!UNSYNCED && !held && !repeating) {
+        return BIOS_WAIT_FOREVER;
+    }
+    if (UNSYNCED) {
+        oldest = UNSYNCED_SINCE;
+    }
+    if (held && held_since < oldest) {
+        oldest = held_since;
+    }
+    if (repeating && repeat_since < oldest) {
+        oldest = repeat_since;
+    }
+    now = timebase_now();
+    idle_deadline =
+        LAST_ACTIVITY +
+        ((uint64_t)timebase_freq() * config_get(CONFIG_SYNC_IDLE_MS)) / 1000;
+    age_deadline =
+        oldest +
+        ((uint64_t)timebase_freq() * config_get(CONFIG_SYNC_MAX_MS)) / 1000;
+    deadline = age_deadline;
+    if ((UNSYNCED || held) && idle_deadline < deadline) {
+        deadline = idle_deadline;
+    }
+    if (deadline <= now) {
+        return 0;
+    }
+    // Round up, so the wait does not end just before the deadline.
+    return (UInt)((timebase_to_us(deadline - now) + 999) / 1000);
+}
+
+/**
+ * Gets the time until a waiting panic snapshot is written, as the logged
+ * UART went silent, or its next chunk is copied.
+ * @return clock ticks until the snapshot is due, 0 if it is due now, or
+ * BIOS_WAIT_FOREVER if no snapshot is waiting, or blocks are waiting before
+ * the next chunk.
+ */
+static UInt snapshot_timeout(void) {
+    uint64_t now, deadline;
+    if (SNAPSHOT_REASON == NULL) {
+        return BIOS_WAIT_FOREVER;
+    }
+    if (SNAPSHOT_COPYING) {
+        // Blocks post SUP_EVT_BLOCK, and the copy carries on after them.
+        return log_buffer_pending() == 0 ? 0 : BIOS_WAIT_FOREVER;
+    }
+    now = timebase_now();
+    deadline =
+        LAST_ACTIVITY + ((uint64_t)timebase_freq() * SNAPSHOT_IDLE_MS) / 1000;
+    if (deadline <= now) {
+        return 0;
+    }
+    // Round up, so the wait does not end just before the deadline.
+    return (UInt)((timebase_to_us(deadline - now) + 999) / 1000);
+}
+
+/**
+ * Checks if the log file reached the configured rotation size.
+ * @return true if the log file should be rotated.
+ */
+static bool rotate_due(void) {
+    uint32_t rotate_kb = config_get(CONFIG_ROTATE_KB);
+    if (rotate_kb == 0 || !MOUNTED || ROTATE_FAILED) {
+        return false;
+    }
+    return (uint32_t)filesize() / 1024 >= rotate_kb;
+}
\ No newline at end of file
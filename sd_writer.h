@@ -0,0 +1,37 @@
+/**
+ * @file sd_writer.h
+ * Implements the task responsible for writing log blocks filled by the UART
+ * logger to the SD card log file, and syncing them so they are durable.
+ */
+
+#ifndef SD_WRITER_H
+#define SD_WRITER_H
+
+/* XDCtools Header files */
+#include <xdc/std.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    /*! true if the writer is writing to a mounted SD card */
+    bool mounted;
+    /*! number of blocks written to the SD card */
+    uint32_t blocks_written;
+} WriterStatus;
+
+/*
+ * Task entry for the SD writer. This task is created statically,
+ * see the "Task creation" section of the cfg file.
+ * @param arg0 unused
+ * @param arg1 unused
+ */
+void sd_writer_task_entry(UArg arg0, UArg arg1);
+
+/**
+ * Gets the published status of the writer. Safe to call from any context.
+ * @param status: filled with the current status.
+ */
+void sd_writer_status(WriterStatus *status);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+/**
+ * @file status_led.c
+ * Implements the status LED engine. See status_led.h for the LED patterns.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/Error.h>
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/knl/Clock.h>
+
+/* TI-RTOS drivers */
+#include <ti/drivers/GPIO.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Board Header file */
+#include "Board.h"
+
+#include "log_buffer.h"
+#include "sd_writer.h"
+#include "status_led.h"
+#include "uart_logger_task.h"
+
+// Period of the status clock, which is the shortest LED on or off time.
+#define STATUS_TICK_MS 50
+// Heartbeat LED toggle period.
+#define STATUS_HEARTBEAT_MS 1000
+// Buffer fill warning flash period.
+#define STATUS_FLASH_MS 200
+// Time the error LED stays on after an error.
+#define STATUS_ERROR_HOLD_MS 2000
+
+#define MS_TO_TICKS(ms) ((ms) / STATUS_TICK_MS)
+
+static bool HEARTBEAT_ENABLED = true;
+static Clock_Handle STATUS_CLOCK;
+
+static void status_clock_fxn(UArg arg);
+
+/**
+ * Sets up the status LED clock. Should be called before BIOS starts, after
+ * the GPIO driver is set up.
+ */
+void status_led_prebios(void) {
+    Error_Block eb;
+    Clock_Params clock_params;
+    Error_init(&eb);
+    Clock_Params_init(&clock_params);
+    clock_params.period = STATUS_TICK_MS;
+    clock_params.startFlag = TRUE;
+    STATUS_CLOCK =
+        Clock_create(status_clock_fxn, STATUS_TICK_MS, &clock_params, &eb);
+    if (STATUS_CLOCK == NULL) {
+        System_abort("Failed to create status LED clock\n");
+    }
+}
+
+/**
+ * Toggles whether the heartbeat LED blinks.
+ */
+void status_led_toggle_heartbeat(void) {
+    HEARTBEAT_ENABLED ^= true;
+    GPIO_write(Board_LED0, Board_LED_OFF);
+}
+
+/**
+ * Enables or disables the status LEDs. While disabled, all LEDs are off and
+ * the status clock is stopped, so it does not wake the core.
+ * @param enable: true to show the status on the LEDs, false to turn them off
+ */
+void status_led_enable(bool enable) {
+    if (enable) {
+        Clock_start(STATUS_CLOCK);
+        return;
+    }
+    Clock_stop(STATUS_CLOCK);
+    GPIO_write(Board_LED0, Board_LED_OFF);
+    GPIO_write(Board_LED1, Board_LED_OFF);
+    GPIO_write(Board_LED2, Board_LED_OFF);
+    GPIO_write(Board_WRITE_ACTIVITY_LED, Board_LED_OFF);
+}
+
+/**
+ * Checks if the status LEDs are enabled.
+ * @return true if the status is shown on the LEDs, false otherwise.
+ */
+bool status_led_enabled(void) { return Clock_isActive(STATUS_CLOCK); }
+
+/**
+ * Clock function for the status LEDs, run in Swi context every
+ * STATUS_TICK_MS. Compares the published counters with their values on the
+ * last tick, and updates the LEDs.
+ * @param arg unused
+ */
+static void status_clock_fxn(UArg arg) {
+    static uint32_t tick = 0, last_written = 0, last_dropped = 0;
+    static uint32_t error_ticks = 0;
+    static bool heartbeat_on = false;
+    IngestStats ingest;
+    WriterStatus writer;
+    bool busy, green;
+    tick++;
+    ingest_stats(&ingest);
+    sd_writer_status(&writer);
+    // Heartbeat.
+    if (HEARTBEAT_ENABLED && tick % MS_TO_TICKS(STATUS_HEARTBEAT_MS) == 0) {
+        heartbeat_on ^= true;
+        GPIO_write(Board_LED0, heartbeat_on ? Board_LED_ON : Board_LED_OFF);
+    }
+    // Write activity.
+    GPIO_write(Board_WRITE_ACTIVITY_LED, writer.blocks_written != last_written
+                                             ? Board_LED_ON
+                                             : Board_LED_OFF);
+    last_written = writer.blocks_written;
+    // Mount state and buffer fill.
+    busy = log_buffer_pending() > LOG_BLOCK_COUNT / 2;
+    green = writer.mounted &&
+            (!busy || (tick / MS_TO_TICKS(STATUS_FLASH_MS / 2)) % 2 == 0);
+    GPIO_write(Board_LED1, green ? Board_LED_ON : Board_LED_OFF);
+    // Errors.
+    if (ingest.dropped != last_dropped) {
+        error_ticks = MS_TO_TICKS(STATUS_ERROR_HOLD_MS);
+        last_dropped = ingest.dropped;
+    } else if (error_ticks > 0) {
+        error_ticks--;
+    }
+    GPIO_write(Board_LED2, error_ticks > 0 ? Board_LED_ON : Board_LED_OFF);
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+/**
+ * @file status_led.h
+ * Implements the status LED engine. A periodic Clock reads the counters
+ * published by the ingest path, log buffer and SD writer, and shows them as
+ * LED patterns. Nothing in the data path touches a GPIO.
+ *
+ * LED patterns:
+ * - Blue (heartbeat): toggles once a second while enabled. The button
+ *   enables and disables it.
+ * - Write activity: on for one tick after the writer wrote a block, so it
+ *   blinks at most STATUS_TICK_MS apart however fast data arrives.
+ * - Green (SD card): off while unmounted. On while mounted, flashing if more
+ *   than half the log blocks are waiting on the writer.
+ * - Red (error): on for STATUS_ERROR_HOLD_MS after data was dropped.
+ *
+ * Pins Required:
+ * PF1- Red LED
+ * PF2- Blue LED
+ * PF3- Green LED
+ * PF4- SD write activity LED
+ */
+
+#ifndef STATUS_LED_H
+#define STATUS_LED_H
+
+#include <stdbool.h>
+
+/**
+ * Sets up the status LED clock. Should be called before BIOS starts, after
+ * the GPIO driver is set up.
+ */
+void status_led_prebios(void);
+
+/**
+ * Toggles whether the heartbeat LED blinks.
+ */
+void status_led_toggle_heartbeat(void);
+
+/**
+ * Enables or disables the status LEDs. While disabled, all LEDs are off and
+ * the status clock is stopped, so it does not wake the core.
+ * @param enable: true to show the status on the LEDs, false to turn them off
+ */
+void status_led_enable(bool enable);
+
+/**
+ * Checks if the status LEDs are enabled.
+ * @return true if the status is shown on the LEDs, false otherwise.
+ */
+bool status_led_enabled(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+/**
+ * @file supervisor.c
+ * Implements the supervisor event flags, which the SD writer task blocks on.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/Error.h>
+#include <xdc/runtime/System.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/knl/Event.h>
+
+/* TI-RTOS drivers */
+#include <ti/drivers/GPIO.h>
+
+#include <string.h>
+
+/* Board Header file */
+#include "Board.h"
+
+#include "supervisor.h"
+#include "trace.h"
+
+static Event_Handle SUP_EVENT;
+// Pending trigger text. Only accessed with interrupts disabled.
+static char TRIGGER_TEXT[SUP_TRIGGER_MAXLEN];
+
+static void button_pressed(unsigned int index);
+
+/**
+ * Sets up the supervisor event flags, and button interrupt.
+ * Should be called before BIOS starts, and before any module that posts
+ * events is set up.
+ */
+void supervisor_prebios(void) {
+    Error_Block eb;
+    Error_init(&eb);
+    SUP_EVENT = Event_create(NULL, &eb);
+    if (SUP_EVENT == NULL) {
+        System_abort("Failed to create supervisor event\n");
+    }
+    // Install button callback.
+    GPIO_setCallback(Board_BUTTON1, button_pressed);
+    // Enable button interrupt.
+    GPIO_enableInt(Board_BUTTON1);
+}
+
+/**
+ * Gets the supervisor's event object, so that mailboxes and semaphores can
+ * post events implicitly.
+ * @return supervisor event handle.
+ */
+Event_Handle supervisor_event(void) { return SUP_EVENT; }
+
+/**
+ * Posts events to the supervisor. Safe to call from any context.
+ * @param events: mask of SUP_EVT_* events to post.
+ */
+void supervisor_post(UInt events) { Event_post(SUP_EVENT, events); }
+
+/**
+ * Waits for any of a set of events. Should only be called by the SD writer.
+ * @param mask: mask of SUP_EVT_* events to wait for.
+ * @param timeout: time to wait, in clock ticks, or BIOS_WAIT_FOREVER.
+ * @return mask of events that occurred, or 0 if the wait timed out.
+ */
+UInt supervisor_pend(UInt mask, UInt timeout) {
+    UInt events = Event_pend(SUP_EVENT, Event_Id_NONE, mask, timeout);
+    // Block events are frequent, so leave them out of the trace.
+    if (events & ~SUP_EVT_BLOCK) {
+        trace_event(TRACE_SUP_EVENT, events);
+    }
+    return events;
+}
+
+/**
+ * Requests a trigger marker in the log. If a trigger is already pending, its
+ * text is replaced.
+ * @param text: text of the marker. Truncated to SUP_TRIGGER_MAXLEN - 1.
+ */
+void supervisor_trigger(const char *text) {
+    UInt key = Hwi_disable();
+    strncpy(TRIGGER_TEXT, text, sizeof(TRIGGER_TEXT) - 1);
+    TRIGGER_TEXT[sizeof(TRIGGER_TEXT) - 1] = '\0';
+    Hwi_restore(key);
+    supervisor_post(SUP_EVT_TRIGGER);
+}
+
+/**
+ * Gets the text of the pending trigger marker.
+ * @param buf: buffer to copy the text to, of at least SUP_TRIGGER_MAXLEN.
+ */
+void supervisor_trigger_text(char *buf) {
+    UInt key = Hwi_disable();
+    memcpy(buf, TRIGGER_TEXT, sizeof(TRIGGER_TEXT));
+    Hwi_restore(key);
+}
+
+/**
+ * GPIO callback for the button, run in Hwi context.
+ * @param index unused
+ */
+static void button_pressed(unsigned int index) {
+    supervisor_post(SUP_EVT_BUTTON);
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+/**
+ * @file supervisor.h
+ * Implements the supervisor event flags, which the SD writer task blocks on.
+ * Every source of work for the writer posts an event here: committed log
+ * blocks, SD card mounts and unmounts, button presses, triggers, and log
+ * rotation requests. The writer handles all of them from a single
+ * Event_pend, rather than polling.
+ *
+ * Pins Required:
+ * PF0- Button (SW2), toggles the heartbeat LED
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+/* XDCtools Header files */
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/knl/Event.h>
+
+#include <stdbool.h>
+
+/* Supervisor events */
+// A log block was committed. Posted implicitly by the log buffer mailbox.
+#define SUP_EVT_BLOCK Event_Id_00
+// The SD card was mounted.
+#define SUP_EVT_MOUNTED Event_Id_01
+// The SD card was unmounted.
+#define SUP_EVT_UNMOUNTED Event_Id_02
+// The button was pressed.
+#define SUP_EVT_BUTTON Event_Id_03
+// A trigger marker was requested, see supervisor_trigger().
+#define SUP_EVT_TRIGGER Event_Id_04
+// Log rotation was requested.
+#define SUP_EVT_ROTATE Event_Id_05
+// Reloading the filter rules was requested.
+#define SUP_EVT_FILTERS Event_Id_06
+// A panic snapshot was requested.
+#define SUP_EVT_PANIC Event_Id_07
+#define SUP_EVT_ALL                                                            \
+    (SUP_EVT_BLOCK | SUP_EVT_MOUNTED | SUP_EVT_UNMOUNTED | SUP_EVT_BUTTON |   \
+     SUP_EVT_TRIGGER | SUP_EVT_ROTATE | SUP_EVT_FILTERS | SUP_EVT_PANIC)
+
+// Maximum length of a trigger marker's text, including the terminator.
+#define SUP_TRIGGER_MAXLEN 64
+
+/**
+ * Sets up the supervisor event flags, and button interrupt.
+ * Should be called before BIOS starts, and before any module that posts
+ * events is set up.
+ */
+void supervisor_prebios(void);
+
+/**
+ * Gets the supervisor's event object, so that mailboxes and semaphores can
+ * post events implicitly.
+ * @return supervisor event handle.
+ */
+Event_Handle supervisor_event(void);
+
+/**
+ * Posts events to the supervisor. Safe to call from any context.
+ * @param events: mask of SUP_EVT_* events to post.
+ */
+void supervisor_post(UInt events);
+
+/**
+ * Waits for any of a set of events. Should only be called by the SD writer.
+ * @param mask: mask of SUP_EVT_* events to wait for.
+ * @param timeout: time to wait, in clock ticks, or BIOS_WAIT_FOREVER.
+ * @return mask of events that occurred, or 0 if the wait timed out.
+ */
+UInt supervisor_pend(UInt mask, UInt timeout);
+
+/**
+ * Requests a trigger marker in the log. If a trigger is already pending, its
+ * text is replaced.
+ * @param text: text of the marker. Truncated to SUP_TRIGGER_MAXLEN - 1.
+ */
+void supervisor_trigger(const char *text);
+
+/**
+ * Gets the text of the pending trigger marker.
+ * @param buf: buffer to copy the text to, of at least SUP_TRIGGER_MAXLEN.
+ */
+void supervisor_trigger_text(char *buf);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,228 @@
+/**
+ * @file timebase.c
+ * Implements a 64 bit monotonic timebase, extended from the 32 bit XDC
+ * Timestamp counter, as well as the wall clock time kept by the hibernation
+ * module RTC.
+ *
+ * The 32 bit Timestamp counter runs at the CPU clock, and wraps in under a
+ * minute. The timebase counts the wraps, so uptime values never wrap.
+ * Reading the timebase only costs a few cycles, so it may be used from
+ * the ingest path.
+ */
+
+/* XDCtools Header files */
+#include <xdc/runtime/Error.h>
+#include <xdc/runtime/System.h>
+#include <xdc/runtime/Timestamp.h>
+#include <xdc/runtime/Types.h>
+#include <xdc/std.h>
+
+/* BIOS Header files */
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/knl/Clock.h>
+
+/* TivaWare driver files */
+#include <driverlib/hibernate.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Board header file */
+#include "Board.h"
+
+#include "timebase.h"
+
+/*
+ * Period to check the Timestamp counter for wraps at, in ms. Must be less
+ * than the wrap period of the counter (~53 seconds at 80MHz)
+ */
+#define TIMEBASE_POLL_MS 10000
+/*
+ * Hibernation module battery backed data word used to mark the RTC as set.
+ * The hibernation module keeps running through a reset, so the RTC stays
+ * valid until power is lost.
+ */
+#define HIB_DATA_RTC_VALID 0
+#define RTC_VALID_MAGIC 0x52544356 // "RTCV"
+// Number of battery backed data words in the hibernation module.
+#define HIB_DATA_WORDS 16
+
+// High word of timebase, and last value of the 32 bit counter.
+static volatile uint32_t TB_HIGH = 0;
+static volatile uint32_t TB_LAST = 0;
+static uint32_t TB_FREQ;
+
+static void timebase_poll(UArg arg);
+
+/**
+ * Sets up the timebase wrap tracking and the hibernation RTC.
+ * Should be called before BIOS starts.
+ */
+void timebase_prebios(void) {
+    Types_FreqHz freq;
+    Clock_Params clock_params;
+    Error_Block eb;
+    Timestamp_getFreq(&freq);
+    TB_FREQ = freq.lo;
+    /*
+     * Create a clock to poll the counter. The timebase can only detect a
+     * wrap when it is read, so make sure it is read at least once per wrap.
+     */
+    Error_init(&eb);
+    Clock_Params_init(&clock_params);
+    clock_params.period = TIMEBASE_POLL_MS;
+    clock_params.startFlag = true;
+    if (Clock_create(timebase_poll, TIMEBASE_POLL_MS, &clock_params, &eb) ==
+        NULL) {
+        System_abort("Failed to create timebase clock\n");
+    }
+    // Start the RTC.
+    Board_initHibernate();
+    System_printf("Timebase running at %lu Hz\n", TB_FREQ);
+    System_flush();
+}
+
+/**
+ * Gets the current value of the monotonic timebase. Safe to call from any
+ * context.
+ * @return uptime in timebase ticks.
+ */
+uint64_t timebase_now(void) {
+    UInt key;
+    uint32_t low, high;
+    // Interrupts must be disabled so the wrap check is atomic.
+    key = Hwi_disable();
+    low = Timestamp_get32();
+    if (low < TB_LAST) {
+        // Counter wrapped since the last read.
+        TB_HIGH++;
+    }
+    TB_LAST = low;
+    high = TB_HIGH;
+    Hwi_restore(key);
+    return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * Gets the frequency of the timebase.
+ * @return number of timebase ticks per second.
+ */
+uint32_t timebase_freq(void) { return TB_FREQ; }
+
+/**
+ * Converts a timebase tick count to microseconds.
+ * @param ticks: number of timebase ticks
+ * @return number of microseconds.
+ */
+uint64_t timebase_to_us(uint64_t ticks) {
+    // Split the conversion so the multiplication cannot overflow.
+    return (ticks / TB_FREQ) * 1000000 +
+           ((ticks % TB_FREQ) * 1000000) / TB_FREQ;
+}
+
+/**
+ * Gets the current uptime in microseconds.
+ * @return uptime in microseconds.
+ */
+uint64_t timebase_now_us(void) { return timebase_to_us(timebase_now()); }
+
+/**
+ * Sets the wall clock time kept by the RTC.
+ * @param seconds: seconds since the unix epoch (UTC).
+ */
+void rtc_set(uint32_t seconds) {
+    uint32_t magic = RTC_VALID_MAGIC;
+    HibernateRTCSet(seconds);
+    hib_data_set(HIB_DATA_RTC_VALID, &magic, 1);
+}
+
+/**
+ * Gets the wall clock time kept by the RTC.
+ * @param subsec: if not NULL, set to the subsecond count (1/32768 seconds).
+ * @return seconds since the unix epoch (UTC).
+ */
+uint32_t rtc_get(uint32_t *subsec) {
+    uint32_t seconds, ss;
+    /*
+     * The seconds and subseconds counter are separate registers, so reread
+     * if the seconds counter rolls over between the reads.
+     */
+    do {
+        seconds = HibernateRTCGet();
+        ss = HibernateRTCSSGet();
+    } while (seconds != HibernateRTCGet());
+    if (subsec != NULL) {
+        *subsec = ss;
+    }
+    return seconds;
+}
+
+/**
+ * Checks if the RTC has been set since it was last powered on.
+ * @return true if the wall clock time is valid, false otherwise.
+ */
+bool rtc_valid(void) {
+    uint32_t magic;
+    hib_data_get(HIB_DATA_RTC_VALID, &magic, 1);
+    return magic == RTC_VALID_MAGIC;
+}
+
+/**
+ * Reads words from the hibernation module's battery backed memory.
+ * @param first: index of the first word to read
+ * @param data: buffer to read the words into
+ * @param count: number of words to read
+ */
+void hib_data_get(int first, uint32_t *data, int count) {
+    uint32_t words[HIB_DATA_WORDS];
+    // The driverlib always reads from word 0.
+    HibernateDataGet(words, first + count);
+    memcpy(data, &words[first], count * sizeof(uint32_t));
+}
+
+/**
+ * Writes words to the hibernation module's battery backed memory, leaving
+ * the other words unchanged.
+ * @param first: index of the first word to write
+ * @param data: words to write
+ * @param count: number of words to write
+ */
+void hib_data_set(int first, const uint32_t *data, int count) {
+    uint32_t words[HIB_DATA_WORDS];
+    // The driverlib always writes from word 0, so keep the earlier words.
+    HibernateDataGet(words, first);
+    memcpy(&words[first], data, count * sizeof(uint32_t));
+    HibernateDataSet(words, first + count);
+}
+
+/**
+ * Formats the current wall clock time into a string, such as
+ * "2021-03-04 05:06:07.890 UTC". If the RTC has not been set, writes
+ * "wall time unset".
+ * @param buf: buffer to write string into
+ * @param len: length of buf in bytes
+ * @return number of characters written, as snprintf.
+ */
+int format_wall_time(char *buf, int len) {
+    uint32_t subsec;
+    time_t seconds;
+    struct tm tm;
+    if (!rtc_valid()) {
+        return snprintf(buf, len, "wall time unset");
+    }
+    seconds = rtc_get(&subsec);
+    gmtime_r(&seconds, &tm);
+    return snprintf(buf, len, "%04d-%02d-%02d %02d:%02d:%02d.%03lu UTC",
+                    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                    tm.tm_min, tm.tm_sec,
+                    (unsigned long)((subsec * 1000) / 32768));
+}
+
+/**
+ * Clock function, reads the timebase so counter wraps are never missed.
+ * @param arg: unused
+ */
+static void timebase_poll(UArg arg) { timebase_now(); }
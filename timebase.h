@@ -0,0 +1,103 @@
+/**
+ * @file timebase.h
+ * Implements a 64 bit monotonic timebase, extended from the 32 bit XDC
+ * Timestamp counter, as well as the wall clock time kept by the hibernation
+ * module RTC.
+ *
+ * The 32 bit Timestamp counter runs at the CPU clock, and wraps in under a
+ * minute. The timebase counts the wraps, so uptime values never wrap.
+ * Reading the timebase only costs a few cycles, so it may be used from
+ * the ingest path.
+ */
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Sets up the timebase wrap tracking and the hibernation RTC.
+ * Should be called before BIOS starts.
+ */
+void timebase_prebios(void);
+
+/**
+ * Gets the current value of the monotonic timebase. Safe to call from any
+ * context.
+ * @return uptime in timebase ticks.
+ */
+uint64_t timebase_now(void);
+
+/**
+ * Gets the frequency of the timebase.
+ * @return number of timebase ticks per second.
+ */
+uint32_t timebase_freq(void);
+
+/**
+ * Converts a timebase tick count to microseconds.
+ * @param ticks: number of timebase ticks
+ * @return number of microseconds.
+ */
+uint64_t timebase_to_us(uint64_t ticks);
+
+/**
+ * Gets the current uptime in microseconds.
+ * @return uptime in microseconds.
+ */
+uint64_t timebase_now_us(void);
+
+/**
+ * Sets the wall clock time kept by the RTC.
+ * @param seconds: seconds since the unix epoch (UTC).
+ */
+void rtc_set(uint32_t seconds);
+
+/**
+ * Gets the wall clock time kept by the RTC.
+ * @param subsec: if not NULL, set to the subsecond count (1/32768 seconds).
+ * @return seconds since the unix epoch (UTC).
+ */
+uint32_t rtc_get(uint32_t *subsec);
+
+/**
+ * Checks if the RTC has been set since it was last powered on.
+ * @return true if the wall clock time is valid, false otherwise.
+ */
+bool rtc_valid(void);
+
+/*
+ * Battery backed hibernation memory. Words in use:
+ * 0: RTC valid marker (timebase.c)
+ * 1-5: stall record (pipeline_wdt.c)
+ */
+
+/**
+ * Reads words from the hibernation module's battery backed memory.
+ * @param first: index of the first word to read
+ * @param data: buffer to read the words into
+ * @param count: number of words to read
+ */
+void hib_data_get(int first, uint32_t *data, int count);
+
+/**
+ * Writes words to the hibernation module's battery backed memory, leaving
+ * the other words unchanged.
+ * @param first: index of the first word to write
+ * @param data: words to write
+ * @param count: number of words to write
+ */
+void hib_data_set(int first, const uint32_t *data, int count);
+
+/**
+ * Formats the current wall clock time into a string, such as
+ * "2021-03-04 05:06:07.890 UTC". If the RTC has not been set, writes
+ * "wall time unset".
+ * @param buf: buffer to write string into
+ * @param len: length of buf in bytes
+ * @return number of characters written, as snprintf.
+ */
+int format_wall_time(char *buf, int len);
+
+#endif
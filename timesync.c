@@ -0,0 +1,150 @@
+/**
+ * @file timesync.c
+ * Implements clock synchronisation between the logger and a host, so captured
+ * data can be mapped to host time.
+ *
+ * The exchange is NTP style, and is driven by the host over the console with
+ * the "tsync" command (see timesync.h for the exchange format). Only one
+ * exchange may be outstanding at a time, and only one console is expected
+ * to run the exchange.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sd_card.h"
+#include "timesync.h"
+
+/*
+ * Number of past estimates used to compute drift. Drift is computed over
+ * the whole window, so a longer window gives a more stable value.
+ */
+#define TSYNC_WINDOW 8
+
+typedef struct {
+    /*! sequence number of the outstanding exchange */
+    uint32_t seq;
+    /*! local receive and send times of the exchange */
+    uint64_t t2_us;
+    uint64_t t3_us;
+    /*! set once t2 is recorded, cleared when the exchange completes */
+    bool pending;
+} SyncExchange;
+
+static SyncExchange EXCHANGE = {0, 0, 0, false};
+// Ring of past estimates, and index of the most recent.
+static TimeSyncResult HISTORY[TSYNC_WINDOW];
+static int HISTORY_IDX = 0;
+static int HISTORY_COUNT = 0;
+
+/**
+ * Records the local time a sync request was received at.
+ * @param seq: sequence number of the exchange
+ * @param t2_us: local uptime the request was received at, in microseconds
+ */
+void timesync_request(uint32_t seq, uint64_t t2_us) {
+    EXCHANGE.seq = seq;
+    EXCHANGE.t2_us = t2_us;
+    EXCHANGE.t3_us = t2_us;
+    EXCHANGE.pending = true;
+}
+
+/**
+ * Records the local time the sync reply was sent at.
+ * @param seq: sequence number of the exchange
+ * @param t3_us: local uptime the reply was sent at, in microseconds
+ */
+void timesync_reply(uint32_t seq, uint64_t t3_us) {
+    if (EXCHANGE.pending && EXCHANGE.seq == seq) {
+        EXCHANGE.t3_us = t3_us;
+    }
+}
+
+/**
+ * Completes a sync exchange with the host timestamps, updates the offset
+ * and drift estimate, and writes a sync record to the log.
+ * @param seq: sequence number of the exchange
+ * @param t1_us: host time the request was sent at, in microseconds
+ * @param t4_us: host time the reply was received at, in microseconds
+ * @param result: filled with the new estimate
+ * @return 0 on success, -1 if the exchange is unknown or invalid, or -2 if
+ * the estimate was made but the sync record could not be written.
+ */
+int timesync_complete(uint32_t seq, uint64_t t1_us, uint64_t t4_us,
+                      TimeSyncResult *result) {
+    const TimeSyncResult *oldest;
+    int64_t delay, local_span;
+    if (!EXCHANGE.pending || EXCHANGE.seq != seq) {
+        return -1;
+    }
+    EXCHANGE.pending = false;
+    // Round trip time, minus the time the logger spent handling the request.
+    delay = ((int64_t)(t4_us - t1_us)) -
+            ((int64_t)(EXCHANGE.t3_us - EXCHANGE.t2_us));
+    if (delay < 0) {
+        // Host timestamps are inconsistent, discard the exchange.
+        return -1;
+    }
+    result->seq = seq;
+    result->delay_us = delay;
+    // Estimate applies at the midpoint of the local handling time.
+    result->local_us = EXCHANGE.t2_us + (EXCHANGE.t3_us - EXCHANGE.t2_us) / 2;
+    /*
+     * Assuming a symmetric path, the offset is the mean of the offsets seen
+     * in each direction.
+     */
+    result->offset_us = (((int64_t)t1_us - (int64_t)EXCHANGE.t2_us) +
+                         ((int64_t)t4_us - (int64_t)EXCHANGE.t3_us)) /
+                        2;
+    /*
+     * Drift is the change in offset over the window, relative to the local
+     * time elapsed.
+     */
+    result->drift_ppb = 0;
+    if (HISTORY_COUNT > 0) {
+        if (HISTORY_COUNT == TSYNC_WINDOW) {
+            // Ring is full, the oldest entry is the one about to be replaced
+            oldest = &HISTORY[(HISTORY_IDX + 1) % TSYNC_WINDOW];
+        } else {
+            oldest = &HISTORY[0];
+        }
+        local_span = (int64_t)(result->local_us - oldest->local_us);
+        if (local_span > 0) {
+            result->drift_ppb =
+                (int32_t)(((result->offset_us - oldest->offset_us) *
+                           1000000000LL) /
+                          local_span);
+        }
+    }
+    // Add to history.
+    if (HISTORY_COUNT > 0) {
+        HISTORY_IDX = (HISTORY_IDX + 1) % TSYNC_WINDOW;
+    }
+    HISTORY[HISTORY_IDX] = *result;
+    if (HISTORY_COUNT < TSYNC_WINDOW) {
+        HISTORY_COUNT++;
+    }
+    // Record the estimate in the log, so post processing can use it.
+    if (write_record("Time sync: seq %lu, local %llu us, offset %lld us, "
+                     "delay %lld us, drift %ld ppb",
+                     (unsigned long)result->seq,
+                     (unsigned long long)result->local_us,
+                     (long long)result->offset_us, (long long)result->delay_us,
+                     (long)result->drift_ppb) != 0) {
+        return -2;
+    }
+    return 0;
+}
+
+/**
+ * Gets the most recent offset and drift estimate.
+ * @param result: filled with the estimate
+ * @return true if an estimate exists, false otherwise.
+ */
+bool timesync_latest(TimeSyncResult *result) {
+    if (HISTORY_COUNT == 0) {
+        return false;
+    }
+    *result = HISTORY[HISTORY_IDX];
+    return true;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file timesync.h
+ * Implements clock synchronisation between the logger and a host, so captured
+ * data can be mapped to host time.
+ *
+ * The exchange is NTP style, and is driven by the host over the console with
+ * the "tsync" command (see tools/timesync.py):
+ *   host: "tsync req <seq>"          host stamps t1 when the line is sent
+ *   logger: "!<seq> <t2> <t3>"       logger stamps t2 when the request is
+ *                                    handled, and t3 before writing the "!"
+ *   host: "tsync done <seq> <t1> <t4>"  host stamps t4 when "!" arrives
+ * Logger times are uptime in microseconds, host times are microseconds since
+ * the unix epoch. Once the exchange is complete the logger estimates the
+ * offset and drift between the clocks, and writes a sync record to the log.
+ */
+
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    /*! sequence number of the exchange */
+    uint32_t seq;
+    /*! local uptime the estimate applies at, in microseconds */
+    uint64_t local_us;
+    /*! host time minus local uptime, in microseconds */
+    int64_t offset_us;
+    /*! round trip delay of the exchange, in microseconds */
+    int64_t delay_us;
+    /*! drift of the host clock relative to the local clock, in ppb */
+    int32_t drift_ppb;
+} TimeSyncResult;
+
+/**
+ * Records the local time a sync request was received at.
+ * @param seq: sequence number of the exchange
+ * @param t2_us: local uptime the request was received at, in microseconds
+ */
+void timesync_request(uint32_t seq, uint64_t t2_us);
+
+/**
+ * Records the local time the sync reply was sent at.
+ * @param seq: sequence number of the exchange
+ * @param t3_us: local uptime the reply was sent at, in microseconds
+ */
+void timesync_reply(uint32_t seq, uint64_t t3_us);
+
+/**
+ * Completes a sync exchange with the host timestamps, updates the offset
+ * and drift estimate, and writes a sync record to the log.
+ * @param seq: sequence number of the exchange
+ * @param t1_us: host time the request was sent at, in microseconds
+ * @param t4_us: host time the reply was received at, in microseconds
+ * @param result: filled with the new estimate
+ * @return 0 on success, -1 if the exchange is unknown or invalid, or -2 if
+ * the estimate was made but the sync record could not be written.
+ */
+int timesync_complete(uint32_t seq, uint64_t t1_us, uint64_t t4_us,
+                      TimeSyncResult *result);
+
+/**
+ * Gets the most recent offset and drift estimate.
+ * @param result: filled with the estimate
+ * @return true if an estimate exists, false otherwise.
+ */
+bool timesync_latest(TimeSyncResult *result);
+
+#endif
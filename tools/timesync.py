@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""
+Runs the host side of the logger clock sync exchange over the logger console.
+
+Each exchange sends "tsync req <seq>", waits for the "!<seq> <t2> <t3>" reply,
+then sends "tsync done <seq> <t1> <t4>" with the host timestamps. The logger
+writes a sync record with the estimated offset and drift into its log:
+
+    -------Time sync: seq N, local L us, offset O us, delay D us, drift R ppb
+
+A logger uptime u (in microseconds) maps to host time (microseconds since the
+unix epoch) as:
+
+    host = u + O + (u - L) * R / 1e9
+
+using the sync record closest to u.
+
+Requires pyserial. Example:
+    tools/timesync.py /dev/ttyACM0 --interval 60
+"""
+
+import argparse
+import time
+
+import serial
+
+
+def host_us():
+    return time.time_ns() // 1000
+
+
+def exchange(port, seq, timeout):
+    """Runs one exchange. Returns the logger's response line, or None."""
+    port.reset_input_buffer()
+    port.write(("tsync req %d" % seq).encode())
+    port.flush()
+    # Stamp t1 as the line is submitted, so both directions are timed from
+    # a single character.
+    t1 = host_us()
+    port.write(b"\r")
+    port.flush()
+    deadline = time.monotonic() + timeout
+    # Skip the echoed command until the "!" marker arrives.
+    while time.monotonic() < deadline:
+        c = port.read(1)
+        if c == b"!":
+            t4 = host_us()
+            break
+    else:
+        return None
+    reply = port.readline().decode(errors="replace").split()
+    if len(reply) != 3 or int(reply[0]) != seq:
+        return None
+    port.write(("tsync done %d %d %d\r" % (seq, t1, t4)).encode())
+    port.flush()
+    # Skip the echoed command, return the logger's estimate.
+    port.readline()
+    return port.readline().decode(errors="replace").strip()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("device", help="logger console serial device")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--interval", type=float, default=60.0,
+                        help="seconds between exchanges")
+    parser.add_argument("--count", type=int, default=0,
+                        help="number of exchanges to run (0 runs forever)")
+    args = parser.parse_args()
+
+    with serial.Serial(args.device, args.baud, timeout=1) as port:
+        seq = 1
+        while args.count == 0 or seq <= args.count:
+            result = exchange(port, seq, timeout=2.0)
+            print("seq %d: %s" % (seq, result if result else "no response"))
+            seq += 1
+            time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    main()
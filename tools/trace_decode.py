@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""
+Renders a logger "trace dump" as a timeline.
+
+Capture the console output of "trace dump" to a file (or pipe it in), then:
+    tools/trace_decode.py dump.txt
+Any console text around the dump is ignored.
+"""
+
+import argparse
+import sys
+
+# Event names and argument formatters, in the same order as TraceEvent in
+# trace.h.
+EVENTS = {
+    1: ("uart_read", lambda a: "bytes=%d" % a),
+    2: ("sd_write_start", lambda a: "bytes=%d" % a),
+    3: ("sd_write_end", lambda a: "error" if a == 0xFFFF else "bytes=%d" % a),
+    4: ("sd_mount", lambda a: "ok" if a else "failed"),
+    5: ("sd_unmount", lambda a: ""),
+    6: ("forward_on", lambda a: ""),
+    7: ("forward_off", lambda a: ""),
+    8: ("timestamp", lambda a: ""),
+    9: ("sd_sync", lambda a: "error" if a else "ok"),
+    10: ("buf_fill", lambda a: "pending=%d" % a),
+    11: ("buf_drop", lambda a: "bytes=%d" % a),
+    12: ("sup_event", lambda a: "events=0x%02x" % a),
+    13: ("rotate", lambda a: "file=%d" % a),
+    14: ("uart_error", lambda a: "flags=0x%02x" % a),
+}
+
+
+def parse(lines):
+    """Returns (header, records) from a dump, records as (ts, event, arg)."""
+    header = None
+    records = []
+    for line in lines:
+        words = line.split()
+        if not words:
+            continue
+        if words[:2] == ["TRACE", "v1"]:
+            header = dict(zip(words[2::2], words[3::2]))
+            records = []
+        elif words[:2] == ["TRACE", "END"]:
+            break
+        elif header is not None:
+            for word in words:
+                records.append((int(word[0:8], 16), int(word[8:12], 16),
+                                int(word[12:16], 16)))
+    if header is None:
+        raise ValueError("no trace dump found")
+    return header, records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("dump", nargs="?", type=argparse.FileType("r"),
+                        default=sys.stdin, help="captured trace dump")
+    args = parser.parse_args()
+
+    header, records = parse(args.dump)
+    tick_us = (1 << int(header["shift"])) * 1e6 / int(header["freq"])
+    now = int(header["now"], 16)
+    if not records:
+        print("trace is empty")
+        return
+    # Timestamps are 32 bits, unwrap them relative to the first record.
+    first = records[0][0]
+    prev = 0
+    for ts, event, arg in records:
+        offset = (ts - first) & 0xFFFFFFFF
+        delta = offset - prev
+        prev = offset
+        name, fmt = EVENTS.get(event, ("event_%d" % event, lambda a: "%d" % a))
+        print("%14.3f ms  (+%10.3f)  %-16s %s" % (offset * tick_us / 1000,
+              delta * tick_us / 1000, name, fmt(arg)))
+    age = ((now - records[-1][0]) & 0xFFFFFFFF) * tick_us / 1000
+    print("last event %.3f ms before dump" % age)
+
+
+if __name__ == "__main__":
+    main()
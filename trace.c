@@ -0,0 +1,98 @@
+/**
+ * @file trace.c
+ * Implements a binary event trace ring, recording compact timestamped
+ * records of pipeline events. See trace.h for usage.
+ *
+ * Dump format: a header line, followed by records oldest first, four to a
+ * line. Each record is 16 hex digits: the timestamp (8), event (4) and
+ * argument (4).
+ *   TRACE v1 freq <timebase Hz> shift <TRACE_TS_SHIFT> now <ts> count <n>
+ *   <record> <record> <record> <record>
+ *   ...
+ *   TRACE END
+ */
+
+/* BIOS Header files */
+#include <ti/sysbios/hal/Hwi.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cli.h"
+#include "timebase.h"
+#include "trace.h"
+
+// Number of records in the ring. Must be a power of two.
+#define TRACE_LEN 128
+#define TRACE_RECORDS_PER_LINE 4
+
+static TraceRecord TRACE_RING[TRACE_LEN];
+// Total number of events recorded. Next record goes at TRACE_HEAD % TRACE_LEN
+static uint32_t TRACE_HEAD = 0;
+static volatile bool TRACE_PAUSED = false;
+
+/**
+ * Records an event in the trace ring. Safe to call from any context.
+ * @param event: event type
+ * @param arg: event specific argument
+ */
+void trace_event(TraceEvent event, uint16_t arg) {
+    UInt key;
+    TraceRecord *record;
+    if (TRACE_PAUSED) {
+        return;
+    }
+    key = Hwi_disable();
+    record = &TRACE_RING[TRACE_HEAD & (TRACE_LEN - 1)];
+    TRACE_HEAD++;
+    record->ts = (uint32_t)(timebase_now() >> TRACE_TS_SHIFT);
+    record->event = event;
+    record->arg = arg;
+    Hwi_restore(key);
+}
+
+/**
+ * Clears the trace ring.
+ */
+void trace_clear(void) {
+    UInt key = Hwi_disable();
+    TRACE_HEAD = 0;
+    Hwi_restore(key);
+}
+
+/**
+ * Gets the number of events recorded in the ring.
+ * @return number of events in the ring.
+ */
+int trace_count(void) {
+    return TRACE_HEAD > TRACE_LEN ? TRACE_LEN : (int)TRACE_HEAD;
+}
+
+/**
+ * Dumps the trace ring to the CLI, oldest event first. Tracing is paused
+ * while the dump runs.
+ * @param context: CLI context to dump to.
+ */
+void trace_dump(CLIContext *context) {
+    int i, count;
+    uint32_t start;
+    TraceRecord *record;
+    // Pause tracing, so records are not overwritten during the dump.
+    TRACE_PAUSED = true;
+    count = trace_count();
+    start = TRACE_HEAD - count;
+    cli_printf(context, "TRACE v1 freq %lu shift %d now %08lx count %d\r\n",
+               (unsigned long)timebase_freq(), TRACE_TS_SHIFT,
+               (unsigned long)(timebase_now() >> TRACE_TS_SHIFT), count);
+    for (i = 0; i < count; i++) {
+        record = &TRACE_RING[(start + i) & (TRACE_LEN - 1)];
+        cli_printf(context, "%08lx%04x%04x%s", (unsigned long)record->ts,
+                   record->event, record->arg,
+                   (i % TRACE_RECORDS_PER_LINE == TRACE_RECORDS_PER_LINE - 1 ||
+                    i == count - 1)
+                       ? "\r\n"
+                       : " ");
+    }
+    cli_printf(context, "TRACE END\r\n");
+    TRACE_PAUSED = false;
+}
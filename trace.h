@@ -0,0 +1,80 @@
+/**
+ * @file trace.h
+ * Implements a binary event trace ring, recording compact timestamped
+ * records of pipeline events. When capture loses data, the ring shows the
+ * sequence of events that led up to it.
+ *
+ * Recording an event only takes a few cycles, so events may be recorded from
+ * the hot paths, and from any context. The ring is dumped with "trace dump",
+ * and the dump can be rendered as a timeline with tools/trace_decode.py.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "cli.h"
+
+/**
+ * Trace event types. Values are part of the dump format, so add new events
+ * at the end, and add them to tools/trace_decode.py as well.
+ */
+typedef enum {
+    TRACE_UART_READ = 1,    // arg: bytes read from the logged UART
+    TRACE_SD_WRITE_START,   // arg: bytes being written to the SD card
+    TRACE_SD_WRITE_END,     // arg: bytes written, or 0xFFFF on error
+    TRACE_SD_MOUNT,         // arg: 1 if mount succeeded, 0 otherwise
+    TRACE_SD_UNMOUNT,       // arg: unused
+    TRACE_FORWARD_ON,       // arg: unused
+    TRACE_FORWARD_OFF,      // arg: unused
+    TRACE_TIMESTAMP,        // arg: unused
+    TRACE_SD_SYNC,          // arg: 0 on success, 1 on error
+    TRACE_BUF_FILL,         // arg: blocks waiting on the writer after commit
+    TRACE_BUF_DROP,         // arg: bytes dropped because no block was free
+    TRACE_SUP_EVENT,        // arg: supervisor events handled, see supervisor.h
+    TRACE_ROTATE,           // arg: index of the new log file
+    TRACE_UART_ERROR,       // arg: LOG_RXERR_* flags, see log_buffer.h
+} TraceEvent;
+
+typedef struct {
+    /*! timebase value at the event, shifted right by TRACE_TS_SHIFT */
+    uint32_t ts;
+    /*! event type, see TraceEvent */
+    uint16_t event;
+    /*! event specific argument */
+    uint16_t arg;
+} TraceRecord;
+
+/*
+ * Timebase ticks are shifted by this amount for trace timestamps. At 80MHz,
+ * this gives 0.8us resolution, and the timestamp wraps after ~57 minutes.
+ */
+#define TRACE_TS_SHIFT 6
+
+/**
+ * Records an event in the trace ring. Safe to call from any context.
+ * @param event: event type
+ * @param arg: event specific argument
+ */
+void trace_event(TraceEvent event, uint16_t arg);
+
+/**
+ * Clears the trace ring.
+ */
+void trace_clear(void);
+
+/**
+ * Gets the number of events recorded in the ring.
+ * @return number of events in the ring.
+ */
+int trace_count(void);
+
+/**
+ * Dumps the trace ring to the CLI, oldest event first. Tracing is paused
+ * while the dump runs.
+ * @param context: CLI context to dump to.
+ */
+void trace_dump(CLIContext *context);
+
+#endif
@@ -2,14 +2,19 @@
  * @file uart_console_task.c
  * Implements a UART console on the built in UART device, allowing for
  * a user to view and manipulate the state of the logger.
+ *
+ * Reads complete by callback, so a read waiting for input can also be woken
+ * to write out forwarded log data, which the SD writer only queues.
  */
 
 /* XDCtools Header files */
+#include <xdc/runtime/Error.h>
 #include <xdc/runtime/System.h>
 #include <xdc/std.h>
 
 /* BIOS Header files */
 #include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/knl/Event.h>
 #include <ti/sysbios/knl/Task.h>
 
 /* TI-RTOS Header files */
@@ -21,16 +26,25 @@
 #include "Board.h"
 
 #include "cli.h"
+#include "uart_logger_task.h"
 
 // UART configuration.
 #define BAUD_RATE 115200
 #define UART_DEV Board_UART0
+// Events a read waits for: the read completing, and forwarded log data.
+#define CONSOLE_EVT_READ Event_Id_00
+#define CONSOLE_EVT_FORWARD Event_Id_01
 
 static UART_Handle uart;
 static UART_Params params;
+static Event_Handle CONSOLE_EVENT;
+// Bytes read by the last read, set by its callback.
+static volatile size_t READ_COUNT;
 
 static int uart_read(char *in, int n);
 static int uart_write(char *out, int n);
+static void uart_wake(void);
+static void uart_read_done(UART_Handle handle, void *buf, size_t count);
 
 /*
  * PreOS Task for UART console. Sets up uart instance for data transmission,
@@ -38,6 +52,7 @@ static int uart_write(char *out, int n);
  * This code MUST be called before the BIOS is started.
  */
 void uart_console_prebios(void) {
+    Error_Block eb;
     /*
      * UART defaults to text mode, echo back characters, and return from read
      * after newline. Default 8 bits, one stop bit, no parity.
@@ -49,6 +64,13 @@ void uart_console_prebios(void) {
     params.readDataMode = UART_DATA_BINARY;
     params.writeDataMode = UART_DATA_BINARY;
     params.readEcho = UART_ECHO_OFF;
+    params.readMode = UART_MODE_CALLBACK;
+    params.readCallback = uart_read_done;
+    Error_init(&eb);
+    CONSOLE_EVENT = Event_create(NULL, &eb);
+    if (CONSOLE_EVENT == NULL) {
+        System_abort("Error creating the console event");
+    }
     uart = UART_open(UART_DEV, &params);
     if (uart == NULL) {
         System_abort("Error opening the UART device");
@@ -68,6 +90,7 @@ void uart_task_entry(UArg arg0, UArg arg1) {
     cli_context_init(&uart_context);
     uart_context.cli_read = uart_read;
     uart_context.cli_write = uart_write;
+    uart_context.cli_wake = uart_wake;
     start_cli(&uart_context); // Does not return.
 }
 
@@ -80,9 +103,37 @@ void uart_task_entry(UArg arg0, UArg arg1) {
 static int uart_write(char *out, int n) { return UART_write(uart, out, n); }
 
 /**
- * Read data from the UART device.
+ * Read data from the UART device. While waiting, writes out forwarded log
+ * data as it is queued.
  * @param in buffer to read data into. Must be "n" bytes or larger.
  * @param n number of bytes to read.
  * @return number of bytes read.
  */
-static int uart_read(char *in, int n) { return UART_read(uart, in, n); }
\ No newline at end of file
+static int uart_read(char *in, int n) {
+    UInt events;
+    UART_read(uart, in, n);
+    do {
+        // Data queued while no read was waiting is written out first.
+        forward_log_drain();
+        events = Event_pend(CONSOLE_EVENT, Event_Id_NONE,
+                            CONSOLE_EVT_READ | CONSOLE_EVT_FORWARD,
+                            BIOS_WAIT_FOREVER);
+    } while (!(events & CONSOLE_EVT_READ));
+    return READ_COUNT;
+}
+
+/**
+ * Wakes a read waiting for input, to write out forwarded log data.
+ */
+static void uart_wake(void) { Event_post(CONSOLE_EVENT, CONSOLE_EVT_FORWARD); }
+
+/**
+ * Called by the UART driver once a read completes, in Hwi or Swi context.
+ * @param handle: UART handle
+ * @param buf: buffer read into
+ * @param count: number of bytes read
+ */
+static void uart_read_done(UART_Handle handle, void *buf, size_t count) {
+    READ_COUNT = count;
+    Event_post(CONSOLE_EVENT, CONSOLE_EVT_READ);
+}
\ No newline at end of file
@@ -1,7 +1,32 @@
 /**
  * @file uart_logger.c
- * Implements the task responsible for reading data from a UART, and writing it
- * to an SD card log file.
+ * Implements the receive path for the UART being logged. Received data is
+ * placed directly into log blocks, which the SD writer task writes to an SD
+ * card log file. No task runs per byte received.
+ *
+ * Two receive paths are available, selected by LOG_UART_DMA:
+ * - uDMA (default): the uDMA controller moves data from the RX FIFO into two
+ *   blocks in ping-pong mode. The UART interrupt fires when a block completes,
+ *   and on the receive timeout, which fires when data below the burst size
+ *   sits in the FIFO while the line is idle. The timeout closes the partial
+ *   block. A periodic Clock closes partial blocks the timeout missed, as
+ *   happens when the data ended on a burst boundary. Once the line has been
+ *   silent for LOG_IDLE_STOP_MS, the Clock stops so the core can sleep, and
+ *   the falling edge of the next start bit on the RX pin restarts it.
+ * - Interrupt: a Hwi drains the RX FIFO on the FIFO level and receive
+ *   timeout interrupts. A block is committed when it fills, on the receive
+ *   timeout, or at the latest LOG_COMMIT_MS after its first byte arrived, by a
+ *   Clock function running in Swi context.
+ *
+ * UART receive errors (break, framing, parity and overrun) end the block
+ * being filled, and are flagged in it, so the writer records them after its
+ * data. Bytes received with a break, framing or parity error are discarded.
+ * With uDMA, the UART stops requesting transfers while an error interrupt is
+ * pending, so the byte in error stays in the RX FIFO for the Hwi to discard.
+ * On the interrupt path, errors that follow a block ended by errors are
+ * flagged in the next block without ending it, so a noisy line gives one
+ * record per block rather than one per error. Errors seen while no block is
+ * free are flagged in the next block.
  *
  * Pins Required:
  * PC6- UART RX
@@ -9,155 +34,802 @@
  */
 
 /* XDCtools Header files */
+#include <xdc/runtime/Error.h>
 #include <xdc/runtime/System.h>
+#include <xdc/runtime/Types.h>
 #include <xdc/std.h>
 
 /* BIOS Header files */
 #include <ti/sysbios/BIOS.h>
-#include <ti/sysbios/knl/Semaphore.h>
-#include <ti/sysbios/knl/Task.h>
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/knl/Clock.h>
 
 /* Pthread support */
 #include <ti/sysbios/posix/pthread.h>
 
-/* TI-RTOS Header files */
-#include <ti/drivers/UART.h>
+/* Driverlib Header files */
+#include <inc/hw_ints.h>
+#include <inc/hw_memmap.h>
+#include <inc/hw_types.h>
+#include <inc/hw_uart.h>
+#include <driverlib/gpio.h>
+#include <driverlib/uart.h>
+#include <driverlib/udma.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 
 /* Board header file */
 #include "Board.h"
 
 #include "cli.h"
-#include "sd_card.h"
+#include "config.h"
+#include "lock.h"
+#include "log_buffer.h"
+#include "pipeline_wdt.h"
+#include "power.h"
+#include "profile.h"
+#include "timebase.h"
+#include "trace.h"
+#include "uart_logger_task.h"
 
-// UART configuration.
-#define LOG_BAUD_RATE 115200
-#define UART_LOGDEV Board_UART3
+// Selects the uDMA receive path. Set to 0 for the interrupt driven path.
+#ifndef LOG_UART_DMA
+#define LOG_UART_DMA 1
+#endif
+
+/*
+ * UART configuration. The pins are configured by Board_initUART. The baud
+ * rate is set by the config (see config.h), up to 5 Mbaud (the system clock
+ * / 16).
+ */
+#define LOG_UART_BASE UART3_BASE
+#define LOG_UART_INT INT_UART3
+/*
+ * A partially filled block is committed at most LOG_COMMIT_MS after its first
+ * byte arrived (at most twice that with uDMA), so the writer is never further
+ * behind than this.
+ */
+#define LOG_COMMIT_MS 20
+// uDMA channel, and the burst size it moves data from the RX FIFO in.
+#define LOG_DMA_CHANNEL 16
+#define LOG_DMA_BURST 8
+// RX pin, watched for a start bit while the commit Clock is stopped.
+#define LOG_RX_PORT GPIO_PORTC_BASE
+#define LOG_RX_PIN GPIO_PIN_6
+#define LOG_RX_INT_PIN GPIO_INT_PIN_6
+#define LOG_RX_INT INT_GPIOC
+// Silence after which the uDMA commit Clock stops.
+#define LOG_IDLE_STOP_MS 200
+// UART error interrupts, and the error bits of a received byte in UARTDR.
+#define LOG_RX_ERROR_INTS                                                      \
+    (UART_INT_OE | UART_INT_BE | UART_INT_PE | UART_INT_FE)
+#define LOG_RX_ERROR_BITS (UART_DR_OE | UART_DR_BE | UART_DR_PE | UART_DR_FE)
+#define LOG_RX_ERROR_SHIFT 8
 
 // Protects access to log forwarding so only one CLI task at a time can use it.
-static pthread_mutex_t LOG_FORWARD_MUTEX;
+static Lock LOG_FORWARD_MUTEX;
 // Protects access to log forwarding related global variables.
-static pthread_mutex_t LOG_VAR_MUTEX;
+static Lock LOG_VAR_MUTEX;
 static CLIContext *CONTEXT;
 static bool FORWARD_UART_LOGS = false;
+// Filtered forwarding. The line is collected until it ends or FWD_LINE
+// fills, then forwarded or not, along with the rest of it.
+#define FORWARD_LINE_MAXLEN 128
+static bool FORWARD_FILTERED = false;
+static ForwardOptions FWD_OPTIONS;
+static char FWD_LINE[FORWARD_LINE_MAXLEN + 1];
+static int FWD_LEN = 0;
+static bool FWD_DECIDED = false;
+static bool FWD_PASS = false;
+// Matching lines seen, and for the rate limit, the start of the current
+// second, the lines forwarded in it and the lines suppressed since the last
+// notice.
+static uint32_t FWD_MATCHED;
+static uint64_t FWD_WINDOW;
+static uint32_t FWD_SENT;
+static uint32_t FWD_SUPPRESSED;
+// Forwarded data waiting for the console, which writes it out while it
+// waits for input, so the writer never waits on console output. FWD_HEAD
+// and FWD_TAIL count the bytes put in and taken out. Data that does not
+// fit is dropped, and counted in FWD_DROPPED.
+#define FORWARD_RING_SIZE 1024
+static char FWD_RING[FORWARD_RING_SIZE];
+static uint32_t FWD_HEAD = 0;
+static uint32_t FWD_TAIL = 0;
+static uint32_t FWD_DROPPED = 0;
+
+static Clock_Handle COMMIT_CLOCK;
+static IngestStats INGEST_STATS;
+// LOG_RXERR_* flags for errors seen while no block was free. Only accessed
+// with interrupts disabled.
+static uint8_t LOST_RX_ERRORS = 0;
+
+#if LOG_UART_DMA
+// uDMA control structure select values, indexed by DMA_ACTIVE.
+static const uint32_t DMA_SELECT[2] = {UDMA_PRI_SELECT, UDMA_ALT_SELECT};
+/*
+ * Blocks owned by the primary and alternate control structures, and which
+ * of them the controller is filling. NULL if no block was free. Only
+ * accessed with interrupts disabled.
+ */
+static LogBlock *DMA_BLOCKS[2];
+static int DMA_ACTIVE = 0;
+// Time data was first seen in the active block, or 0 if it has not been.
+static uint64_t DMA_SEEN = 0;
+// Timebase ticks taken to receive one byte.
+static uint32_t BYTE_TICKS;
+// Consecutive commit Clock runs that found the line silent.
+static int IDLE_RUNS = 0;
 
-static UART_Handle uart;
-static UART_Params params;
+static void dma_service(uint64_t now, bool close, uint8_t errors);
+static void dma_arm(int which);
+static void dma_commit(int which, uint16_t len, uint64_t now);
+static void rx_edge_arm(void);
+static void rx_edge_hwi(UArg arg);
+#else
+// Block being filled by the Hwi. Only accessed with interrupts disabled.
+static LogBlock *FILL_BLOCK = NULL;
+// Set when errors ended the last block, until a block ends without them.
+static bool ERROR_RUN = false;
+
+static bool start_fill_block(uint64_t now);
+static void commit_fill_block(void);
+#endif
+
+static void uart_rx_hwi(UArg arg);
+static void commit_clock_fxn(UArg arg);
+static void record_isr(uint64_t start);
+static void count_rx_errors(uint8_t errors);
+static void forward_piece(const char *data, int len, bool line_end);
+static bool forward_decide(void);
+static void forward_notice(void);
+static bool forward_put(const char *data, int len);
 
 /*
- * PreOS Task for UART logger. Sets up uart instance for data transmission,
+ * PreOS setup for UART logger. Sets up the UART and its interrupt,
  * This code MUST be called before the BIOS is started.
  */
 void uart_logger_prebios(void) {
-    /*
-     * UART defaults to text mode, echo back characters, and return from read
-     * after newline. Default 8 bits, one stop bit, no parity.
-     */
-    UART_Params_init(&params);
-    params.baudRate = LOG_BAUD_RATE;
-    params.readReturnMode = UART_RETURN_FULL;
-    // Do not do text manipulation on the data. CLI will handle this.
-    params.readDataMode = UART_DATA_BINARY;
-    params.writeDataMode = UART_DATA_BINARY;
-    params.readEcho = UART_ECHO_OFF;
-    uart = UART_open(UART_LOGDEV, &params);
-    if (uart == NULL) {
-        System_abort("Error opening the UART device");
-    }
+    Error_Block eb;
+    Hwi_Params hwi_params;
+    Clock_Params clock_params;
+    Types_FreqHz cpu_freq;
+    log_buffer_prebios();
     // Setup the CLI mutex.
-    if (pthread_mutex_init(&LOG_FORWARD_MUTEX, NULL) != 0) {
+    if (lock_init(&LOG_FORWARD_MUTEX, "LOG_FORWARD_MUTEX") != 0) {
         System_abort("Failed to create log forwarding mutex\n");
     }
     // Setup the variable mutex.
-    if (pthread_mutex_init(&LOG_VAR_MUTEX, NULL) != 0) {
+    if (lock_init(&LOG_VAR_MUTEX, "LOG_VAR_MUTEX") != 0) {
         System_abort("Failed to create log variable mutex\n");
     }
+    Error_init(&eb);
+    Clock_Params_init(&clock_params);
+#if LOG_UART_DMA
+    // Periodic clock, checking for partial blocks.
+    clock_params.period = LOG_COMMIT_MS;
+    clock_params.startFlag = TRUE;
+#else
+    // One shot clock, started when a block gets its first byte.
+    clock_params.period = 0;
+    clock_params.startFlag = FALSE;
+#endif
+    COMMIT_CLOCK =
+        Clock_create(commit_clock_fxn, LOG_COMMIT_MS, &clock_params, &eb);
+    if (COMMIT_CLOCK == NULL) {
+        System_abort("Failed to create log commit clock\n");
+    }
+    Hwi_Params_init(&hwi_params);
+    if (Hwi_create(LOG_UART_INT, uart_rx_hwi, &hwi_params, &eb) == NULL) {
+        System_abort("Failed to create logger UART Hwi\n");
+    }
+    // 8 bits, one stop bit, no parity.
+    BIOS_getCpuFreq(&cpu_freq);
+    UARTConfigSetExpClk(LOG_UART_BASE, cpu_freq.lo, config_get(CONFIG_BAUD),
+                        UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE |
+                            UART_CONFIG_PAR_NONE);
+    /*
+     * Request service when the RX FIFO is half full, leaving 8 bytes (~700us
+     * at 115200 baud) of headroom for interrupt or DMA latency.
+     */
+    UARTFIFOLevelSet(LOG_UART_BASE, UART_FIFO_TX4_8, UART_FIFO_RX4_8);
+    UARTFIFOEnable(LOG_UART_BASE);
+#if LOG_UART_DMA
+    // 10 bits per byte, with the start and stop bits.
+    BYTE_TICKS = (timebase_freq() * 10) / config_get(CONFIG_BAUD);
+    Board_initDMA();
+    uDMAChannelAssign(UDMA_CH16_UART3RX);
+    uDMAChannelAttributeDisable(LOG_DMA_CHANNEL, UDMA_ATTR_ALL);
+    /*
+     * Only transfer full bursts, so bytes at the end of a message stay in the
+     * FIFO and raise the receive timeout.
+     */
+    uDMAChannelAttributeEnable(LOG_DMA_CHANNEL, UDMA_ATTR_USEBURST);
+    uDMAChannelControlSet(LOG_DMA_CHANNEL | UDMA_PRI_SELECT,
+                          UDMA_SIZE_8 | UDMA_SRC_INC_NONE | UDMA_DST_INC_8 |
+                              UDMA_ARB_8);
+    uDMAChannelControlSet(LOG_DMA_CHANNEL | UDMA_ALT_SELECT,
+                          UDMA_SIZE_8 | UDMA_SRC_INC_NONE | UDMA_DST_INC_8 |
+                              UDMA_ARB_8);
+    dma_arm(0);
+    dma_arm(1);
+    uDMAChannelEnable(LOG_DMA_CHANNEL);
+    // Stop requests on an error, so the Hwi can discard the byte in error.
+    UARTDMAEnable(LOG_UART_BASE, UART_DMA_RX | UART_DMA_ERR_RXSTOP);
+    // Block completion raises the UART interrupt, so only add the timeout.
+    UARTIntClear(LOG_UART_BASE, UART_INT_RT | LOG_RX_ERROR_INTS);
+    UARTIntEnable(LOG_UART_BASE, UART_INT_RT | LOG_RX_ERROR_INTS);
+    /*
+     * The edge detector samples the pin while it is in its UART function, so
+     * it sees start bits. It is only enabled while the commit Clock is
+     * stopped.
+     */
+    GPIOIntDisable(LOG_RX_PORT, LOG_RX_INT_PIN);
+    GPIOIntTypeSet(LOG_RX_PORT, LOG_RX_PIN, GPIO_FALLING_EDGE);
+    if (Hwi_create(LOG_RX_INT, rx_edge_hwi, &hwi_params, &eb) == NULL) {
+        System_abort("Failed to create logger RX edge Hwi\n");
+    }
+#else
+    UARTIntClear(LOG_UART_BASE,
+                 UART_INT_RX | UART_INT_RT | LOG_RX_ERROR_INTS);
+    UARTIntEnable(LOG_UART_BASE,
+                  UART_INT_RX | UART_INT_RT | LOG_RX_ERROR_INTS);
+#endif
+    UARTEnable(LOG_UART_BASE);
     System_printf("Setup UART Logger\n");
     System_flush();
 }
 
-/*
- * Task entry for the UART logger. This task is created statically,
- * see the "Task creation" section of the cfg file.
- * @param arg0 unused
- * @param arg1 unused
- */
-void uart_logger_task_entry(UArg arg0, UArg arg1) {
-    char read_char;
-    char start_str[] = "\r\n--------UART Logger Boot---------\r\n";
+#if LOG_UART_DMA
+
+/**
+ * Hwi for the logged UART. Commits completed blocks, and on a receive timeout
+ * or a receive error closes the partial block.
+ * @param arg unused
+ */
+static void uart_rx_hwi(UArg arg) {
+    uint32_t status;
+    uint64_t now;
+    uint8_t errors = 0;
+    PROF_ENTER(PROF_UART_ISR);
+    now = timebase_now();
+    status = UARTIntStatus(LOG_UART_BASE, true);
+    // Clearing an error restarts the transfers, so wait until it is drained.
+    UARTIntClear(LOG_UART_BASE, status & ~LOG_RX_ERROR_INTS);
+    if (status & LOG_RX_ERROR_INTS) {
+        errors = ((status & UART_INT_FE) ? LOG_RXERR_FRAMING : 0) |
+                 ((status & UART_INT_PE) ? LOG_RXERR_PARITY : 0) |
+                 ((status & UART_INT_BE) ? LOG_RXERR_BREAK : 0) |
+                 ((status & UART_INT_OE) ? LOG_RXERR_OVERRUN : 0);
+    }
+    dma_service(now, (status & (UART_INT_RT | LOG_RX_ERROR_INTS)) != 0,
+                errors);
+    UARTIntClear(LOG_UART_BASE, status & LOG_RX_ERROR_INTS);
+    record_isr(now);
+    PROF_EXIT(PROF_UART_ISR);
+}
+
+/**
+ * Clock function, run in Swi context every LOG_COMMIT_MS. Notes when data
+ * first shows up in the active block, and closes it if it still holds
+ * partial data on the next run. Stops itself once the line is silent.
+ * @param arg unused
+ */
+static void commit_clock_fxn(UArg arg) {
+    static uint32_t last_blocks = 0;
+    LogBlock *block;
+    uint64_t now = timebase_now();
+    bool partial;
+    UInt key = Hwi_disable();
     /*
-     * Try to mount the SD card, and if it fails wait for the sd_ready
-     * condition.
+     * Forget old edges before checking for data, so an edge latched after
+     * the check wakes the receive path if the Clock stops below.
      */
-    if (!attempt_sd_mount()) {
-        // Wait for the SD card to be ready and mounted.
-        wait_sd_ready();
+    GPIOIntClear(LOG_RX_PORT, LOG_RX_INT_PIN);
+    block = DMA_BLOCKS[DMA_ACTIVE];
+    partial = (block != NULL &&
+               uDMAChannelSizeGet(LOG_DMA_CHANNEL | DMA_SELECT[DMA_ACTIVE]) !=
+                   LOG_BLOCK_SIZE) ||
+              UARTCharsAvail(LOG_UART_BASE);
+    if (partial && DMA_SEEN == 0) {
+        DMA_SEEN = now;
+        // The data must now be committed within the watchdog limit.
+        wdt_busy(WDT_STAGE_INGEST);
+    } else {
+        // Also rearms structures left without a block.
+        dma_service(now, partial, 0);
     }
-    // Write boot notification.
-    if (write_sd(start_str, sizeof(start_str) - 1) != sizeof(start_str) - 1) {
-        System_abort("Could not write start message to SD card");
+    if (partial || INGEST_STATS.blocks != last_blocks) {
+        IDLE_RUNS = 0;
+        last_blocks = INGEST_STATS.blocks;
+    } else if (++IDLE_RUNS >= LOG_IDLE_STOP_MS / LOG_COMMIT_MS) {
+        rx_edge_arm();
     }
-    while (1) {
-        /**
-         * Write to the SD card until it is unmounted
-         */
-        System_printf("SD card mounted\n");
-        System_flush();
-        // Write a notification to the SD card that the logs just started.
-        if (write_timestamp() != 0) {
-            System_abort("Could not write timestamp to SD card");
-        }
-        // Now, try to read data from the UART connection.
-        while (1) {
-            // Read data from the UART.
-            UART_read(uart, &read_char, 1);
-            if (sd_card_mounted()) {
-                // Write data out to the SD card.
-                if (write_sd(&read_char, 1) != 1) {
-                    System_abort("SD card write error");
-                }
-                // Attempt to lock the log forwarding variable mutex.
-                if (pthread_mutex_lock(&LOG_VAR_MUTEX) != 0) {
-                    System_abort("Could not lock access to log variables");
-                }
-                // If log forwarding was requested, write to the CLI.
-                if (FORWARD_UART_LOGS) {
-                    CONTEXT->cli_write(&read_char, 1);
+    Hwi_restore(key);
+}
+
+/**
+ * Stops the commit Clock, and enables the RX edge interrupt to restart it.
+ * Must be called with interrupts disabled, while the active block and the
+ * RX FIFO are empty.
+ */
+static void rx_edge_arm(void) {
+    Clock_stop(COMMIT_CLOCK);
+    IDLE_RUNS = 0;
+    // An edge latched since the last clear raises the interrupt right away.
+    GPIOIntEnable(LOG_RX_PORT, LOG_RX_INT_PIN);
+}
+
+/**
+ * Hwi for a start bit on the logged UART's RX pin, while the commit Clock is
+ * stopped. The UART receives the byte itself, so this only restarts the
+ * Clock.
+ * @param arg unused
+ */
+static void rx_edge_hwi(UArg arg) {
+    GPIOIntDisable(LOG_RX_PORT, LOG_RX_INT_PIN);
+    GPIOIntClear(LOG_RX_PORT, LOG_RX_INT_PIN);
+    power_rx_wake();
+    Clock_start(COMMIT_CLOCK);
+}
+
+/**
+ * Commits completed blocks, and rearms the control structures. Must be
+ * called from the Hwi, or with interrupts disabled.
+ * @param now: current timebase value
+ * @param close: if true, also close the active block, along with any data
+ * left in the RX FIFO.
+ * @param errors: LOG_RXERR_* flags for receive errors to flag in the closed
+ * block
+ */
+static void dma_service(uint64_t now, bool close, uint8_t errors) {
+    uint32_t sel, data;
+    uint16_t len;
+    int drained = 0, dropped = 0;
+    LogBlock *block;
+    if (close) {
+        // Stop the controller, so the active block stops changing.
+        uDMAChannelDisable(LOG_DMA_CHANNEL);
+    }
+    // Control structures complete in order, starting with the active one.
+    while (DMA_BLOCKS[DMA_ACTIVE] != NULL &&
+           uDMAChannelModeGet(LOG_DMA_CHANNEL | DMA_SELECT[DMA_ACTIVE]) ==
+               UDMA_MODE_STOP) {
+        drained += LOG_BLOCK_SIZE;
+        dma_commit(DMA_ACTIVE, LOG_BLOCK_SIZE, now);
+        DMA_ACTIVE ^= 1;
+    }
+    if (close) {
+        block = DMA_BLOCKS[DMA_ACTIVE];
+        sel = LOG_DMA_CHANNEL | DMA_SELECT[DMA_ACTIVE];
+        len = block ? LOG_BLOCK_SIZE - uDMAChannelSizeGet(sel) : 0;
+        drained += len;
+        // Move the bytes below the burst size out of the FIFO.
+        while (UARTCharsAvail(LOG_UART_BASE)) {
+            data = HWREG(LOG_UART_BASE + UART_O_DR);
+            if (data & LOG_RX_ERROR_BITS) {
+                errors |= (data & LOG_RX_ERROR_BITS) >> LOG_RX_ERROR_SHIFT;
+                if ((data & LOG_RX_ERROR_BITS) != UART_DR_OE) {
+                    // Discard the byte received in error.
+                    continue;
                 }
-                // Drop the lock on log forwarding vars.
-                pthread_mutex_unlock(&LOG_VAR_MUTEX);
+            }
+            if (block != NULL && len < LOG_BLOCK_SIZE) {
+                block->data[len++] = (char)(data & UART_DR_DATA_M);
+                drained++;
+            } else {
+                dropped++;
+            }
+        }
+        if (errors != 0) {
+            count_rx_errors(errors);
+            if (block != NULL) {
+                block->rx_errors |= errors;
+            } else {
+                LOST_RX_ERRORS |= errors;
+            }
+        }
+        if (len != 0 || (block != NULL && block->rx_errors != 0)) {
+            // Committing rearms the structure, so the controller resumes on it.
+            dma_commit(DMA_ACTIVE, len, now);
+        }
+    }
+    // Retry structures left without a block, as blocks may have been freed.
+    if (DMA_BLOCKS[DMA_ACTIVE] == NULL) {
+        dma_arm(DMA_ACTIVE);
+    }
+    if (DMA_BLOCKS[DMA_ACTIVE ^ 1] == NULL) {
+        dma_arm(DMA_ACTIVE ^ 1);
+    }
+    // The controller stops when it reaches a structure without a block.
+    if (DMA_BLOCKS[DMA_ACTIVE] != NULL) {
+        uDMAChannelEnable(LOG_DMA_CHANNEL);
+    }
+    if (drained) {
+        trace_event(TRACE_UART_READ, drained > 0xFFFF ? 0xFFFF : drained);
+    }
+    if (DMA_SEEN == 0) {
+        wdt_idle(WDT_STAGE_INGEST);
+    }
+    if (dropped) {
+        INGEST_STATS.dropped += dropped;
+        trace_event(TRACE_BUF_DROP, dropped);
+        // Dropping data when the writer falls behind still empties the FIFO.
+        wdt_checkin(WDT_STAGE_INGEST);
+    }
+}
+
+/**
+ * Gives a control structure a free block to fill, if one is available.
+ * @param which: 0 for the primary control structure, 1 for the alternate
+ */
+static void dma_arm(int which) {
+    LogBlock *block = log_buffer_get_free();
+    DMA_BLOCKS[which] = block;
+    if (block == NULL) {
+        return;
+    }
+    uDMAChannelTransferSet(LOG_DMA_CHANNEL | DMA_SELECT[which],
+                           UDMA_MODE_PINGPONG,
+                           (void *)(LOG_UART_BASE + UART_O_DR), block->data,
+                           LOG_BLOCK_SIZE);
+}
+
+/**
+ * Commits the block of a control structure to the writer, and rearms the
+ * structure.
+ * @param which: 0 for the primary control structure, 1 for the alternate
+ * @param len: number of bytes in the block
+ * @param now: current timebase value
+ */
+static void dma_commit(int which, uint16_t len, uint64_t now) {
+    LogBlock *block = DMA_BLOCKS[which];
+    uint64_t earliest = now - (uint64_t)BYTE_TICKS * len;
+    block->len = len;
+    /*
+     * Bytes are not timestamped as they arrive. Use the earlier of the time
+     * data was first seen in the block by the Clock, and the time the block
+     * would have started at the line rate.
+     */
+    block->first_arrival =
+        (DMA_SEEN != 0 && DMA_SEEN < earliest) ? DMA_SEEN : earliest;
+    DMA_SEEN = 0;
+    block->rx_errors |= LOST_RX_ERRORS;
+    LOST_RX_ERRORS = 0;
+    wdt_checkin(WDT_STAGE_INGEST);
+    log_buffer_commit(block);
+    INGEST_STATS.blocks++;
+    INGEST_STATS.bytes += len;
+    dma_arm(which);
+}
+
+#else
+
+/**
+ * Hwi for the logged UART. Drains the RX FIFO into the fill block.
+ * @param arg unused
+ */
+static void uart_rx_hwi(UArg arg) {
+    uint32_t status, data;
+    uint64_t now;
+    uint8_t errors;
+    int drained = 0, dropped = 0;
+    PROF_ENTER(PROF_UART_ISR);
+    now = timebase_now();
+    status = UARTIntStatus(LOG_UART_BASE, true);
+    UARTIntClear(LOG_UART_BASE, status);
+    while (UARTCharsAvail(LOG_UART_BASE)) {
+        data = HWREG(LOG_UART_BASE + UART_O_DR);
+        errors = (data & LOG_RX_ERROR_BITS) >> LOG_RX_ERROR_SHIFT;
+        if (errors != 0) {
+            count_rx_errors(errors);
+            // Flag the errors after the data so far, in a block of their own
+            // if there is none.
+            if (FILL_BLOCK != NULL || start_fill_block(now)) {
+                FILL_BLOCK->rx_errors |= errors;
             } else {
-                System_printf("SD card was unmounted\n");
-                System_flush();
-                // Exit loop.
-                break;
+                LOST_RX_ERRORS |= errors;
+            }
+            if (errors != LOG_RXERR_OVERRUN) {
+                // Discard the byte received in error.
+                continue;
             }
         }
-        // Wait for SD card to be remounted.
-        wait_sd_ready();
+        if (FILL_BLOCK != NULL && FILL_BLOCK->rx_errors != 0 && !ERROR_RUN) {
+            // The errors end the block, so they are recorded before this
+            // byte. Errors after them stay in the next block until it ends.
+            commit_fill_block();
+            ERROR_RUN = true;
+        }
+        if (FILL_BLOCK == NULL && !start_fill_block(now)) {
+            // All blocks are waiting on the writer, so drop the byte.
+            dropped++;
+            continue;
+        }
+        FILL_BLOCK->data[FILL_BLOCK->len++] = (char)(data & UART_DR_DATA_M);
+        drained++;
+        if (FILL_BLOCK->len == LOG_BLOCK_SIZE) {
+            commit_fill_block();
+        }
+    }
+    // A receive timeout means the line is idle, so pass the data on now.
+    if ((status & UART_INT_RT) && FILL_BLOCK != NULL) {
+        commit_fill_block();
+    }
+    // An error-only interrupt drains nothing, so is not traced.
+    if (drained) {
+        trace_event(TRACE_UART_READ, drained);
+    }
+    if (dropped) {
+        INGEST_STATS.dropped += dropped;
+        trace_event(TRACE_BUF_DROP, dropped);
+    }
+    record_isr(now);
+    PROF_EXIT(PROF_UART_ISR);
+}
+
+/**
+ * Clock function, run in Swi context LOG_COMMIT_MS after a block got its
+ * first byte. Commits the block if the Hwi has not already done so.
+ * @param arg unused
+ */
+static void commit_clock_fxn(UArg arg) {
+    UInt key = Hwi_disable();
+    if (FILL_BLOCK != NULL &&
+        (FILL_BLOCK->len != 0 || FILL_BLOCK->rx_errors != 0)) {
+        commit_fill_block();
+    }
+    Hwi_restore(key);
+}
+
+/**
+ * Takes a free block to fill, and starts the commit Clock. Must be called
+ * from the Hwi, or with interrupts disabled.
+ * @param now: current timebase value
+ * @return true if a block was free, or false otherwise.
+ */
+static bool start_fill_block(uint64_t now) {
+    FILL_BLOCK = log_buffer_get_free();
+    if (FILL_BLOCK == NULL) {
+        return false;
+    }
+    FILL_BLOCK->first_arrival = now;
+    FILL_BLOCK->rx_errors = LOST_RX_ERRORS;
+    LOST_RX_ERRORS = 0;
+    Clock_start(COMMIT_CLOCK);
+    // The block must now be committed within the watchdog limit.
+    wdt_busy(WDT_STAGE_INGEST);
+    return true;
+}
+
+/**
+ * Commits the fill block to the writer. Must be called from the Hwi, or with
+ * interrupts disabled.
+ */
+static void commit_fill_block(void) {
+    Clock_stop(COMMIT_CLOCK);
+    log_buffer_commit(FILL_BLOCK);
+    INGEST_STATS.blocks++;
+    INGEST_STATS.bytes += FILL_BLOCK->len;
+    FILL_BLOCK = NULL;
+    ERROR_RUN = false;
+    wdt_idle(WDT_STAGE_INGEST);
+}
+
+#endif
+
+/**
+ * Records the time spent in the UART Hwi.
+ * @param start: timebase value the Hwi started at
+ */
+static void record_isr(uint64_t start) {
+    uint64_t duration = timebase_now() - start;
+    INGEST_STATS.isr_total += duration;
+    if (duration > INGEST_STATS.isr_max) {
+        INGEST_STATS.isr_max = (uint32_t)duration;
+    }
+}
+
+/**
+ * Counts UART receive errors. Must be called from the Hwi, or with
+ * interrupts disabled.
+ * @param errors: LOG_RXERR_* flags for the errors seen
+ */
+static void count_rx_errors(uint8_t errors) {
+    if (errors & LOG_RXERR_BREAK) {
+        INGEST_STATS.breaks++;
+    }
+    if (errors & LOG_RXERR_FRAMING) {
+        INGEST_STATS.framing++;
+    }
+    if (errors & LOG_RXERR_PARITY) {
+        INGEST_STATS.parity++;
+    }
+    if (errors & LOG_RXERR_OVERRUN) {
+        INGEST_STATS.overruns++;
+    }
+    trace_event(TRACE_UART_ERROR, errors);
+}
+
+/**
+ * Gets statistics on the ingest path.
+ * @param stats: filled with the current statistics.
+ */
+void ingest_stats(IngestStats *stats) {
+    UInt key = Hwi_disable();
+    *stats = INGEST_STATS;
+    Hwi_restore(key);
+}
+
+/**
+ * Gets the name of the receive path in use.
+ * @return "uDMA" or "interrupt".
+ */
+const char *ingest_path_name(void) {
+    return LOG_UART_DMA ? "uDMA" : "interrupt";
+}
+
+/**
+ * Resets the ingest path statistics.
+ */
+void ingest_stats_reset(void) {
+    UInt key = Hwi_disable();
+    INGEST_STATS = (IngestStats){0};
+    INGEST_STATS.since = timebase_now();
+    Hwi_restore(key);
+}
+
+/**
+ * Changes the baud rate of the logged UART. A byte being received during the
+ * change may be lost.
+ * @param baud: new baud rate
+ */
+void ingest_set_baud(uint32_t baud) {
+    Types_FreqHz cpu_freq;
+    UInt key;
+    BIOS_getCpuFreq(&cpu_freq);
+    key = Hwi_disable();
+    // Disables the UART while it is reconfigured, then enables it again.
+    UARTConfigSetExpClk(LOG_UART_BASE, cpu_freq.lo, baud,
+                        UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE |
+                            UART_CONFIG_PAR_NONE);
+#if LOG_UART_DMA
+    BYTE_TICKS = (timebase_freq() * 10) / baud;
+#endif
+    Hwi_restore(key);
+}
+
+/**
+ * Forwards logged data to the CLI, if log forwarding is enabled. The data is
+ * queued for the console task, rather than written out, so the caller never
+ * waits on the console.
+ * @param data: logged data
+ * @param len: length of data
+ */
+void forward_log_data(char *data, int len) {
+    uint32_t head;
+    char *end;
+    int n;
+    // Attempt to lock the log forwarding variable mutex.
+    PROF_ENTER(PROF_LOG_VAR_MUTEX);
+    if (lock_acquire(&LOG_VAR_MUTEX) != 0) {
+        System_abort("Could not lock access to log variables");
+    }
+    PROF_EXIT(PROF_LOG_VAR_MUTEX);
+    head = FWD_HEAD;
+    // If log forwarding was requested, queue the data for the CLI.
+    if (FORWARD_UART_LOGS && !FORWARD_FILTERED) {
+        PROF_ENTER(PROF_FORWARD);
+        if (!forward_put(data, len)) {
+            FWD_DROPPED += len;
+        }
+        PROF_EXIT(PROF_FORWARD);
+    } else if (FORWARD_UART_LOGS) {
+        PROF_ENTER(PROF_FORWARD);
+        while (len > 0) {
+            end = memchr(data, '\n', len);
+            n = end != NULL ? end - data + 1 : len;
+            forward_piece(data, n, end != NULL);
+            data += n;
+            len -= n;
+        }
+        PROF_EXIT(PROF_FORWARD);
+    }
+    // Wake the console to write out the data queued.
+    if (FWD_HEAD != head && CONTEXT->cli_wake != NULL) {
+        CONTEXT->cli_wake();
+    }
+    // Drop the lock on log forwarding vars.
+    lock_release(&LOG_VAR_MUTEX);
+}
+
+/**
+ * Writes the forwarded data queued for the CLI, then a notice of the bytes
+ * dropped as they did not fit, if any were. Called by the console task
+ * while it waits for input, as it may block on the console.
+ */
+void forward_log_drain(void) {
+    CLIContext *context;
+    uint32_t head, dropped;
+    char notice[40];
+    int offset, n;
+    if (lock_acquire(&LOG_VAR_MUTEX) != 0) {
+        System_abort("Could not lock access to log variables");
+    }
+    context = CONTEXT;
+    head = FWD_HEAD;
+    lock_release(&LOG_VAR_MUTEX);
+    if (context == NULL) {
+        return;
+    }
+    while (FWD_TAIL != head) {
+        // Write up to the end of the ring, then wrap.
+        offset = FWD_TAIL % FORWARD_RING_SIZE;
+        n = head - FWD_TAIL;
+        if (n > FORWARD_RING_SIZE - offset) {
+            n = FORWARD_RING_SIZE - offset;
+        }
+        // Only this task takes data out, so the lock is not held meanwhile.
+        context->cli_write(FWD_RING + offset, n);
+        if (lock_acquire(&LOG_VAR_MUTEX) != 0) {
+            System_abort("Could not lock access to log variables");
+        }
+        FWD_TAIL += n;
+        head = FWD_HEAD;
+        lock_release(&LOG_VAR_MUTEX);
+    }
+    if (lock_acquire(&LOG_VAR_MUTEX) != 0) {
+        System_abort("Could not lock access to log variables");
+    }
+    dropped = FWD_DROPPED;
+    FWD_DROPPED = 0;
+    lock_release(&LOG_VAR_MUTEX);
+    if (dropped != 0) {
+        n = snprintf(notice, sizeof(notice), "\r\n[%lu bytes dropped]\r\n",
+                     (unsigned long)dropped);
+        context->cli_write(notice, n);
     }
 }
 
 /**
  * Enables UART log forwarding.
  * @param context: CLI context to log to
+ * @param options: options to forward lines by, or NULL to forward all data
+ * as it arrives
  * @return 0 if log forwarding was enabled, or -1 if another console is already
  * using the forwarding feature.
  */
-int enable_log_forwarding(CLIContext *context) {
+int enable_log_forwarding(CLIContext *context, const ForwardOptions *options) {
     // First, get the mutex lock required for log forwarding.
-    if (pthread_mutex_trylock(&LOG_FORWARD_MUTEX) != 0) {
+    if (lock_try(&LOG_FORWARD_MUTEX) != 0) {
         // Another thread owns the mutex, return.
         return -1;
     }
     // Now, get the mutex lock required to edit the forwarding variables.
-    if (pthread_mutex_lock(&LOG_VAR_MUTEX) != 0) {
+    if (lock_acquire(&LOG_VAR_MUTEX) != 0) {
         System_abort("Could not lock access to log variables");
     }
     // Now that we own the mutex, enable forwarding and set the CLI context.
     FORWARD_UART_LOGS = true;
     CONTEXT = context;
+    FWD_HEAD = 0;
+    FWD_TAIL = 0;
+    FWD_DROPPED = 0;
+    FORWARD_FILTERED = options != NULL;
+    if (FORWARD_FILTERED) {
+        FWD_OPTIONS = *options;
+        FWD_LEN = 0;
+        FWD_DECIDED = false;
+        FWD_MATCHED = 0;
+        FWD_WINDOW = 0;
+        FWD_SENT = 0;
+        FWD_SUPPRESSED = 0;
+    }
+    trace_event(TRACE_FORWARD_ON, 0);
     // Unlock the log variable mutex.
-    pthread_mutex_unlock(&LOG_VAR_MUTEX);
+    lock_release(&LOG_VAR_MUTEX);
     /*
      * Note: do not drop the Mutex here. The CLI task thread holds the mutex
      * until it stops log forwarding, preventing other CLI tasks from starting
@@ -173,7 +845,7 @@ int enable_log_forwarding(CLIContext *context) {
  */
 int disable_log_forwarding(void) { 
     // Lock the forwarding variables mutex.
-    if (pthread_mutex_lock(&LOG_VAR_MUTEX) != 0) {
+    if (lock_acquire(&LOG_VAR_MUTEX) != 0) {
         System_abort("Could not lock access to log variables");
     }
     /*
@@ -181,19 +853,30 @@ int disable_log_forwarding(void) {
      * thread doesn't have log forwarding running, and shouldn't be disabling
      * it.
      */
-    if (pthread_mutex_unlock(&LOG_FORWARD_MUTEX) != 0) { 
+    if (lock_release(&LOG_FORWARD_MUTEX) != 0) { 
         /*
          * Don't edit the log forwarding variables, just drop their mutex 
          * and return.
          */
-        pthread_mutex_unlock(&LOG_VAR_MUTEX);
+        lock_release(&LOG_VAR_MUTEX);
         return -1;
     }
+    // Report lines suppressed since the last notice, before disconnecting.
+    if (FORWARD_FILTERED) {
+        forward_notice();
+    }
     // If we were able to unlock the mutex, reset the log forwarding variables.
     FORWARD_UART_LOGS = false; 
+    lock_release(&LOG_VAR_MUTEX);
+    // Write out the data still queued, which no more is added to.
+    forward_log_drain();
+    if (lock_acquire(&LOG_VAR_MUTEX) != 0) {
+        System_abort("Could not lock access to log variables");
+    }
     CONTEXT = NULL;
+    trace_event(TRACE_FORWARD_OFF, 0);
     // Now, drop the log variable mutex
-    pthread_mutex_unlock(&LOG_VAR_MUTEX);
+    lock_release(&LOG_VAR_MUTEX);
     return 0;
 }
 
@@ -204,5 +887,121 @@ int disable_log_forwarding(void) {
  * @return number of bytes written.
  */
 int write_to_logger(char* data, int len) {
-    return UART_write(uart, data, len);
+    int i;
+    // Transmit is rare and slow, so it is polled rather than interrupt driven.
+    for (i = 0; i < len; i++) {
+        UARTCharPut(LOG_UART_BASE, data[i]);
+    }
+    return len;
+}
+
+/**
+ * Forwards a piece of a line, if the line passes the forwarding options.
+ * Must be called with the log variable mutex held.
+ * @param data: piece of a line
+ * @param len: length of data
+ * @param line_end: true if the piece ends the line
+ */
+static void forward_piece(const char *data, int len, bool line_end) {
+    int n;
+    if (!FWD_DECIDED) {
+        n = FORWARD_LINE_MAXLEN - FWD_LEN;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(FWD_LINE + FWD_LEN, data, n);
+        FWD_LEN += n;
+        data += n;
+        len -= n;
+        // Wait for the rest of the line, unless there is no room for it.
+        if (!line_end && FWD_LEN < FORWARD_LINE_MAXLEN) {
+            return;
+        }
+        FWD_LINE[FWD_LEN] = '\0';
+        FWD_PASS = forward_decide();
+        FWD_DECIDED = true;
+        if (FWD_PASS && !forward_put(FWD_LINE, FWD_LEN)) {
+            // No room for the line, so it is suppressed.
+            FWD_PASS = false;
+            FWD_SUPPRESSED++;
+        }
+    }
+    if (FWD_PASS && len > 0 && !forward_put(data, len)) {
+        // No room for the rest of the line, so it is cut short.
+        FWD_PASS = false;
+        FWD_SUPPRESSED++;
+    }
+    if (line_end) {
+        FWD_LEN = 0;
+        FWD_DECIDED = false;
+    }
+}
+
+/**
+ * Decides if the line in FWD_LINE is forwarded, by the match text, the
+ * sampling and the rate limit, in that order. Lines held back by the rate
+ * limit are counted, and reported before the next line forwarded.
+ * @return true if the line is forwarded.
+ */
+static bool forward_decide(void) {
+    uint64_t now;
+    if (FWD_OPTIONS.match[0] != '\0' &&
+        strstr(FWD_LINE, FWD_OPTIONS.match) == NULL) {
+        return false;
+    }
+    if (FWD_MATCHED++ % FWD_OPTIONS.sample != 0) {
+        return false;
+    }
+    if (FWD_OPTIONS.max_rate != 0) {
+        now = timebase_now();
+        if (FWD_WINDOW == 0 || now - FWD_WINDOW >= timebase_freq()) {
+            FWD_WINDOW = now;
+            FWD_SENT = 0;
+        }
+        if (FWD_SENT == FWD_OPTIONS.max_rate) {
+            FWD_SUPPRESSED++;
+            return false;
+        }
+        FWD_SENT++;
+    }
+    forward_notice();
+    return true;
+}
+
+/**
+ * Queues a notice of the lines suppressed by the rate limit or a full queue
+ * since the last one, if any were. If the notice does not fit, they are
+ * reported later.
+ */
+static void forward_notice(void) {
+    char notice[40];
+    int len;
+    if (FWD_SUPPRESSED == 0) {
+        return;
+    }
+    len = snprintf(notice, sizeof(notice), "[%lu lines suppressed]\r\n",
+                   (unsigned long)FWD_SUPPRESSED);
+    if (forward_put(notice, len)) {
+        FWD_SUPPRESSED = 0;
+    }
+}
+
+/**
+ * Queues forwarded data for the CLI, if all of it fits. Must be called with
+ * the log variable mutex held.
+ * @param data: data to queue
+ * @param len: length of data
+ * @return true if the data was queued, or false if it did not fit.
+ */
+static bool forward_put(const char *data, int len) {
+    int offset, n;
+    if (len > FORWARD_RING_SIZE - (int)(FWD_HEAD - FWD_TAIL)) {
+        return false;
+    }
+    offset = FWD_HEAD % FORWARD_RING_SIZE;
+    n = len < FORWARD_RING_SIZE - offset ? len : FORWARD_RING_SIZE - offset;
+    memcpy(FWD_RING + offset, data, n);
+    memcpy(FWD_RING, data + n, len - n);
+    FWD_HEAD += len;
+    return true;
 }
\ No newline at end of file
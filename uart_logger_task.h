@@ -1,33 +1,118 @@
 /**
  * @file uart_logger.h
- * Implements the task responsible for reading data from a UART, and writing it
- * to an SD card log file.
+ * Implements the receive path for the UART being logged. A Hwi drains the
+ * UART's hardware FIFO directly into log blocks, which the SD writer task
+ * writes to an SD card log file.
  *
  * Pins Required:
- * PD6- UART RX
- * PD7- UART TX
+ * PC6- UART RX
+ * PC7- UART TX
  */
 
 #ifndef UART_LOGGER_TASK_H
 #define UART_LOGGER_TASK_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "cli.h"
 
+typedef struct {
+    /*! number of blocks committed to the writer */
+    uint32_t blocks;
+    /*! bytes dropped because no blocks were free */
+    uint32_t dropped;
+    /*! longest time spent in the UART Hwi, in timebase ticks */
+    uint32_t isr_max;
+    /*! bytes committed to the writer, total time spent in the UART Hwi, and
+     * timebase value the statistics were reset at, for comparing the CPU
+     * load of the receive paths */
+    uint32_t bytes;
+    uint64_t isr_total;
+    uint64_t since;
+    /*! UART receive errors seen. With uDMA, errors reported by one Hwi run
+     * count once. */
+    uint32_t breaks;
+    uint32_t framing;
+    uint32_t parity;
+    uint32_t overruns;
+} IngestStats;
+
+// Longest match text of filtered log forwarding, including the terminator.
+#define FORWARD_MATCH_MAXLEN 32
+
+/*! Options of filtered log forwarding. A line is forwarded if it holds the
+ * match text, is picked by the sampling, and the rate limit allows it. */
+typedef struct {
+    /*! text forwarded lines must hold in their first 128 bytes, or empty
+     * for all lines */
+    char match[FORWARD_MATCH_MAXLEN];
+    /*! forward one in this many matching lines, 1 for all of them */
+    uint32_t sample;
+    /*! most lines forwarded per second, or 0 for no limit */
+    uint32_t max_rate;
+} ForwardOptions;
+
 /*
- * PreOS Task for UART logger. Sets up uart instance for data transmission,
+ * PreOS setup for UART logger. Sets up the UART and its interrupt,
  * This code MUST be called before the BIOS is started.
  */
 void uart_logger_prebios(void);
 
+/**
+ * Gets statistics on the ingest path.
+ * @param stats: filled with the current statistics.
+ */
+void ingest_stats(IngestStats *stats);
+
+/**
+ * Gets the name of the receive path in use.
+ * @return "uDMA" or "interrupt".
+ */
+const char *ingest_path_name(void);
+
+/**
+ * Resets the ingest path statistics.
+ */
+void ingest_stats_reset(void);
+
+/**
+ * Changes the baud rate of the logged UART. A byte being received during the
+ * change may be lost.
+ * @param baud: new baud rate
+ */
+void ingest_set_baud(uint32_t baud);
+
+/**
+ * Forwards logged data to the CLI, if log forwarding is enabled. Data is
+ * forwarded as received, ahead of the processing pipeline. Should only be
+ * called by the SD writer, as filtered forwarding assembles lines across
+ * calls. The data is queued and the CLI context's cli_wake called, so the
+ * writer never waits on console output. Data that does not fit in the queue
+ * is dropped, and noted on the console, or with filtering, counted in the
+ * lines suppressed.
+ * @param data: logged data
+ * @param len: length of data
+ */
+void forward_log_data(char *data, int len);
+
+/**
+ * Writes the forwarded data queued for the CLI, then a notice of the bytes
+ * dropped as they did not fit, if any were. Called by the console task
+ * while it waits for input, as it may block on the console.
+ */
+void forward_log_drain(void);
+
 /**
  * Enables UART log forwarding.
  * @param context: CLI context to log to
+ * @param options: options to forward lines by, or NULL to forward all data
+ * as it arrives. Filtered lines are forwarded once complete, so a prompt
+ * without a line ending is not shown until the line ends.
  * @return 0 if log forwarding was enabled, or -1 if another console is already
  * using the forwarding feature.
  */
-int enable_log_forwarding(CLIContext *context);
+int enable_log_forwarding(CLIContext *context, const ForwardOptions *options);
 
 /**
  * Disables UART log forwarding.  